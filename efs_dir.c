@@ -22,22 +22,58 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <stddef.h>
 
 #include <pthread.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "utils.h"
 #include "efs_vol.h"
+#include "efs_mem.h"
+#include "efs_stats.h"
+#include "efs_probes.h"
+#include "efs_mrc.h"
 
 #include "efs_dir.h"
 
 typedef struct name_cache_item {
 	const char *path;
+	uint32_t hash;
 	efs_inode_t *ino;
 	struct name_cache_item *next;
 } name_cache_item_t;
 
-name_cache_item_t *ncache = NULL;
-static pthread_mutex_t ncache_mtx = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Name cache. Like the inode cache, it is a hash table with striped
+ * read-write locks and no lock is held during the path walk itself.
+ */
+#define	NCACHE_BUCKETS	4096	/* power of 2 */
+#define	NCACHE_LOCKS	64	/* power of 2 */
+#define	NCACHE_LOCK(nc, h)	(&(nc)->nc_locks[(h) & (NCACHE_LOCKS - 1)])
+
+struct efs_ncache {
+	name_cache_item_t *nc_hash[NCACHE_BUCKETS];
+	pthread_rwlock_t nc_locks[NCACHE_LOCKS];
+	pthread_mutex_t	nc_alloc_mtx;
+	efs_pool_t	nc_pool;
+	efs_arena_t	nc_names;	/* paths of ncache items */
+};
+
+static pthread_mutex_t dsnap_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* Number of entries compared at once by efs_dir_snap_find() */
+#if defined(__AVX2__)
+#define	DS_SCAN_WIDTH	32
+#elif defined(__SSE2__)
+#define	DS_SCAN_WIDTH	16
+#else
+#define	DS_SCAN_WIDTH	8
+#endif
+#define	DS_SCAN_PAD	32	/* multiple of any DS_SCAN_WIDTH */
 
 #ifdef EFS_DEBUG
 static void
@@ -73,101 +109,180 @@ efs_print_dir(char *buf)
 }
 #endif
 
-static int
-efs_db_lookup(efs_dirblk_t *db, char *name, uint32_t *ino)
+/*
+ * Returns a pointer to the name of the n-th entry of the directory block and
+ * its length. Nothing is copied, the name lives as long as the block does.
+ */
+int
+efs_dir_get_dirent(efs_dirblk_t *db, int n, uint32_t *ino, const char **name,
+    int *namelen)
 {
-	uint16_t magic = GET_U16(db->db_magic);
-	size_t name_len = strlen(name);
-	int i;
+	efs_dirent_t *de;
+	int offset;
 
-	if (magic != EFS_DIRBLK_MAGIC) {
+	if (GET_U16(db->db_magic) != EFS_DIRBLK_MAGIC) {
 		LOG_ERR("%s: wrong dirblk magic 0x%x\n", __func__,
 		    GET_U16(db->db_magic));
 		return (ENXIO);
 	}
+	if (n < 0 || n >= db->db_slots)
+		return (ENOENT);
 
-	for (i = 0; i < db->db_slots; i++) {
-		int ofs = (db->db_space[i]) << 1;
-		efs_dirent_t *de;
-
-		if (ofs == 0)
-			continue;
-		de = (efs_dirent_t *)((char *)db + ofs);
-		if (name_len != de->de_namelen)
-			continue;
-		if (strncmp(name, (const char *)&de->de_name,
-		    de->de_namelen) == 0) {
-			*ino = GET_U32(de->de_ino);
-			return (0);
-		}
+	offset = db->db_space[n] << 1;
+	if (offset == 0)
+		return (ENOENT);	/* unused slot */
+	de = (efs_dirent_t *)((char *)db + offset);
+	if (offset + offsetof(efs_dirent_t, de_name) + de->de_namelen > BBS) {
+		LOG_ERR("%s: slot %d points beyond the block\n", __func__, n);
+		return (ENXIO);
 	}
-	return (ENOENT);
+	*ino = GET_U32(de->de_ino);
+	*name = de->de_name;
+	*namelen = de->de_namelen;
+
+	return (0);
 }
 
 int
-efs_dir_get_dirent(efs_dirblk_t *db, int n, uint32_t *ino, char **name)
+efs_dir_iter_init(efs_dir_iter_t *it, efs_dirblk_t *db, int slot)
 {
-	efs_dirent_t *de;
-	char *nm;
-	int offset;
-
 	if (GET_U16(db->db_magic) != EFS_DIRBLK_MAGIC) {
 		LOG_ERR("%s: wrong dirblk magic 0x%x\n", __func__,
 		    GET_U16(db->db_magic));
 		return (ENXIO);
 	}
-	if (n < 0 || n >= db->db_slots)
-		return (ENOENT);
-
-	offset = db->db_space[n] << 1;
-	de = (efs_dirent_t *)((char *)db + offset);
-	*ino = GET_U32(de->de_ino);
-	nm = malloc(de->de_namelen + 1);
-	strncpy(nm, de->de_name, de->de_namelen);
-	nm[de->de_namelen] = '\0';
-	*name = nm;
+	it->di_db = db;
+	it->di_slot = slot;
 
 	return (0);
 }
 
+/*
+ * Returns the next used slot, skipping the empty ones. ENOENT means the end
+ * of the block was reached.
+ */
+int
+efs_dir_iter_next(efs_dir_iter_t *it, uint32_t *ino, const char **name,
+    int *namelen)
+{
+	int err;
+
+	while (it->di_slot < it->di_db->db_slots) {
+		err = efs_dir_get_dirent(it->di_db, it->di_slot++, ino, name,
+		    namelen);
+		if (err != ENOENT)
+			return (err);
+	}
+
+	return (ENOENT);
+}
+
+static uint32_t
+ncache_hash(const char *nm)
+{
+	uint32_t h = 2166136261u;
+
+	while (*nm != '\0') {
+		h ^= (uint8_t)*nm++;
+		h *= 16777619u;
+	}
+	return (h);
+}
+
 static efs_inode_t *
-ncache_search(const char *nm)
+ncache_search(efs_fs_t *fs, const char *nm, uint32_t hash)
 {
+	efs_ncache_t *nc = fs->ncache;
+	uint32_t b = hash & (NCACHE_BUCKETS - 1);
 	name_cache_item_t *ci;
+	efs_inode_t *inode = NULL;
 
-	for (ci = ncache; ci != NULL; ci = ci->next) {
-		if (strcmp(ci->path, nm) == 0)
-			return (ci->ino);
+	pthread_rwlock_rdlock(NCACHE_LOCK(nc, b));
+	for (ci = nc->nc_hash[b]; ci != NULL; ci = ci->next) {
+		if (ci->hash == hash && strcmp(ci->path, nm) == 0) {
+			inode = ci->ino;
+			break;
+		}
 	}
-	return (NULL);
+	pthread_rwlock_unlock(NCACHE_LOCK(nc, b));
+
+	return (inode);
 }
 
 static void
-ncache_add(const char *nm, efs_inode_t *inode)
+ncache_add(efs_fs_t *fs, const char *nm, uint32_t hash, efs_inode_t *inode)
 {
+	efs_ncache_t *nc = fs->ncache;
+	uint32_t b = hash & (NCACHE_BUCKETS - 1);
 	name_cache_item_t *ci;
 
-	LOG_DBG2(inode->i_fs, "%s: adding inode %d for '%s'\n",
+	LOG_DBG2(fs, "%s: adding inode %d for '%s'\n",
 	    __func__, inode->i_num, nm);
 
-	if ((ci = malloc(sizeof (*ci))) == NULL)
-		return;
-	ci->path = strdup(nm);
-	ci->ino = inode;
-	ci->next = ncache;
-	ncache = ci;
+	pthread_rwlock_wrlock(NCACHE_LOCK(nc, b));
+	for (ci = nc->nc_hash[b]; ci != NULL; ci = ci->next) {
+		if (ci->hash == hash && strcmp(ci->path, nm) == 0) {
+			/* added by another thread */
+			pthread_rwlock_unlock(NCACHE_LOCK(nc, b));
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&nc->nc_alloc_mtx);
+	if ((ci = efs_pool_alloc(&nc->nc_pool)) != NULL &&
+	    (ci->path = efs_arena_strdup(&nc->nc_names, nm)) == NULL) {
+		efs_pool_free(&nc->nc_pool, ci);
+		ci = NULL;
+	}
+	pthread_mutex_unlock(&nc->nc_alloc_mtx);
+
+	if (ci != NULL) {
+		ci->hash = hash;
+		ci->ino = inode;
+		ci->next = nc->nc_hash[b];
+		nc->nc_hash[b] = ci;
+	}
+	pthread_rwlock_unlock(NCACHE_LOCK(nc, b));
+
+	if (ci != NULL) {
+		EFS_STAT_ADD(EFS_STAT_NCACHE_MEM, sizeof (*ci) +
+		    strlen(nm) + 1);
+	}
+}
+
+int
+ncache_create(efs_fs_t *fs)
+{
+	efs_ncache_t *nc;
+
+	if ((nc = calloc(1, sizeof (efs_ncache_t))) == NULL)
+		return (ENOMEM);
+	for (int l = 0; l < NCACHE_LOCKS; l++)
+		(void) pthread_rwlock_init(&nc->nc_locks[l], NULL);
+	(void) pthread_mutex_init(&nc->nc_alloc_mtx, NULL);
+	nc->nc_pool = (efs_pool_t)EFS_POOL_INITIALIZER(
+	    sizeof (name_cache_item_t), 256);
+	efs_arena_init(&nc->nc_names);
+	fs->ncache = nc;
+
+	return (0);
 }
 
 void
-ncache_destroy(void)
+ncache_destroy(efs_fs_t *fs)
 {
-	name_cache_item_t *ci = ncache;
+	efs_ncache_t *nc = fs->ncache;
 
-	while (ci != NULL) {
-		name_cache_item_t *next = ci->next;
-		free(ci);
-		ci = next;
-	}
+	if (nc == NULL)
+		return;
+
+	efs_pool_destroy(&nc->nc_pool);
+	efs_arena_destroy(&nc->nc_names);
+	for (int l = 0; l < NCACHE_LOCKS; l++)
+		(void) pthread_rwlock_destroy(&nc->nc_locks[l]);
+	(void) pthread_mutex_destroy(&nc->nc_alloc_mtx);
+	free(nc);
+	fs->ncache = NULL;
 }
 
 int
@@ -175,23 +290,29 @@ efs_dir_namei(efs_fs_t *fs, const char *nm, efs_inode_t **ino)
 {
 	efs_inode_t *inode = NULL;
 	uint32_t cur_ino = FIRST_INO;
+	uint32_t hash = ncache_hash(nm);
+	efs_arena_t arena;
 	char *path;
 	char *cur;
 	int err = 0;
 
 	/* Try the cache first */
-	pthread_mutex_lock(&ncache_mtx);
-	if ((inode = ncache_search(nm)) != NULL) {
+	EFS_MRC_REF(EFS_MRC_NAME, hash);
+	if ((inode = ncache_search(fs, nm, hash)) != NULL) {
+		EFS_STAT_INC(EFS_STAT_NCACHE_HIT);
+		EFS_PROBE2(ncache__hit, nm, inode->i_num);
 		LOG_DBG2(fs, "%s: found cached inode %d for '%s'\n", __func__,
-		    inode, nm);
+		    inode->i_num, nm);
 		*ino = inode;
-		goto out;
+		return (0);
 	}
 
-	if ((path = strdup(nm)) == NULL) {
-		err = ENOMEM;
-		goto out;
-	}
+	EFS_STAT_INC(EFS_STAT_NCACHE_MISS);
+	EFS_PROBE1(ncache__miss, nm);
+
+	efs_arena_init(&arena);
+	if ((path = efs_arena_strdup(&arena, nm)) == NULL)
+		return (ENOMEM);
 
 	assert(path[0] == '/');	/* Must be an absolute path */
 
@@ -228,77 +349,299 @@ efs_dir_namei(efs_fs_t *fs, const char *nm, efs_inode_t **ino)
 		}
 	}
 
-	free(path);
+	efs_arena_destroy(&arena);
 
 	if (err == 0) {
-		ncache_add(nm, inode);
+		ncache_add(fs, nm, hash, inode);
 		*ino = inode;
 		LOG_DBG2(fs, "found inode %d for '%s'\n", inode->i_num, nm);
 	}
-out:
-	pthread_mutex_unlock(&ncache_mtx);
 	if (err != 0)
 		LOG_DBG2(fs, "%s: failed for '%s' with %d\n",
 		    __func__, nm, err);
 	return (err);
 }
 
-callback_state_t
-dir_lookup_cb(efs_inode_t *inode, uint32_t blkno, uint32_t offset,
-    void *arg)
+int
+efs_dir_lookup(efs_inode_t *inode, char *nm, uint32_t *ino)
 {
-	dir_lookup_arg_t *dl = (dir_lookup_arg_t *)arg;
-	efs_dirblk_t *db;
-	int ret;
+	efs_dir_snap_t *ds;
+	int err;
 
-	if ((db = malloc(BBS)) == NULL)
-		return (ENOMEM);
+	assert(inode != NULL);
+	LOG_DBG1(inode->i_fs, "%s: searcing '%s' in dir inode %d\n", __func__,
+	    nm, inode->i_num);
 
-	if ((ret = efs_bread_bbs(inode->i_fs, blkno, db, 1)) != 0)
-		return (ERROR);
+	if (!IS_DIR(inode))
+		return (ENOTDIR);
+
+	if ((err = efs_dir_snap_get(inode, &ds)) != 0)
+		return (err);
+	err = efs_dir_snap_find(ds, nm, strlen(nm), ino);
+	efs_dir_snap_rele(ds);
+
+	if (err == 0) {
+		LOG_DBG1(inode->i_fs, "%s: found inode %d\n", __func__, *ino);
+	}
+
+	return (err);
+}
+
+static void
+dir_snap_free(efs_dir_snap_t *ds)
+{
+	free(ds->ds_entries);
+	free(ds->ds_names);
+	free(ds->ds_lens);
+	free(ds);
+}
+
+/* 8-bit FNV-1a based fingerprint of a name. */
+static inline uint8_t
+dir_name_fp(const char *nm, int len)
+{
+	uint32_t h = 2166136261u;
+
+	for (int i = 0; i < len; i++) {
+		h ^= (uint8_t)nm[i];
+		h *= 16777619u;
+	}
+	return (h ^ (h >> 8) ^ (h >> 16) ^ (h >> 24));
+}
+
+/*
+ * Builds the packed per-entry length and fingerprint arrays. They are padded
+ * to a multiple of DS_SCAN_PAD with zero lengths which never match.
+ */
+static int
+dir_snap_fingerprint(efs_dir_snap_t *ds)
+{
+	uint32_t n = (ds->ds_nentries + DS_SCAN_PAD - 1) & ~(DS_SCAN_PAD - 1);
 
-	ret = efs_db_lookup(db, dl->dl_name, &dl->dl_ino);
-	free(db);
-	LOG_DBG2(inode->i_fs, "%s: inode %d, blkno %d, offset %d, name '%s'."
-	    "Got %d\n", __func__, inode->i_num, blkno, offset, dl->dl_name,
-	    ret);
+	if ((ds->ds_lens = calloc(2, MAX(n, DS_SCAN_PAD))) == NULL)
+		return (ENOMEM);
+	ds->ds_size += 2 * MAX(n, DS_SCAN_PAD);
+	ds->ds_fps = ds->ds_lens + MAX(n, DS_SCAN_PAD);
 
-	if (ret == ENOENT)
-		return (CONTINUE);
-	if (ret != 0) {
-		dl->dl_error = ret;
-		return (ERROR);
+	for (uint32_t k = 0; k < ds->ds_nentries; k++) {
+		ds->ds_lens[k] = ds->ds_entries[k].dse_namelen;
+		ds->ds_fps[k] = dir_name_fp(DS_NAME(ds, k),
+		    ds->ds_entries[k].dse_namelen);
 	}
 
-	/* name found */
-	assert(dl->dl_ino > 0);
-	return (STOP);
+	return (0);
 }
 
+/*
+ * Returns a bit mask of the entries among the DS_SCAN_WIDTH ones starting at
+ * lens/fps whose length and fingerprint both match.
+ */
+static inline uint32_t
+dir_scan_match(const uint8_t *lens, const uint8_t *fps, uint8_t len,
+    uint8_t fp)
+{
+#if defined(__AVX2__)
+	__m256i l = _mm256_loadu_si256((const __m256i *)lens);
+	__m256i f = _mm256_loadu_si256((const __m256i *)fps);
+	__m256i m = _mm256_and_si256(
+	    _mm256_cmpeq_epi8(l, _mm256_set1_epi8(len)),
+	    _mm256_cmpeq_epi8(f, _mm256_set1_epi8(fp)));
+
+	return ((uint32_t)_mm256_movemask_epi8(m));
+#elif defined(__SSE2__)
+	__m128i l = _mm_loadu_si128((const __m128i *)lens);
+	__m128i f = _mm_loadu_si128((const __m128i *)fps);
+	__m128i m = _mm_and_si128(_mm_cmpeq_epi8(l, _mm_set1_epi8(len)),
+	    _mm_cmpeq_epi8(f, _mm_set1_epi8(fp)));
+
+	return ((uint32_t)_mm_movemask_epi8(m));
+#else
+	uint32_t mask = 0;
+
+	for (int i = 0; i < DS_SCAN_WIDTH; i++) {
+		if (lens[i] == len && fps[i] == fp)
+			mask |= 1u << i;
+	}
+	return (mask);
+#endif
+}
+
+/*
+ * Finds a name in the decoded directory. Candidates are filtered by length
+ * and fingerprint, DS_SCAN_WIDTH entries at a time, and only those are
+ * compared in full.
+ */
 int
-efs_dir_lookup(efs_inode_t *inode, char *nm, uint32_t *ino)
+efs_dir_snap_find(efs_dir_snap_t *ds, const char *nm, size_t len,
+    uint32_t *ino)
 {
-	dir_lookup_arg_t arg = { 0 };
+	uint8_t fp;
 
-	arg.dl_name = nm;
-	arg.dl_ino = 0;
+	if (len == 0 || len > EFS_NAME_MAX)
+		return (ENOENT);
+	fp = dir_name_fp(nm, len);
 
-	assert(inode != NULL);
-	LOG_DBG1(inode->i_fs, "%s: searcing '%s' in dir inode %d\n", __func__,
-	    nm, inode->i_num);
+	for (uint32_t base = 0; base < ds->ds_nentries;
+	    base += DS_SCAN_WIDTH) {
+		uint32_t mask = dir_scan_match(&ds->ds_lens[base],
+		    &ds->ds_fps[base], len, fp);
+
+		while (mask != 0) {
+			uint32_t idx = base + __builtin_ctz(mask);
+
+			if (memcmp(DS_NAME(ds, idx), nm, len) == 0) {
+				*ino = ds->ds_entries[idx].dse_ino;
+				return (0);
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	return (ENOENT);
+}
+
+static int
+dir_snap_add(efs_dir_snap_t *ds, uint32_t ino, const char *nm, int nlen,
+    uint32_t *max_entries, uint32_t *names_size, uint32_t *names_used)
+{
+	efs_dir_entry_t *e;
+
+	if (ds->ds_nentries == *max_entries) {
+		uint32_t n = MAX(*max_entries * 2, EFS_DIRBLK_SLOTS_MAX);
+
+		if ((e = realloc(ds->ds_entries, n * sizeof (*e))) == NULL)
+			return (ENOMEM);
+		ds->ds_entries = e;
+		*max_entries = n;
+	}
+	if (*names_used + nlen + 1 > *names_size) {
+		uint32_t n = MAX(*names_size * 2, BBS);
+		char *names;
+
+		if ((names = realloc(ds->ds_names, n)) == NULL)
+			return (ENOMEM);
+		ds->ds_names = names;
+		*names_size = n;
+	}
+
+	e = &ds->ds_entries[ds->ds_nentries++];
+	e->dse_ino = ino;
+	e->dse_name = *names_used;
+	e->dse_namelen = nlen;
+	memcpy(&ds->ds_names[*names_used], nm, nlen);
+	ds->ds_names[*names_used + nlen] = '\0';
+	*names_used += nlen + 1;
+
+	return (0);
+}
+
+static int
+dir_snap_build(efs_inode_t *inode, efs_dir_snap_t **snap)
+{
+	efs_dir_snap_t *ds;
+	uint32_t max_entries = 0;
+	uint32_t names_size = 0;
+	uint32_t names_used = 0;
+	int err = 0;
+
+	if ((ds = calloc(1, sizeof (*ds))) == NULL)
+		return (ENOMEM);
+	ds->ds_inode = inode;
+
+	for (uint32_t blkno = 0; blkno < inode->i_nblks && err == 0; blkno++) {
+		efs_dirblk_t db;
+		efs_dir_iter_t it;
+		const char *nm;
+		uint32_t ino;
+		int nlen;
+
+		if ((err = efs_iread(inode, blkno, 1, &db)) != 0) {
+			LOG_ERR("%s: cannot read block %u of dir inode %u, "
+			    "error: %d\n", __func__, blkno, inode->i_num, err);
+			break;
+		}
+		if ((err = efs_dir_iter_init(&it, &db, 0)) != 0)
+			break;
+		while ((err = efs_dir_iter_next(&it, &ino, &nm, &nlen)) == 0) {
+			err = dir_snap_add(ds, ino, nm, nlen, &max_entries,
+			    &names_size, &names_used);
+			if (err != 0)
+				break;
+		}
+		if (err == ENOENT)
+			err = 0;
+	}
+
+	ds->ds_size = sizeof (*ds) + max_entries * sizeof (efs_dir_entry_t) +
+	    names_size;
+	if (err == 0)
+		err = dir_snap_fingerprint(ds);
+	if (err != 0) {
+		dir_snap_free(ds);
+		return (err);
+	}
+
+	LOG_DBG1(inode->i_fs, "%s: dir inode %u has %u entries\n", __func__,
+	    inode->i_num, ds->ds_nentries);
+	*snap = ds;
+
+	return (0);
+}
+
+/*
+ * Returns the decoded directory, building it if there is none yet. The
+ * directory blocks are read without dsnap_mtx held; if two threads race,
+ * the loser frees its copy. The inode keeps a reference of its own, so the
+ * decoded directory stays cached until the file system is unmounted.
+ */
+int
+efs_dir_snap_get(efs_inode_t *inode, efs_dir_snap_t **snap)
+{
+	efs_dir_snap_t *ds;
+	int err;
 
 	if (!IS_DIR(inode))
 		return (ENOTDIR);
 
-	(void) efs_walk(inode, 0, 0, dir_lookup_cb, &arg);
-
-	if (arg.dl_ino != 0) {
-		assert(arg.dl_error == 0);
-		*ino = arg.dl_ino;
-		LOG_DBG1(inode->i_fs, "%s: found inode %d\n", __func__,
-		    arg.dl_ino);
+	pthread_mutex_lock(&dsnap_mtx);
+	if ((ds = inode->i_dsnap) != NULL) {
+		ds->ds_refcnt++;
+		pthread_mutex_unlock(&dsnap_mtx);
+		EFS_STAT_INC(EFS_STAT_DSNAP_HIT);
+		*snap = ds;
 		return (0);
 	}
+	pthread_mutex_unlock(&dsnap_mtx);
+	EFS_STAT_INC(EFS_STAT_DSNAP_MISS);
+
+	if ((err = dir_snap_build(inode, &ds)) != 0)
+		return (err);
+
+	pthread_mutex_lock(&dsnap_mtx);
+	if (inode->i_dsnap != NULL) {
+		dir_snap_free(ds);
+		ds = inode->i_dsnap;
+	} else {
+		inode->i_dsnap = ds;
+		ds->ds_refcnt++;	/* the inode's reference */
+		EFS_STAT_ADD(EFS_STAT_DSNAP_MEM, ds->ds_size);
+	}
+	ds->ds_refcnt++;
+	pthread_mutex_unlock(&dsnap_mtx);
 
-	return (ENOENT);
+	*snap = ds;
+	return (0);
+}
+
+void
+efs_dir_snap_rele(efs_dir_snap_t *ds)
+{
+	pthread_mutex_lock(&dsnap_mtx);
+	assert(ds->ds_refcnt > 0);
+	if (--ds->ds_refcnt == 0) {
+		EFS_STAT_ADD(EFS_STAT_DSNAP_MEM, -ds->ds_size);
+		ds->ds_inode->i_dsnap = NULL;
+		dir_snap_free(ds);
+	}
+	pthread_mutex_unlock(&dsnap_mtx);
 }
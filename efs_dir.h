@@ -33,6 +33,8 @@
 
 #define	EFS_DIR_ENTRY_MOD	(EFS_DIRBLK_SLOTS_MAX + 1)
 
+#define	EFS_NAME_MAX		255
+
 typedef struct efs_dirblk {
 	uint16_t db_magic;
 	uint8_t db_first;
@@ -47,21 +49,60 @@ typedef struct efs_dirent {
 	char de_name[1];
 } efs_dirent_t;
 
-typedef struct dir_lookup_arg {
-	char *dl_name;
-	uint32_t dl_ino;
-	int dl_error;
-} dir_lookup_arg_t;
+/*
+ * Iterator over the used slots of a directory block. It returns pointers
+ * into the block, the names are not NUL terminated.
+ */
+typedef struct efs_dir_iter {
+	efs_dirblk_t *di_db;
+	int di_slot;		/* next slot to examine */
+} efs_dir_iter_t;
+
+/*
+ * Decoded directory. All entries of a directory are read once and kept in a
+ * compact array, names are stored NUL terminated in ds_names. ds_lens and
+ * ds_fps hold the name length and an 8-bit name hash of every entry, packed
+ * so that lookups can compare many entries at once. A snapshot is shared by
+ * all users of the directory and freed with the last reference.
+ */
+typedef struct efs_dir_entry {
+	uint32_t dse_ino;
+	uint32_t dse_name;	/* offset of the name in ds_names */
+	uint8_t dse_namelen;
+} efs_dir_entry_t;
+
+typedef struct efs_dir_snap {
+	efs_inode_t *ds_inode;		/* directory inode */
+	uint32_t ds_nentries;
+	efs_dir_entry_t *ds_entries;
+	char *ds_names;
+	uint8_t *ds_lens;		/* packed name lengths */
+	uint8_t *ds_fps;		/* packed name fingerprints */
+	size_t ds_size;			/* bytes allocated */
+	int ds_refcnt;
+} efs_dir_snap_t;
+
+#define	DS_NAME(ds, n)	(&(ds)->ds_names[(ds)->ds_entries[n].dse_name])
 
 typedef int (*dir_walker_t)(efs_dirblk_t *db, uint32_t blkno, void *arg);
 
-int efs_dir_get_dirent(efs_dirblk_t *db, int n, uint32_t *ino, char **name);
+int efs_dir_get_dirent(efs_dirblk_t *db, int n, uint32_t *ino,
+    const char **name, int *namelen);
+int efs_dir_iter_init(efs_dir_iter_t *it, efs_dirblk_t *db, int slot);
+int efs_dir_iter_next(efs_dir_iter_t *it, uint32_t *ino, const char **name,
+    int *namelen);
 int efs_dir_namei(efs_fs_t *fs, const char *nm, efs_inode_t **ino);
 int efs_dir_walker(efs_inode_t *inode, dir_walker_t w, void *arg);
 
 int efs_dir_lookup(efs_inode_t *inode, char *nm, uint32_t *ino);
 
-void ncache_destroy(void);
+int efs_dir_snap_get(efs_inode_t *inode, efs_dir_snap_t **snap);
+void efs_dir_snap_rele(efs_dir_snap_t *snap);
+int efs_dir_snap_find(efs_dir_snap_t *snap, const char *nm, size_t len,
+    uint32_t *ino);
+
+int ncache_create(efs_fs_t *fs);
+void ncache_destroy(efs_fs_t *fs);
 
 
 #endif /* EFS_DIR_H */
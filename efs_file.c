@@ -17,6 +17,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define	_GNU_SOURCE	/* SEEK_DATA, SEEK_HOLE */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -24,15 +26,36 @@
 #include <errno.h>
 #include <assert.h>
 #include <pthread.h>
+#include <sys/sysmacros.h>
 
 #include "utils.h"
 #include "efs_vol.h"
 #include "efs_dir.h"
+#include "efs_mem.h"
+#include "efs_stats.h"
+#include "efs_trace.h"
+#include "efs_probes.h"
+#include "efs_mrc.h"
 
 #include "efs_file.h"
 
-static efs_inode_t *icache = NULL;
-static pthread_mutex_t icache_mtx = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Inode cache. A hash table whose buckets are protected by a set of striped
+ * read-write locks. Locks are never held across I/O: a missing inode is read
+ * and decoded unlocked and then inserted; if another thread inserted the
+ * same inode in the meantime, the new copy is dropped.
+ */
+#define	ICACHE_BUCKETS	4096	/* power of 2 */
+#define	ICACHE_LOCKS	64	/* power of 2 */
+#define	ICACHE_HASH(ino)	(((ino) * 2654435761u) & (ICACHE_BUCKETS - 1))
+#define	ICACHE_LOCK(ic, h)	(&(ic)->ic_locks[(h) & (ICACHE_LOCKS - 1)])
+
+struct efs_icache {
+	efs_inode_t	*ic_hash[ICACHE_BUCKETS];
+	pthread_rwlock_t ic_locks[ICACHE_LOCKS];
+	pthread_mutex_t	ic_pool_mtx;
+	efs_pool_t	ic_pool;
+};
 
 static void
 efs_inode_stat(efs_inode_t *inode,  struct stat *stbuf)
@@ -58,38 +81,51 @@ efs_inode_stat(efs_inode_t *inode,  struct stat *stbuf)
 	    stbuf->st_blocks);
 }
 
+/*
+ * Decodes the extents stored in an indirect extent of nbbs BBs at indblkno.
+ * Only the first *extn to n extents of the file are valid.
+ */
 static int
-efs_inode_load_indirect(efs_inode_t *inode, uint32_t indblkno,
-    efs_extent_t *ext, int *extn)
+efs_inode_load_indirect(efs_inode_t *inode, uint32_t indblkno, int nbbs,
+    efs_extent_t *ext, int n, int *extn)
 {
-	efs_od_extent_t indext[BBS / sizeof (efs_od_extent_t)];
+	efs_od_extent_t *indext;
+	int cnt;
 	int ret;
 
-	LOG_DBG2(inode->i_fs, "%s: indblkno=%d, extn=%d\n", __func__,
-	    indblkno, *extn);
+	LOG_DBG2(inode->i_fs, "%s: indblkno=%d, nbbs=%d, extn=%d\n", __func__,
+	    indblkno, nbbs, *extn);
 
-	if ((ret = efs_bread_bbs(inode->i_fs, indblkno, indext, 1)) != 0)
+	if ((indext = malloc(nbbs * BBS)) == NULL)
+		return (ENOMEM);
+	if ((ret = efs_bread_bbs(inode->i_fs, indblkno, indext, nbbs)) != 0) {
+		free(indext);
 		return (ret);
+	}
 
-	for (int i = 0; i < EFS_EXTENTS_PER_BB; i++) {
+	cnt = MIN(nbbs * (int)EFS_EXTENTS_PER_BB, n - *extn);
+	for (int i = 0; i < cnt; i++) {
 		uint32_t ext1 = GET_U32(indext[i].ext1);
 		uint32_t ext2 = GET_U32(indext[i].ext2);
+		efs_extent_t *e = &ext[*extn];
+
 		if (EXT_MAGIC(ext1) != 0) {
-			LOG_ERR("inode %d, extent %d has wrong magic 0x%x\n",
-			    __func__, inode->i_num, i, EXT_MAGIC(ext1));
+			LOG_ERR("%s: inode %d, extent %d has wrong magic 0x%x\n",
+			    __func__, inode->i_num, *extn, EXT_MAGIC(ext1));
+			ret = EINVAL;
 			break;
 		}
-		ext[i].e_blk = EXT_BN(ext1);
-		ext[i].e_len = EXT_LEN(ext2);
-		ext[i].e_offset = EXT_OFFSET(ext2);
+		e->e_blk = EXT_BN(ext1);
+		e->e_len = EXT_LEN(ext2);
+		e->e_offset = EXT_OFFSET(ext2);
 		(*extn)++;
 
-		LOG_DBG2(inode->i_fs, "%02d: %d -> %d - %d\n", i,
-		    ext[i].e_offset, ext[i].e_blk,
-		    ext[i].e_blk + ext[i].e_len - 1);
+		LOG_DBG2(inode->i_fs, "%02d: %d -> %d - %d\n", *extn - 1,
+		    e->e_offset, e->e_blk, e->e_blk + e->e_len - 1);
 	}
 
-	return (0);
+	free(indext);
+	return (ret);
 }
 
 static int
@@ -121,10 +157,10 @@ static int
 efs_inode_load_extents(efs_inode_t *inode)
 {
 	uint16_t n = GET_I16(inode->i_od.di_nextents);
-	boolean_t direct = (n <= EFS_DIRECTEXTENTS);
+	int direct = (n <= EFS_DIRECTEXTENTS);
 	efs_extent_t *ext;
-	int max_extn;	/* max number of extents (for indirect blocks ) */
-	int extn;	/* actual number of extents */
+	int nind;	/* number of indirect extents */
+	int extn;	/* number of extents loaded */
 	int err;
 
 	if (direct) {
@@ -132,7 +168,7 @@ efs_inode_load_extents(efs_inode_t *inode)
 		if ((ext = calloc(n, sizeof (efs_extent_t))) == NULL)
 			return (ENOMEM);
 
-		LOG_DBG2(inode->i_fs, "%s: inode %d has %n direct extents",
+		LOG_DBG2(inode->i_fs, "%s: inode %d has %d direct extents\n",
 		    __func__, inode->i_num, n);
 
 		for (int i = 0; i < n; i++) {
@@ -160,29 +196,45 @@ efs_inode_load_extents(efs_inode_t *inode)
 		return (0);
 	}
 
-	n = EXT_OFFSET(GET_U32(inode->i_od.di_u.di_extents[0].ext2));
+	/*
+	 * The direct extents point to the indirect ones, their number is kept
+	 * in the offset of the first one. The file extents are packed across
+	 * all of them.
+	 */
+	nind = EXT_OFFSET(GET_U32(inode->i_od.di_u.di_extents[0].ext2));
+	if (nind == 0 || nind > EFS_DIRECTEXTENTS) {
+		LOG_ERR("%s: inode %d has %d indirect extents\n", __func__,
+		    inode->i_num, nind);
+		return (EINVAL);
+	}
 	extn = 0;
-	max_extn = n * EFS_EXTENTS_PER_BB;
-	if ((ext = calloc(max_extn, sizeof (efs_extent_t))) == NULL)
+	if ((ext = calloc(n, sizeof (efs_extent_t))) == NULL)
 		return (ENOMEM);
 
-	LOG_DBG2(inode->i_fs, "%s: indirect n=%d, max_extn=%d\n", __func__, n,
-	    max_extn);
+	LOG_DBG2(inode->i_fs, "%s: indirect nind=%d, n=%d\n", __func__, nind,
+	    n);
 
-	err = EINVAL;		/* No extent found */
-	for (int i = 0; i < n; i++) {
+	err = 0;
+	for (int i = 0; i < nind && extn < n; i++) {
 		uint32_t ext1 = GET_U32(inode->i_od.di_u.di_extents[i].ext1);
+		uint32_t ext2 = GET_U32(inode->i_od.di_u.di_extents[i].ext2);
 
 		if (EXT_MAGIC(ext1) != 0) {
 			LOG_ERR("%s: inode %d extent %d has wrong magic 0x%x\n",
 			    __func__, inode->i_num, i, EXT_MAGIC(ext1));
-			return (EINVAL);
+			err = EINVAL;
+			break;
 		}
 		err = efs_inode_load_indirect(inode, EXT_BN(ext1),
-		    &ext[i * EFS_EXTENTS_PER_BB], &extn);
+		    EXT_LEN(ext2), ext, n, &extn);
 		if (err != 0)
 			break;
 	}
+	if (err == 0 && extn != n) {
+		LOG_ERR("%s: inode %d has %d extents, found %d\n", __func__,
+		    inode->i_num, n, extn);
+		err = EINVAL;
+	}
 
 	if (err == 0) {
 		inode->i_nextents = extn;
@@ -194,45 +246,114 @@ efs_inode_load_extents(efs_inode_t *inode)
 	return (err);
 }
 
-int
-efs_iget(efs_fs_t *fs, uint32_t ino, efs_inode_t **inode)
+static efs_inode_t *
+icache_search(efs_fs_t *fs, uint32_t ino)
 {
-	efs_inode_t *i = icache;
-	uint32_t blkno;
-	off_t ofs;
-	int err = 0;
+	efs_icache_t *ic = fs->icache;
+	uint32_t h = ICACHE_HASH(ino);
+	efs_inode_t *i;
 
-	assert(inode != NULL);
+	pthread_rwlock_rdlock(ICACHE_LOCK(ic, h));
+	for (i = ic->ic_hash[h]; i != NULL; i = i->i_next) {
+		if (i->i_num == ino)
+			break;
+	}
+	pthread_rwlock_unlock(ICACHE_LOCK(ic, h));
 
-	LOG_DBG2(fs, "iget inode %d\n", ino);
+	return (i);
+}
 
-	pthread_mutex_lock(&icache_mtx);
-	while (i != NULL) {
-		if (i->i_num == ino) {
-			assert(i != NULL);
-			*inode = i;
-			LOG_DBG2(fs, "iget: inode %d found in icache\n", ino);
-			pthread_mutex_unlock(&icache_mtx);
-			return (0);
-		}
-		i = i->i_next;
+static efs_inode_t *
+icache_alloc(efs_fs_t *fs)
+{
+	efs_icache_t *ic = fs->icache;
+	efs_inode_t *i;
+
+	pthread_mutex_lock(&ic->ic_pool_mtx);
+	i = efs_pool_alloc(&ic->ic_pool);
+	pthread_mutex_unlock(&ic->ic_pool_mtx);
+
+	return (i);
+}
+
+static void
+icache_free(efs_fs_t *fs, efs_inode_t *i)
+{
+	efs_icache_t *ic = fs->icache;
+
+	free(i->i_extents);
+	pthread_mutex_lock(&ic->ic_pool_mtx);
+	efs_pool_free(&ic->ic_pool, i);
+	pthread_mutex_unlock(&ic->ic_pool_mtx);
+}
+
+/*
+ * Adds a fully initialized inode to the cache and returns the cached one,
+ * which is a different inode if somebody else was faster.
+ */
+static efs_inode_t *
+icache_insert(efs_fs_t *fs, efs_inode_t *i)
+{
+	efs_icache_t *ic = fs->icache;
+	uint32_t h = ICACHE_HASH(i->i_num);
+	efs_inode_t *c;
+
+	pthread_rwlock_wrlock(ICACHE_LOCK(ic, h));
+	for (c = ic->ic_hash[h]; c != NULL; c = c->i_next) {
+		if (c->i_num == i->i_num)
+			break;
+	}
+	if (c == NULL) {
+		i->i_next = ic->ic_hash[h];
+		ic->ic_hash[h] = i;
 	}
+	pthread_rwlock_unlock(ICACHE_LOCK(ic, h));
 
-	/* requested inode is not in icache - load it from the disk */
-	if ((i = malloc(sizeof (efs_inode_t))) == NULL) {
-		err = ENOMEM;
-		goto out;
+	if (c == NULL) {
+		EFS_STAT_ADD(EFS_STAT_ICACHE_MEM, sizeof (efs_inode_t) +
+		    i->i_nextents * sizeof (efs_extent_t));
 	}
-	memset(inode, 0, sizeof (*inode));
-	inode2loc(fs, ino, &blkno, &ofs);
 
-	err = efs_bread(fs, blkno, ofs, &i->i_od, sizeof (efs_od_inode_t));
-	if (err != 0)
-		goto out;
+	if (c != NULL) {
+		icache_free(fs, i);
+		return (c);
+	}
+	return (i);
+}
+
+/*
+ * Decodes the number of a device inode the way Linux does: the old 16-bit
+ * number has an 8-bit major and minor, the new one (SVR4) a 14-bit major
+ * and an 18-bit minor.
+ */
+static int
+efs_inode_rdev(efs_inode_t *inode, dev_t *rdev)
+{
+	uint16_t odev = GET_U16(inode->i_od.di_u.di_dev.di_odev);
+	uint32_t ndev = GET_U32(inode->i_od.di_u.di_dev.di_ndev);
+
+	if (GET_I16(inode->i_od.di_nextents) != 0 ||
+	    (odev == EFS_ODEV_NEW && ndev == UINT32_MAX)) {
+		LOG_ERR("%s: inode %d has a bad device number 0x%x/0x%x\n",
+		    __func__, inode->i_num, odev, ndev);
+		return (EINVAL);
+	}
+	if (odev != EFS_ODEV_NEW)
+		*rdev = makedev(odev >> 8, odev & 0xff);
+	else
+		*rdev = makedev((ndev >> 18) & 0x3fff, ndev & 0x3ffff);
+
+	return (0);
+}
 
-	/* add inode to the cache */
-	i->i_next = icache;
-	icache = i;
+/*
+ * Fills the in-core part of a freshly read inode. It may read indirect
+ * extents, so it is called without any lock held.
+ */
+static int
+efs_inode_init(efs_fs_t *fs, uint32_t ino, efs_inode_t *i)
+{
+	int err;
 
 	/* fill cached items */
 	i->i_num = ino;
@@ -240,23 +361,185 @@ efs_iget(efs_fs_t *fs, uint32_t ino, efs_inode_t **inode)
 	efs_inode_stat(i, &i->i_stat);
 	i->i_mode = i->i_stat.st_mode;
 	i->i_flags = 0;
-	if ((err = efs_inode_load_extents(i)) != 0)
+	i->i_uses = 0;
+	i->i_reads = 0;
+	if ((err = efs_inode_load_extents(i)) == 0 &&
+	    (S_ISCHR(i->i_mode) || S_ISBLK(i->i_mode)))
+		err = efs_inode_rdev(i, &i->i_stat.st_rdev);
+	if (err != 0)
 		i->i_flags |= EFS_FLG_BAD_FILE;
 	(void) efs_inode_verify_extents(i);
-	*inode = i;
-out:
-	pthread_mutex_unlock(&icache_mtx);
+
+	return (err);
+}
+
+int
+efs_iget(efs_fs_t *fs, uint32_t ino, efs_inode_t **inode)
+{
+	efs_inode_t *i;
+	uint32_t blkno;
+	off_t ofs;
+	int err = 0;
+
+	assert(inode != NULL);
+
+	EFS_MRC_REF(EFS_MRC_INODE, ino);
+	if ((i = icache_search(fs, ino)) != NULL) {
+		EFS_STAT_INC(EFS_STAT_ICACHE_HIT);
+		EFS_TRACE(2, EFS_TR_IGET, ino, 1);
+		EFS_PROBE1(iget__hit, ino);
+		__atomic_add_fetch(&i->i_uses, 1, __ATOMIC_RELAXED);
+		*inode = i;
+		return (0);
+	}
+
+	/* requested inode is not in icache - load it from the disk */
+	EFS_STAT_INC(EFS_STAT_ICACHE_MISS);
+	EFS_TRACE(2, EFS_TR_IGET, ino, 0);
+	EFS_PROBE1(iget__miss, ino);
+	if ((i = icache_alloc(fs)) == NULL)
+		return (ENOMEM);
+	inode2loc(fs, ino, &blkno, &ofs);
+
+	err = efs_bread(fs, blkno, ofs, &i->i_od, sizeof (efs_od_inode_t));
+	if (err != 0) {
+		EFS_PROBE2(iget__load, ino, err);
+		icache_free(fs, i);
+		return (err);
+	}
+
+	err = efs_inode_init(fs, ino, i);
+	EFS_PROBE2(iget__load, ino, err);
+	*inode = icache_insert(fs, i);
+	if (*inode != i)
+		err = 0;	/* somebody else loaded it */
+	__atomic_add_fetch(&(*inode)->i_uses, 1, __ATOMIC_RELAXED);
+
+	return (err);
+}
+
+typedef struct ibatch_miss {
+	uint32_t im_ino;
+	uint32_t im_blk;	/* BB holding the inode */
+	off_t im_ofs;		/* offset of the inode within the BB */
+} ibatch_miss_t;
+
+static int
+ibatch_cmp(const void *a, const void *b)
+{
+	const ibatch_miss_t *ma = a;
+	const ibatch_miss_t *mb = b;
+
+	if (ma->im_blk != mb->im_blk)
+		return (ma->im_blk < mb->im_blk ? -1 : 1);
+	return (ma->im_ofs < mb->im_ofs ? -1 : (ma->im_ofs > mb->im_ofs));
+}
+
+/*
+ * Reads the misses in [first, last) with a single read of the BBs they
+ * occupy and adds them to the cache.
+ */
+static int
+ibatch_load_run(efs_fs_t *fs, ibatch_miss_t *m, int first, int last,
+    char *buf)
+{
+	uint32_t start = m[first].im_blk;
+	uint32_t nblks = m[last - 1].im_blk - start + 1;
+	int err;
+
+	LOG_DBG2(fs, "%s: %d inodes in BBs %u-%u\n", __func__, last - first,
+	    start, start + nblks - 1);
+
+	if ((err = efs_bread_bbs(fs, start, buf, nblks)) != 0)
+		return (err);
+
+	for (int k = first; k < last; k++) {
+		efs_inode_t *i;
+
+		if (k > first && m[k].im_ino == m[k - 1].im_ino)
+			continue;	/* duplicate */
+		if ((i = icache_alloc(fs)) == NULL)
+			return (ENOMEM);
+		memcpy(&i->i_od, buf + (m[k].im_blk - start) * BBS +
+		    m[k].im_ofs, sizeof (efs_od_inode_t));
+		/* bad inodes are flagged, the caller checks EFS_BAD_FILE() */
+		(void) efs_inode_init(fs, m[k].im_ino, i);
+		(void) icache_insert(fs, i);
+	}
+
+	return (0);
+}
+
+/*
+ * Gets n inodes at once. Inodes missing in the cache are sorted by their
+ * location and BBs that are close to each other (within the same cylinder
+ * group) are read by a single request. On success, inodes[k] is the inode
+ * inos[k].
+ */
+int
+efs_iget_batch(efs_fs_t *fs, const uint32_t *inos, int n,
+    efs_inode_t **inodes)
+{
+	int32_t inos_per_cg = GET_I16(fs->sb.s_cg_ino_bbs) * INOS_PER_BB;
+	ibatch_miss_t *m;
+	efs_arena_t arena;
+	char *buf;
+	int nmiss = 0;
+	int first;
+	int err = 0;
+
+	efs_arena_init(&arena);
+	m = efs_arena_alloc(&arena, n * sizeof (ibatch_miss_t));
+	buf = efs_arena_alloc(&arena, EFS_IBATCH_MAX_BBS * BBS);
+	if (m == NULL || buf == NULL) {
+		efs_arena_destroy(&arena);
+		return (ENOMEM);
+	}
+
+	for (int k = 0; k < n; k++) {
+		EFS_MRC_REF(EFS_MRC_INODE, inos[k]);
+		if (icache_search(fs, inos[k]) != NULL) {
+			EFS_STAT_INC(EFS_STAT_ICACHE_HIT);
+			continue;
+		}
+		EFS_STAT_INC(EFS_STAT_ICACHE_MISS);
+		m[nmiss].im_ino = inos[k];
+		inode2loc(fs, inos[k], &m[nmiss].im_blk, &m[nmiss].im_ofs);
+		nmiss++;
+	}
+
+	LOG_DBG2(fs, "%s: %d inodes, %d not cached\n", __func__, n, nmiss);
+
+	qsort(m, nmiss, sizeof (ibatch_miss_t), ibatch_cmp);
+
+	first = 0;
+	for (int k = 1; k <= nmiss && err == 0; k++) {
+		if (k < nmiss &&
+		    m[k].im_ino / inos_per_cg == m[first].im_ino / inos_per_cg &&
+		    m[k].im_blk - m[k - 1].im_blk <= EFS_IBATCH_GAP &&
+		    m[k].im_blk - m[first].im_blk < EFS_IBATCH_MAX_BBS)
+			continue;
+		err = ibatch_load_run(fs, m, first, k, buf);
+		first = k;
+	}
+
+	for (int k = 0; k < n && err == 0; k++) {
+		if ((inodes[k] = icache_search(fs, inos[k])) == NULL)
+			err = ENOENT;
+	}
+
+	efs_arena_destroy(&arena);
+
 	return (err);
 }
 
 int
 efs_iread(efs_inode_t *inode, uint32_t blkno, uint32_t nblks, void *buf)
 {
-	uint32_t blkend = blkno + nblks - 1;
+	uint32_t blkend;	/* first block after the range */
 	int err = 0;
 
-	LOG_DBG2(inode->i_fs, "%s: inode %d, blkno %d, nblks %d\n", __func__,
-	    inode->i_num, blkno, nblks);
+	EFS_TRACE(3, EFS_TR_IREAD, inode->i_num, (uint64_t)blkno << 32 | nblks);
 
 	memset(buf, 0, nblks * BBS);
 
@@ -266,35 +549,27 @@ efs_iread(efs_inode_t *inode, uint32_t blkno, uint32_t nblks, void *buf)
 	if (blkno >= inode->i_nblks)
 		return (ENXIO);
 	nblks = MIN(nblks, inode->i_nblks - blkno);
+	blkend = blkno + nblks;
 	for (int i = 0; i < inode->i_nextents; i++) {
 		efs_extent_t *e = &inode->i_extents[i];
-		uint32_t e_last = e->e_blk + e->e_len;
-		uint32_t start;
-		uint32_t to_read;
-		uint32_t buf_off;
-		void *cur_buf;
-
-		LOG_DBG3(inode->i_fs, "%d: b=%d, l=%d, o=%d\n", i, e->e_blk,
-		    e->e_len, e->e_offset);
-		if (e->e_offset + e->e_len < blkno)
-			continue;
-		if (e->e_offset > blkend)
-			break;
-		start = blkno - e->e_offset;
-		buf_off = start - blkno;
-		to_read = MIN(nblks - buf_off, e_last - start);
+		uint32_t from;
+		uint32_t to;
 
-		LOG_DBG3(inode->i_fs, "start=%d, to_read=%d, buf_off=%d\n",
-		    start, to_read, buf_off);
-		if (to_read == 0)
+		if (e->e_offset + e->e_len <= blkno)
+			continue;
+		if (e->e_offset >= blkend)
 			break;
-		cur_buf = buf + buf_off * BBS;
-
-		err = efs_bread_bbs(inode->i_fs, start + e->e_blk, cur_buf,
-		    to_read);
+		/* the part of the extent within the range */
+		from = MAX(blkno, e->e_offset);
+		to = MIN(blkend, e->e_offset + e->e_len);
+
+		EFS_PROBE4(iread__map, inode->i_num, from,
+		    e->e_blk + from - e->e_offset, to - from);
+		err = efs_bread_bbs(inode->i_fs, e->e_blk + from - e->e_offset,
+		    (char *)buf + (from - blkno) * BBS, to - from);
 		if (err != 0) {
-			LOG_ERR("%s: cannot read inode %d, offset %d, err=%d\n",
-			    __func__, inode->i_num, buf_off, err);
+			LOG_ERR("%s: cannot read inode %d, block %d, err=%d\n",
+			    __func__, inode->i_num, from, err);
 			break;
 		}
 	}
@@ -302,6 +577,325 @@ efs_iread(efs_inode_t *inode, uint32_t blkno, uint32_t nblks, void *buf)
 	return (err);
 }
 
+/*
+ * Reads size bytes at byte offset off, clipped to the file size. Unaligned
+ * head and tail are read through a bounce block, the rest goes straight to
+ * buf. Blocks past the last extent read as zeros.
+ */
+int
+efs_pread(efs_inode_t *inode, void *buf, size_t size, off_t off,
+    size_t *nread)
+{
+	off_t fsize = inode->i_stat.st_size;
+	char bb[BBS];
+	size_t done = 0;
+	uint32_t nblks;
+	int err = 0;
+
+	*nread = 0;
+	if (off >= fsize)
+		return (0);
+	size = MIN(size, fsize - off);
+
+	if (off % BBS != 0) {
+		size_t ofs = off % BBS;
+		size_t n = MIN(size, BBS - ofs);
+
+		err = efs_iread(inode, off / BBS, 1, bb);
+		if (err != 0 && err != ENXIO)
+			return (err);
+		memcpy(buf, bb + ofs, n);
+		done = n;
+	}
+
+	nblks = (size - done) / BBS;
+	if (nblks > 0) {
+		err = efs_iread(inode, (off + done) / BBS, nblks,
+		    (char *)buf + done);
+		if (err != 0 && err != ENXIO)
+			return (err);
+		done += nblks * BBS;
+	}
+
+	if (done < size) {
+		err = efs_iread(inode, (off + done) / BBS, 1, bb);
+		if (err != 0 && err != ENXIO)
+			return (err);
+		memcpy((char *)buf + done, bb, size - done);
+		done = size;
+	}
+
+	*nread = done;
+	return (0);
+}
+
+static int
+extent_ends_after(efs_inode_t *inode, int i, uint32_t blkno)
+{
+	efs_extent_t *e = &inode->i_extents[i];
+
+	return (e->e_offset + e->e_len > blkno);
+}
+
+/*
+ * Returns the index of the first extent that ends after block blkno, or
+ * i_nextents if there is none. Extents are sorted by their file offset. The
+ * hint (or the extent following it) is tried first, -1 means no hint.
+ */
+int
+efs_extent_find(efs_inode_t *inode, uint32_t blkno, int hint)
+{
+	int lo = 0;
+	int hi = inode->i_nextents;
+
+	for (int i = MAX(hint, 0); hint >= 0 && i <= hint + 1 && i < hi; i++) {
+		if (extent_ends_after(inode, i, blkno) &&
+		    (i == 0 || !extent_ends_after(inode, i - 1, blkno)))
+			return (i);
+	}
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (extent_ends_after(inode, mid, blkno))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return (lo);
+}
+
+typedef struct bmap {
+	efs_seg_t	*b_segs;	/* NULL if only counting */
+	efs_seg_t	b_last;
+	int		b_n;
+} bmap_t;
+
+static void
+bmap_add(bmap_t *b, off_t pos, size_t len)
+{
+	efs_seg_t *last = &b->b_last;
+
+	/* merge with the previous segment if it is contiguous */
+	if (b->b_n > 0 && ((last->s_pos == EFS_SEG_HOLE &&
+	    pos == EFS_SEG_HOLE) || (last->s_pos != EFS_SEG_HOLE &&
+	    pos == last->s_pos + (off_t)last->s_len))) {
+		last->s_len += len;
+	} else {
+		last->s_pos = pos;
+		last->s_len = len;
+		b->b_n++;
+	}
+	if (b->b_segs != NULL)
+		b->b_segs[b->b_n - 1] = *last;
+}
+
+/*
+ * Maps size bytes at byte offset off, clipped to the file size, onto the
+ * image, starting with extent *ext. Physically contiguous extents end up in
+ * one segment. On return, *ext is the last extent used. Returns the number
+ * of segments; if segs is NULL, they are only counted.
+ */
+static int
+bmap(efs_inode_t *inode, off_t off, size_t size, efs_seg_t *segs, int *ext)
+{
+	off_t end = MIN(off + (off_t)size, inode->i_stat.st_size);
+	off_t start = inode->i_fs->start;
+	bmap_t b = { segs, { 0, 0 }, 0 };
+	int i;
+
+	for (i = *ext; i < inode->i_nextents && off < end; i++) {
+		efs_extent_t *e = &inode->i_extents[i];
+		off_t estart = (off_t)e->e_offset * BBS;
+		off_t eend = MIN((off_t)(e->e_offset + e->e_len) * BBS, end);
+
+		if (estart >= end)
+			break;
+		if (off < estart) {
+			bmap_add(&b, EFS_SEG_HOLE, estart - off);
+			off = estart;
+		}
+		bmap_add(&b, start + (off_t)e->e_blk * BBS + (off - estart),
+		    eend - off);
+		off = eend;
+	}
+	if (off < end)
+		bmap_add(&b, EFS_SEG_HOLE, end - off);
+	if (i > *ext)
+		*ext = i - 1;
+
+	return (b.b_n);
+}
+
+int
+efs_bmap(efs_inode_t *inode, off_t off, size_t size, efs_seg_t *segs)
+{
+	int ext = efs_extent_find(inode, off / BBS, -1);
+
+	return (bmap(inode, off, size, segs, &ext));
+}
+
+/*
+ * Copies the target of a symbolic link, NUL terminated and truncated to
+ * fit in size bytes. Short targets are kept right in the inode.
+ */
+int
+efs_readlink(efs_inode_t *inode, char *buf, size_t size)
+{
+	size_t len;
+	int err;
+
+	if (size == 0 || !S_ISLNK(inode->i_mode))
+		return (EINVAL);
+
+	len = MIN((size_t)inode->i_stat.st_size, size - 1);
+	if (inode->i_nextents == 0) {
+		len = MIN(len, sizeof (inode->i_od.di_u.di_symlink));
+		memcpy(buf, inode->i_od.di_u.di_symlink, len);
+	} else if ((err = efs_pread(inode, buf, len, 0, &len)) != 0) {
+		return (err);
+	}
+	buf[len] = '\0';
+
+	return (0);
+}
+
+/*
+ * Implements lseek() SEEK_DATA and SEEK_HOLE on the extent list. Anything
+ * not covered by an extent is a hole, and so is the (virtual) end of file.
+ */
+int
+efs_seek_data(efs_inode_t *inode, off_t off, int whence, off_t *res)
+{
+	off_t fsize = inode->i_stat.st_size;
+	efs_extent_t *e;
+	off_t end;
+	int i;
+
+	if (off < 0 || off >= fsize)
+		return (ENXIO);
+
+	i = efs_extent_find(inode, off / BBS, -1);
+	e = &inode->i_extents[i];
+
+	if (whence == SEEK_DATA) {
+		if (i == inode->i_nextents ||
+		    (off_t)e->e_offset * BBS >= fsize)
+			return (ENXIO);
+		*res = MAX(off, (off_t)e->e_offset * BBS);
+		return (0);
+	}
+
+	if (whence != SEEK_HOLE)
+		return (EINVAL);
+
+	if (i == inode->i_nextents || (off_t)e->e_offset * BBS > off) {
+		*res = off;
+		return (0);
+	}
+	/* skip over logically contiguous extents */
+	end = (off_t)(e->e_offset + e->e_len) * BBS;
+	for (i++; i < inode->i_nextents; i++) {
+		e = &inode->i_extents[i];
+		if ((off_t)e->e_offset * BBS != end)
+			break;
+		end += (off_t)e->e_len * BBS;
+	}
+	*res = MIN(end, fsize);
+
+	return (0);
+}
+
+/*
+ * Inodes are never evicted from the cache, the handle can simply point to
+ * one for as long as the file is open.
+ */
+int
+efs_file_open(efs_inode_t *inode, efs_file_t **fp)
+{
+	efs_file_t *f;
+
+	if ((f = malloc(sizeof (*f))) == NULL)
+		return (ENOMEM);
+	f->f_inode = inode;
+	f->f_next = 0;
+	f->f_ext = 0;
+	f->f_data = NULL;
+	f->f_len = 0;
+	*fp = f;
+
+	return (0);
+}
+
+/*
+ * Opens a virtual file with the given malloc()ed contents, the handle takes
+ * them over.
+ */
+int
+efs_file_open_data(char *data, size_t len, efs_file_t **fp)
+{
+	int err;
+
+	if ((err = efs_file_open(NULL, fp)) != 0)
+		return (err);
+	(*fp)->f_data = data;
+	(*fp)->f_len = len;
+
+	return (0);
+}
+
+void
+efs_file_close(efs_file_t *f)
+{
+	free(f->f_data);
+	free(f);
+}
+
+int
+efs_file_pread(efs_file_t *f, void *buf, size_t size, off_t off,
+    size_t *nread)
+{
+	if (f->f_inode != NULL) {
+		__atomic_add_fetch(&f->f_inode->i_reads, 1, __ATOMIC_RELAXED);
+		return (efs_pread(f->f_inode, buf, size, off, nread));
+	}
+
+	*nread = 0;
+	if (off < f->f_len) {
+		*nread = MIN(size, f->f_len - off);
+		memcpy(buf, f->f_data + off, *nread);
+	}
+	return (0);
+}
+
+/*
+ * Like efs_bmap(), but a read that continues where the previous one ended
+ * starts the extent search at the extent it ended in. Concurrent reads of
+ * the same handle may garble the cursor, it is only a hint.
+ */
+int
+efs_file_bmap(efs_file_t *f, off_t off, size_t size, efs_seg_t *segs)
+{
+	int hint = -1;
+	int ext;
+	int n;
+
+	if (off == __atomic_load_n(&f->f_next, __ATOMIC_RELAXED))
+		hint = __atomic_load_n(&f->f_ext, __ATOMIC_RELAXED);
+	ext = efs_extent_find(f->f_inode, off / BBS, hint);
+
+	n = bmap(f->f_inode, off, size, segs, &ext);
+	if (segs != NULL) {
+		__atomic_add_fetch(&f->f_inode->i_reads, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&f->f_ext, ext, __ATOMIC_RELAXED);
+		__atomic_store_n(&f->f_next, off + (off_t)size,
+		    __ATOMIC_RELAXED);
+	}
+
+	return (n);
+}
+
 int
 efs_walk(efs_inode_t *inode, uint32_t blkno, uint32_t nblks, file_walker_t w,
     void *arg)
@@ -336,22 +930,67 @@ efs_walk(efs_inode_t *inode, uint32_t blkno, uint32_t nblks, file_walker_t w,
 	return (ret);
 }
 
+int
+icache_create(efs_fs_t *fs)
+{
+	efs_icache_t *ic;
+
+	if ((ic = calloc(1, sizeof (efs_icache_t))) == NULL)
+		return (ENOMEM);
+	for (int l = 0; l < ICACHE_LOCKS; l++)
+		(void) pthread_rwlock_init(&ic->ic_locks[l], NULL);
+	(void) pthread_mutex_init(&ic->ic_pool_mtx, NULL);
+	ic->ic_pool = (efs_pool_t)EFS_POOL_INITIALIZER(sizeof (efs_inode_t),
+	    64);
+	fs->icache = ic;
+
+	return (0);
+}
+
+/*
+ * Calls cb for every cached inode, with its bucket read locked.
+ */
+void
+icache_walk(efs_fs_t *fs, void (*cb)(efs_inode_t *, void *), void *arg)
+{
+	efs_icache_t *ic = fs->icache;
+
+	for (int h = 0; h < ICACHE_BUCKETS; h++) {
+		pthread_rwlock_rdlock(ICACHE_LOCK(ic, h));
+		for (efs_inode_t *i = ic->ic_hash[h]; i != NULL; i = i->i_next)
+			cb(i, arg);
+		pthread_rwlock_unlock(ICACHE_LOCK(ic, h));
+	}
+}
+
+/*
+ * Frees all cached inodes and the cache itself; the name cache, which
+ * points to the inodes, must be gone already.
+ */
 void
-icache_destroy(void)
+icache_destroy(efs_fs_t *fs)
 {
+	efs_icache_t *ic = fs->icache;
 	efs_inode_t *ino;
-	unsigned long cnt = 0;
 
-	pthread_mutex_lock(&icache_mtx);
+	if (ic == NULL)
+		return;
 
-	ino = icache;
-	while (ino != NULL) {
-		efs_inode_t *next = ino->i_next;
-		free(ino);
-		cnt++;
-		ino = next;
+	for (int h = 0; h < ICACHE_BUCKETS; h++) {
+		/* The inodes go away with their pool, extents are freed here. */
+		for (ino = ic->ic_hash[h]; ino != NULL; ino = ino->i_next) {
+			if (ino->i_dsnap != NULL)
+				efs_dir_snap_rele(ino->i_dsnap);
+			free(ino->i_extents);
+		}
 	}
-	pthread_mutex_unlock(&icache_mtx);
+	efs_pool_destroy(&ic->ic_pool);
+
+	for (int l = 0; l < ICACHE_LOCKS; l++)
+		(void) pthread_rwlock_destroy(&ic->ic_locks[l]);
+	(void) pthread_mutex_destroy(&ic->ic_pool_mtx);
+	free(ic);
+	fs->icache = NULL;
 }
 
 #ifdef EFS_DEBUG
@@ -26,6 +26,13 @@
 #include "efs_fs.h"
 
 #define	EFS_DIRECTEXTENTS	12
+/* di_odev of a device whose number does not fit, see di_ndev */
+#define	EFS_ODEV_NEW		0xffff
+
+/* Inode batches are read in runs of at most this many BBs */
+#define	EFS_IBATCH_MAX_BBS	64
+/* Largest gap (in BBs) between inodes still merged into one read */
+#define	EFS_IBATCH_GAP		4
 
 /*
  * On-disk data structures
@@ -65,7 +72,11 @@ typedef struct efs_od_inode {
 		char		di_symlink[sizeof (efs_od_extent_t) *
 		    EFS_DIRECTEXTENTS];
 		/* device */
-		uint32_t	di_dev;	/* dev_t */
+		struct {
+			uint16_t	di_odev;	/* 8-bit major and minor */
+			uint16_t	di_pad;
+			uint32_t	di_ndev;	/* 14-bit major, 18 minor */
+		} di_dev;
 	} di_u;
 } efs_od_inode_t;
 
@@ -88,9 +99,36 @@ typedef struct efs_inode {
 	uint32_t	i_nblks;	/* blocks incl holes */
 	uint32_t	i_nalloc_blks;	/* allocated blocks */
 	int		i_flags;
+	struct efs_dir_snap *i_dsnap;	/* decoded directory, if any */
+	uint32_t	i_uses;		/* efs_iget() calls, for the hot set */
+	uint32_t	i_reads;	/* data reads, for the hot set */
 	struct efs_inode *i_next;
 } efs_inode_t;
 
+/*
+ * A byte range of a file mapped onto the image: s_pos is the position in
+ * the image file, or EFS_SEG_HOLE if the range is not allocated.
+ */
+typedef struct efs_seg {
+	off_t	s_pos;
+	size_t	s_len;
+} efs_seg_t;
+
+#define	EFS_SEG_HOLE	((off_t)-1)
+
+/*
+ * Open file. A sequential reader continues where its previous read ended,
+ * the extent it ended in is remembered to start the next extent search.
+ * Virtual files have no inode, their contents are kept in f_data.
+ */
+typedef struct efs_file {
+	efs_inode_t	*f_inode;
+	off_t		f_next;	/* offset following the last read */
+	int		f_ext;	/* extent the last read ended in */
+	char		*f_data;
+	size_t		f_len;
+} efs_file_t;
+
 #define	IS_DIR(inode)	((inode->i_mode & S_IFMT) == S_IFDIR)
 
 /* In-core inode flags */
@@ -109,11 +147,27 @@ typedef callback_state_t (*file_walker_t)(efs_inode_t *inode, uint32_t blkno,
 
 /* Public inode related functions */
 int efs_iget(efs_fs_t *fs, uint32_t ino, efs_inode_t **inode);
+int efs_iget_batch(efs_fs_t *fs, const uint32_t *inos, int n,
+    efs_inode_t **inodes);
 int efs_iread(efs_inode_t *inode, uint32_t blkno, uint32_t nblks, void *buf);
+int efs_pread(efs_inode_t *inode, void *buf, size_t size, off_t off,
+    size_t *nread);
+int efs_extent_find(efs_inode_t *inode, uint32_t blkno, int hint);
+int efs_bmap(efs_inode_t *inode, off_t off, size_t size, efs_seg_t *segs);
+int efs_seek_data(efs_inode_t *inode, off_t off, int whence, off_t *res);
+int efs_readlink(efs_inode_t *inode, char *buf, size_t size);
+int efs_file_open(efs_inode_t *inode, efs_file_t **fp);
+int efs_file_open_data(char *data, size_t len, efs_file_t **fp);
+void efs_file_close(efs_file_t *f);
+int efs_file_pread(efs_file_t *f, void *buf, size_t size, off_t off,
+    size_t *nread);
+int efs_file_bmap(efs_file_t *f, off_t off, size_t size, efs_seg_t *segs);
 int efs_walk(efs_inode_t *inode, uint32_t blkno, uint32_t nblks,
     file_walker_t w, void *arg);
 
-void icache_destroy(void);
+int icache_create(efs_fs_t *fs);
+void icache_walk(efs_fs_t *fs, void (*cb)(efs_inode_t *, void *), void *arg);
+void icache_destroy(efs_fs_t *fs);
 
 
 #ifdef EFS_DEBUG
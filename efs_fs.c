@@ -21,12 +21,15 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/statvfs.h>
 #include <unistd.h>
 #include <assert.h>
 #include <string.h>
 
 #include "utils.h"
 #include "efs_vol.h"
+#include "efs_dir.h"
+#include "efs_trace.h"
 
 #include "efs_fs.h"
 
@@ -57,9 +60,25 @@ efs_mount(efs_fs_t *fs)
 	LOG_DBG2(fs, "super block: name='%s', pack='%s'\n", fs->sb.s_fname,
 	    fs->sb.s_fpack);
 
+	if ((err = icache_create(fs)) != 0 || (err = ncache_create(fs)) != 0) {
+		LOG_ERR("cannot allocate caches\n");
+		efs_umount(fs);
+		return (err);
+	}
+
 	return (0);
 }
 
+/*
+ * Drops everything efs_mount() allocated, the image stays open.
+ */
+void
+efs_umount(efs_fs_t *fs)
+{
+	ncache_destroy(fs);
+	icache_destroy(fs);
+}
+
 void
 inode2loc(efs_fs_t *fs, uint32_t ino, uint32_t *blk, off_t *ofs)
 {
@@ -79,6 +98,24 @@ inode2loc(efs_fs_t *fs, uint32_t ino, uint32_t *blk, off_t *ofs)
 	*blk = bbofs;
 	*ofs = idx * INO_SIZE;
 
-	LOG_DBG2(fs, "%s:  ino=%d -> blk=%d, ofs=%ld\n", __func__, ino, *blk,
-	    *ofs);
+	EFS_TRACE(3, EFS_TR_INO2LOC, ino, (uint64_t)*blk << 32 | *ofs);
+}
+
+void
+efs_fs_statvfs(efs_fs_t *fs, struct statvfs *st)
+{
+	memset(st, 0, sizeof (*st));
+	st->f_bsize = BBS;
+	st->f_frsize = BBS;
+	st->f_blocks = GET_I32(fs->sb.s_size);
+	st->f_bfree = GET_I32(fs->sb.s_blk_free);
+	st->f_bavail = st->f_bfree;
+	st->f_files = GET_I32(fs->sb.s_ino_free) * 2;
+	st->f_ffree = GET_I32(fs->sb.s_ino_free);
+	st->f_favail = st->f_ffree;
+	st->f_fsid = 0;
+	st->f_namemax = EFS_NAME_MAX;
+#if defined(__SOLARIS__)
+	(void) strncpy(st->f_basetype, EFS_NAME, FSTYPSZ);
+#endif
 }
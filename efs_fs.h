@@ -21,6 +21,8 @@
 #define	EFS_FS_H
 
 #include <sys/types.h>
+#include <sys/statvfs.h>
+#include <stdint.h>
 
 /*
  * On-disk file system data structures.
@@ -63,16 +65,24 @@ typedef struct efs_sb {
 } efs_sb_t;
 
 /*
- * In-core data structure.
+ * In-core data structure. Everything a mounted file system caches hangs off
+ * it, so several file systems can be used by one process at once.
  */
+typedef struct efs_icache efs_icache_t;
+typedef struct efs_ncache efs_ncache_t;
+
 typedef struct efs_fs {
 	int fd;			/* file system image file descriptor (RO) */
 	off_t start;		/* in bytes */
 	int log_lvl;		/* debugging log verbosity */
 	efs_sb_t sb;		/* super block */
+	efs_icache_t *icache;	/* inode cache */
+	efs_ncache_t *ncache;	/* name (path) cache */
 } efs_fs_t;
 
 int efs_mount(efs_fs_t *fs);
+void efs_umount(efs_fs_t *fs);
 void inode2loc(efs_fs_t *fs, uint32_t ino, uint32_t *blk, off_t *ofs);
+void efs_fs_statvfs(efs_fs_t *fs, struct statvfs *st);
 
 #endif /* EFS_FS_H */
@@ -0,0 +1,283 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "efs_fuse.h"
+#include "efs_file.h"
+#include "efs_mem.h"
+#include "efs_mrc.h"
+#include "efs_prefetch.h"
+#include "efs_stats.h"
+#include "utils.h"
+
+void
+efs_mount_opts_init(efs_mount_opts_t *mo)
+{
+	mo->mo_max_readahead = 0;
+	mo->mo_max_background = 0;
+	mo->mo_congestion_threshold = 0;
+	mo->mo_prefetch = EFS_PREFETCH_DEPTH;
+	mo->mo_keep_cache = 1;
+	mo->mo_use_ino = 1;
+	mo->mo_entry_timeout = EFS_CACHE_TIMEOUT;
+	mo->mo_attr_timeout = EFS_CACHE_TIMEOUT;
+	mo->mo_negative_timeout = EFS_CACHE_TIMEOUT;
+	mo->mo_stats_dump = NULL;
+	mo->mo_trace_file = NULL;
+	mo->mo_hotset_file = NULL;
+}
+
+/*
+ * Always ask for readdirplus when the kernel supports it, so that listing
+ * a directory returns the attributes of all entries and no lookups follow.
+ * Read replies are spliced from the image when possible.
+ */
+void
+efs_fuse_conn_init(const efs_mount_opts_t *mo, struct fuse_conn_info *conn)
+{
+	if (conn->capable & FUSE_CAP_READDIRPLUS) {
+		conn->want |= FUSE_CAP_READDIRPLUS;
+		conn->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+	}
+	if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+		conn->want |= FUSE_CAP_SPLICE_WRITE;
+
+	if (mo->mo_max_readahead > 0)
+		conn->max_readahead = mo->mo_max_readahead;
+	if (mo->mo_max_background > 0)
+		conn->max_background = mo->mo_max_background;
+	if (mo->mo_congestion_threshold > 0)
+		conn->congestion_threshold = mo->mo_congestion_threshold;
+}
+
+/*
+ * Builds the reply to a read: allocated data are described by segments of
+ * the image fd, which libfuse can splice to the kernel without copying them
+ * through user space. Only holes are backed by (zeroed) memory. The memory
+ * buffers are freed the way libfuse frees the vector of a read_buf reply.
+ */
+int
+efs_fuse_read_bufvec(efs_file_t *f, size_t size, off_t off,
+    struct fuse_bufvec **bufp)
+{
+	struct fuse_bufvec *bv;
+	efs_seg_t *segs;
+	efs_arena_t arena;
+	int n;
+	int err = 0;
+
+	if (f->f_inode == NULL) {
+		/* virtual file, libfuse frees the copy */
+		if ((bv = malloc(sizeof (*bv))) == NULL)
+			return (ENOMEM);
+		*bv = FUSE_BUFVEC_INIT(0);
+		if (off < f->f_len) {
+			bv->buf[0].size = MIN(size, f->f_len - off);
+			if ((bv->buf[0].mem = malloc(bv->buf[0].size)) == NULL) {
+				free(bv);
+				return (ENOMEM);
+			}
+			memcpy(bv->buf[0].mem, f->f_data + off,
+			    bv->buf[0].size);
+		}
+		*bufp = bv;
+		return (0);
+	}
+
+	efs_arena_init(&arena);
+
+	n = efs_file_bmap(f, off, size, NULL);
+	bv = malloc(sizeof (*bv) + MAX(n - 1, 0) * sizeof (struct fuse_buf));
+	segs = efs_arena_alloc(&arena, MAX(n, 1) * sizeof (efs_seg_t));
+	if (bv == NULL || segs == NULL) {
+		free(bv);
+		efs_arena_destroy(&arena);
+		return (ENOMEM);
+	}
+
+	*bv = FUSE_BUFVEC_INIT(0);
+	if (n > 0) {
+		efs_file_bmap(f, off, size, segs);
+		bv->count = n;
+	}
+	for (int i = 0; i < n; i++) {
+		struct fuse_buf *b = &bv->buf[i];
+
+		b->size = segs[i].s_len;
+		if (segs[i].s_pos == EFS_SEG_HOLE) {
+			b->flags = 0;
+			b->fd = -1;
+			b->pos = 0;
+			if ((b->mem = calloc(1, b->size)) == NULL) {
+				bv->count = i;
+				err = ENOMEM;
+				break;
+			}
+		} else {
+			efs_fs_t *fs = f->f_inode->i_fs;
+			off_t pos = segs[i].s_pos - fs->start;
+			off_t last = (pos + b->size - 1) / BBS;
+
+			b->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK |
+			    FUSE_BUF_FD_RETRY;
+			b->mem = NULL;
+			b->fd = fs->fd;
+			b->pos = segs[i].s_pos;
+
+			/* libfuse reads it, account it as efs_bread() would */
+			EFS_STAT_INC(EFS_STAT_BREAD);
+			EFS_STAT_ADD(EFS_STAT_BREAD_BYTES, b->size);
+			if (efs_mrc_threshold != 0) {
+				for (off_t bb = pos / BBS; bb <= last; bb++)
+					efs_mrc_ref(EFS_MRC_BLOCK, bb);
+			}
+		}
+	}
+
+	efs_arena_destroy(&arena);
+
+	if (err != 0) {
+		efs_fuse_free_bufvec(bv);
+		return (err);
+	}
+
+	*bufp = bv;
+	return (0);
+}
+
+void
+efs_fuse_free_bufvec(struct fuse_bufvec *bv)
+{
+	for (size_t i = 0; i < bv->count; i++) {
+		if (!(bv->buf[i].flags & FUSE_BUF_IS_FD))
+			free(bv->buf[i].mem);
+	}
+	free(bv);
+}
+
+static size_t
+extent_map(efs_inode_t *inode, char *buf, size_t size)
+{
+	size_t len = 0;
+
+	for (int i = 0; i < inode->i_nextents; i++) {
+		efs_extent_t *e = &inode->i_extents[i];
+
+		len += snprintf(buf == NULL ? NULL : buf + len,
+		    buf == NULL ? 0 : size - len, "%lld %lld %lld\n",
+		    (long long)e->e_offset * BBS,
+		    (long long)(inode->i_fs->start + (off_t)e->e_blk * BBS),
+		    (long long)e->e_len * BBS);
+	}
+
+	return (len);
+}
+
+/*
+ * The xattr calls follow getxattr(2): with size 0, only the size of the
+ * value is returned in *len.
+ */
+int
+efs_fuse_getxattr(efs_inode_t *inode, const char *name, char *value,
+    size_t size, size_t *len)
+{
+	char *buf;
+
+	if (!S_ISREG(inode->i_mode) || strcmp(name, EFS_XATTR_EXTENTS) != 0)
+		return (ENODATA);
+
+	*len = extent_map(inode, NULL, 0);
+	if (size == 0)
+		return (0);
+	if (size < *len)
+		return (ERANGE);
+
+	/* snprintf() needs room for the terminating NUL */
+	if ((buf = malloc(*len + 1)) == NULL)
+		return (ENOMEM);
+	(void) extent_map(inode, buf, *len + 1);
+	memcpy(value, buf, *len);
+	free(buf);
+
+	return (0);
+}
+
+int
+efs_fuse_listxattr(efs_inode_t *inode, char *list, size_t size, size_t *len)
+{
+	*len = 0;
+	if (!S_ISREG(inode->i_mode))
+		return (0);
+
+	*len = sizeof (EFS_XATTR_EXTENTS);
+	if (size == 0)
+		return (0);
+	if (size < *len)
+		return (ERANGE);
+	memcpy(list, EFS_XATTR_EXTENTS, *len);
+
+	return (0);
+}
+
+int
+efs_fuse_stats_name(const char *name, int *json)
+{
+	if (strcmp(name, EFS_STATS_NAME) == 0)
+		*json = 0;
+	else if (strcmp(name, EFS_STATS_JSON_NAME) == 0)
+		*json = 1;
+	else
+		return (0);
+	return (1);
+}
+
+/*
+ * The size is unknown until the file is opened, the files are read with
+ * direct I/O, so the kernel does not clip reads to it.
+ */
+void
+efs_fuse_stats_stat(int json, struct stat *st)
+{
+	memset(st, 0, sizeof (*st));
+	st->st_ino = EFS_FUSE_STATS_INO(json);
+	st->st_mode = S_IFREG | 0444;
+	st->st_nlink = 1;
+}
+
+/*
+ * The statistics are formatted once, on open.
+ */
+int
+efs_fuse_stats_open(int json, efs_file_t **fp)
+{
+	size_t len;
+	char *buf;
+	int err;
+
+	if ((err = efs_stats_format(json, &buf, &len)) != 0)
+		return (err);
+	if ((err = efs_file_open_data(buf, len, fp)) != 0)
+		free(buf);
+
+	return (err);
+}
@@ -0,0 +1,90 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EFS_FUSE_H
+#define	EFS_FUSE_H
+
+/*
+ * Glue shared by the high-level (main.c) and low-level (efs_ll.c) FUSE
+ * front ends.
+ */
+
+#define	FUSE_USE_VERSION 35
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <fuse_common.h>
+
+/*
+ * Nothing on the image ever changes, so the kernel may cache whatever it
+ * gets from us for as long as it wants.
+ */
+#define	EFS_CACHE_TIMEOUT	86400.0	/* seconds */
+
+/*
+ * Mount options. Tuning of the FUSE connection uses 0 for the kernel
+ * default; the caching policy is set up by efs_mount_opts_init().
+ */
+typedef struct efs_mount_opts {
+	int mo_max_readahead;
+	int mo_max_background;
+	int mo_congestion_threshold;
+	int mo_prefetch;		/* directory order prefetch depth */
+	int mo_keep_cache;		/* keep page cache between opens */
+	int mo_use_ino;			/* report EFS inode numbers */
+	double mo_entry_timeout;
+	double mo_attr_timeout;
+	double mo_negative_timeout;
+	char *mo_stats_dump;		/* statistics written at unmount */
+	char *mo_trace_file;		/* trace rings written at unmount */
+	char *mo_hotset_file;		/* hot set manifest, see efs_hotset.h */
+} efs_mount_opts_t;
+
+/*
+ * The statistics (see efs_stats.h) are exposed as virtual files in the root
+ * directory. They hide files of the same name and are not listed by readdir;
+ * their inode numbers are above the range of EFS inode numbers.
+ */
+#define	EFS_FUSE_STATS_INO(json)	(((uint64_t)1 << 32) + (json))
+
+/*
+ * Virtual extended attribute with the extent map of a regular file, one
+ * "<file offset> <image offset> <length>" line per extent, all in bytes.
+ * The image offset can be used with the image file directly.
+ */
+#define	EFS_XATTR_EXTENTS	"user.efs.extents"
+
+struct efs_file;
+struct efs_inode;
+
+void efs_mount_opts_init(efs_mount_opts_t *mo);
+void efs_fuse_conn_init(const efs_mount_opts_t *mo,
+    struct fuse_conn_info *conn);
+int efs_fuse_read_bufvec(struct efs_file *f, size_t size, off_t off,
+    struct fuse_bufvec **bufp);
+void efs_fuse_free_bufvec(struct fuse_bufvec *bv);
+int efs_fuse_stats_name(const char *name, int *json);
+void efs_fuse_stats_stat(int json, struct stat *st);
+int efs_fuse_stats_open(int json, struct efs_file **fp);
+int efs_fuse_getxattr(struct efs_inode *inode, const char *name,
+    char *value, size_t size, size_t *len);
+int efs_fuse_listxattr(struct efs_inode *inode, char *list, size_t size,
+    size_t *len);
+
+#endif /* EFS_FUSE_H */
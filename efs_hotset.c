@@ -0,0 +1,374 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "efs_file.h"
+#include "efs_dir.h"
+#include "efs_stats.h"
+
+#include "efs_hotset.h"
+
+#define	HS_BATCH	256	/* inodes read at once */
+
+typedef struct hs_save {
+	efs_hotset_ent_t *s_ents;
+	uint32_t s_n;
+	uint32_t s_max;
+	int	s_err;
+} hs_save_t;
+
+static efs_fs_t *hs_fs;
+static efs_hotset_ent_t *hs_ents;
+static uint32_t hs_nents;
+static int hs_stopping;
+static int hs_started;
+static pthread_t hs_thread;
+
+static uint64_t
+hs_fsid(const efs_fs_t *fs)
+{
+	const uint8_t *p = (const uint8_t *)&fs->sb;
+	uint64_t h = 0xcbf29ce484222325ULL ^ (uint64_t)fs->start;
+
+	for (size_t i = 0; i < sizeof (fs->sb); i++)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	return (h);
+}
+
+static int
+hs_cmp_ino(const void *a, const void *b)
+{
+	const efs_hotset_ent_t *x = a, *y = b;
+
+	return (x->he_ino < y->he_ino ? -1 : x->he_ino > y->he_ino);
+}
+
+static int
+hs_cmp_uses(const void *a, const void *b)
+{
+	const efs_hotset_ent_t *x = a, *y = b;
+	uint64_t ux = (uint64_t)x->he_uses + x->he_reads;
+	uint64_t uy = (uint64_t)y->he_uses + y->he_reads;
+
+	return (ux > uy ? -1 : ux < uy);
+}
+
+/* Directory inodes and extents, by their first BB */
+static int
+hs_cmp_dir(const void *a, const void *b)
+{
+	const efs_inode_t *x = *(efs_inode_t * const *)a;
+	const efs_inode_t *y = *(efs_inode_t * const *)b;
+	uint32_t bx = x->i_nextents > 0 ? x->i_extents[0].e_blk : 0;
+	uint32_t by = y->i_nextents > 0 ? y->i_extents[0].e_blk : 0;
+
+	return (bx < by ? -1 : bx > by);
+}
+
+static int
+hs_cmp_ext(const void *a, const void *b)
+{
+	const efs_extent_t *x = a, *y = b;
+
+	return (x->e_blk < y->e_blk ? -1 : x->e_blk > y->e_blk);
+}
+
+static int
+hs_stopped(void)
+{
+	return (__atomic_load_n(&hs_stopping, __ATOMIC_RELAXED));
+}
+
+/*
+ * Reads the manifest, a missing one is not an error.
+ */
+static int
+hs_load(efs_fs_t *fs, const char *path)
+{
+	efs_hotset_hdr_t hh;
+	FILE *f;
+	int err = 0;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		if (errno == ENOENT)
+			return (0);
+		err = errno;
+		LOG_ERR("cannot open hot set '%s', error: %d\n", path, err);
+		return (err);
+	}
+	if (fread(&hh, sizeof (hh), 1, f) != 1 ||
+	    hh.hh_magic != EFS_HOTSET_MAGIC ||
+	    hh.hh_version != EFS_HOTSET_VERSION ||
+	    hh.hh_entsize != sizeof (efs_hotset_ent_t) ||
+	    hh.hh_nents > EFS_HOTSET_MAX) {
+		LOG_WARN(fs, "'%s' is not a hot set manifest\n", path);
+	} else if (hh.hh_fsid != hs_fsid(fs)) {
+		LOG_WARN(fs, "hot set '%s' is of another image\n", path);
+	} else if (hh.hh_nents > 0 &&
+	    (hs_ents = calloc(hh.hh_nents, sizeof (efs_hotset_ent_t))) ==
+	    NULL) {
+		err = ENOMEM;
+	} else if (fread(hs_ents, sizeof (efs_hotset_ent_t), hh.hh_nents,
+	    f) != hh.hh_nents) {
+		LOG_WARN(fs, "hot set '%s' is truncated\n", path);
+		free(hs_ents);
+		hs_ents = NULL;
+	} else {
+		hs_nents = hh.hh_nents;
+	}
+	(void) fclose(f);
+
+	return (err);
+}
+
+/*
+ * Asks for the data of the hot files, in physical order, adjacent extents
+ * merged. At most EFS_HOTSET_DATA_MAX bytes are read ahead.
+ */
+static uint64_t
+hs_warm_data(efs_inode_t **files, uint32_t nfiles)
+{
+	efs_extent_t *exts;
+	uint64_t bytes = 0;
+	uint32_t n = 0;
+
+	for (uint32_t k = 0; k < nfiles; k++)
+		n += files[k]->i_nextents;
+	if (n == 0 || (exts = malloc(n * sizeof (efs_extent_t))) == NULL)
+		return (0);
+	n = 0;
+	for (uint32_t k = 0; k < nfiles; k++) {
+		memcpy(&exts[n], files[k]->i_extents,
+		    files[k]->i_nextents * sizeof (efs_extent_t));
+		n += files[k]->i_nextents;
+	}
+	qsort(exts, n, sizeof (efs_extent_t), hs_cmp_ext);
+
+	for (uint32_t k = 0; k < n && bytes < EFS_HOTSET_DATA_MAX &&
+	    !hs_stopped(); ) {
+		uint32_t blk = exts[k].e_blk;
+		uint32_t end = blk + exts[k].e_len;
+		off_t len;
+
+		for (k++; k < n && exts[k].e_blk <= end; k++)
+			end = MAX(end, exts[k].e_blk + exts[k].e_len);
+		len = MIN((off_t)(end - blk) * BBS,
+		    EFS_HOTSET_DATA_MAX - (off_t)bytes);
+		(void) posix_fadvise(hs_fs->fd, hs_fs->start + (off_t)blk * BBS,
+		    len, POSIX_FADV_WILLNEED);
+		EFS_STAT_INC(EFS_STAT_SYSCALLS);
+		bytes += len;
+	}
+	free(exts);
+
+	return (bytes);
+}
+
+static void *
+hs_worker(void *arg)
+{
+	efs_inode_t **dirs, **files;
+	uint32_t ndirs = 0, nfiles = 0, ninos = 0;
+	uint64_t start = efs_stats_now();
+	uint64_t bytes;
+
+	dirs = malloc(hs_nents * sizeof (efs_inode_t *));
+	files = malloc(hs_nents * sizeof (efs_inode_t *));
+	if (dirs == NULL || files == NULL)
+		goto out;
+
+	/* Inodes are sorted by number, which is their order on disk. */
+	qsort(hs_ents, hs_nents, sizeof (efs_hotset_ent_t), hs_cmp_ino);
+	for (uint32_t k = 0; k < hs_nents && !hs_stopped(); k += HS_BATCH) {
+		efs_inode_t *inodes[HS_BATCH];
+		uint32_t inos[HS_BATCH];
+		uint32_t n = MIN(HS_BATCH, hs_nents - k);
+
+		for (uint32_t j = 0; j < n; j++)
+			inos[j] = hs_ents[k + j].he_ino;
+		if (efs_iget_batch(hs_fs, inos, n, inodes) != 0)
+			continue;
+		ninos += n;
+		EFS_STAT_ADD(EFS_STAT_WARMED, n);
+		for (uint32_t j = 0; j < n; j++) {
+			efs_inode_t *i = inodes[j];
+
+			if (EFS_BAD_FILE(i))
+				continue;
+			if (IS_DIR(i) && (hs_ents[k + j].he_flags &
+			    EFS_HOTSET_DIR) != 0)
+				dirs[ndirs++] = i;
+			else if (S_ISREG(i->i_mode) && (hs_ents[k + j].he_flags &
+			    EFS_HOTSET_DATA) != 0)
+				files[nfiles++] = i;
+		}
+	}
+
+	qsort(dirs, ndirs, sizeof (efs_inode_t *), hs_cmp_dir);
+	for (uint32_t k = 0; k < ndirs && !hs_stopped(); k++) {
+		efs_dir_snap_t *ds;
+
+		/* The inode keeps a reference to the snapshot. */
+		if (efs_dir_snap_get(dirs[k], &ds) == 0)
+			efs_dir_snap_rele(ds);
+	}
+
+	bytes = hs_warm_data(files, nfiles);
+	LOG_DBG1(hs_fs, "%s: %u inodes, %u directories, %llu bytes of data "
+	    "in %llu ms\n", __func__, ninos, ndirs, (unsigned long long)bytes,
+	    (unsigned long long)(efs_stats_now() - start) / 1000000);
+out:
+	free(dirs);
+	free(files);
+	free(hs_ents);
+	hs_ents = NULL;
+	hs_nents = 0;
+
+	return (NULL);
+}
+
+/*
+ * Loads the manifest and starts warming the caches in the background.
+ * Must be called after the process daemonized.
+ */
+int
+efs_hotset_start(efs_fs_t *fs, const char *path)
+{
+	int err;
+
+	if ((err = hs_load(fs, path)) != 0 || hs_nents == 0)
+		return (err);
+
+	hs_fs = fs;
+	hs_stopping = 0;
+	if ((err = pthread_create(&hs_thread, NULL, hs_worker, NULL)) != 0) {
+		LOG_ERR("%s: cannot start hot set thread, error %d\n",
+		    __func__, err);
+		free(hs_ents);
+		hs_ents = NULL;
+		hs_nents = 0;
+		return (err);
+	}
+	hs_started = 1;
+
+	return (0);
+}
+
+void
+efs_hotset_stop(void)
+{
+	if (!hs_started)
+		return;
+	__atomic_store_n(&hs_stopping, 1, __ATOMIC_RELAXED);
+	(void) pthread_join(hs_thread, NULL);
+	hs_started = 0;
+}
+
+static void
+hs_collect(efs_inode_t *i, void *arg)
+{
+	hs_save_t *s = arg;
+	efs_hotset_ent_t *e;
+	uint32_t uses = __atomic_load_n(&i->i_uses, __ATOMIC_RELAXED);
+	uint32_t reads = __atomic_load_n(&i->i_reads, __ATOMIC_RELAXED);
+
+	if ((uses == 0 && reads == 0) || s->s_err != 0)
+		return;
+	if (s->s_n == s->s_max) {
+		s->s_max = MAX(s->s_max * 2, 1024);
+		if ((e = realloc(s->s_ents, s->s_max *
+		    sizeof (efs_hotset_ent_t))) == NULL) {
+			s->s_err = ENOMEM;
+			return;
+		}
+		s->s_ents = e;
+	}
+	e = &s->s_ents[s->s_n++];
+	e->he_ino = i->i_num;
+	e->he_uses = uses;
+	e->he_reads = reads;
+	e->he_flags = (IS_DIR(i) ? EFS_HOTSET_DIR : 0) |
+	    (reads > 0 ? EFS_HOTSET_DATA : 0);
+}
+
+/*
+ * Writes the EFS_HOTSET_MAX most used cached inodes to the manifest. The
+ * file is replaced atomically, a failed save keeps the old one.
+ */
+int
+efs_hotset_save(efs_fs_t *fs, const char *path)
+{
+	efs_hotset_hdr_t hh;
+	hs_save_t s;
+	char tmp[4096];
+	FILE *f;
+	int err = 0;
+
+	memset(&s, 0, sizeof (s));
+	icache_walk(fs, hs_collect, &s);
+	if (s.s_err != 0) {
+		free(s.s_ents);
+		return (s.s_err);
+	}
+	if (s.s_n > EFS_HOTSET_MAX) {
+		qsort(s.s_ents, s.s_n, sizeof (efs_hotset_ent_t), hs_cmp_uses);
+		s.s_n = EFS_HOTSET_MAX;
+	}
+
+	(void) snprintf(tmp, sizeof (tmp), "%s.tmp", path);
+	if ((f = fopen(tmp, "w")) == NULL) {
+		err = errno;
+		LOG_ERR("cannot write hot set '%s', error: %d\n", tmp, err);
+		free(s.s_ents);
+		return (err);
+	}
+	memset(&hh, 0, sizeof (hh));
+	hh.hh_magic = EFS_HOTSET_MAGIC;
+	hh.hh_version = EFS_HOTSET_VERSION;
+	hh.hh_entsize = sizeof (efs_hotset_ent_t);
+	hh.hh_nents = s.s_n;
+	hh.hh_fsid = hs_fsid(fs);
+	if (fwrite(&hh, sizeof (hh), 1, f) != 1 ||
+	    (s.s_n > 0 && fwrite(s.s_ents, sizeof (efs_hotset_ent_t), s.s_n,
+	    f) != s.s_n))
+		err = EIO;
+	if (fclose(f) != 0 && err == 0)
+		err = errno;
+	if (err == 0 && rename(tmp, path) != 0)
+		err = errno;
+	if (err != 0) {
+		LOG_ERR("cannot write hot set '%s', error: %d\n", path, err);
+		(void) unlink(tmp);
+	} else {
+		LOG_DBG1(fs, "%s: %u inodes saved to '%s'\n", __func__, s.s_n,
+		    path);
+	}
+	free(s.s_ents);
+
+	return (err);
+}
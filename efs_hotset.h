@@ -0,0 +1,66 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef EFS_HOTSET_H
+#define	EFS_HOTSET_H
+
+#include <stdint.h>
+
+#include "efs_fs.h"
+
+/*
+ * Hot set warming. At unmount, the most used inodes are saved to a
+ * manifest: the inode numbers, whether they are directories and whether
+ * their data were read. At the next mount, a background thread reads the
+ * inodes, the directories and asks the kernel to read ahead the data,
+ * each in physical order, while requests are being served.
+ *
+ * The manifest is bound to the super block of the image it was made from
+ * and ignored for any other image.
+ */
+#define	EFS_HOTSET_MAGIC	0x45465348	/* "EFSH" */
+#define	EFS_HOTSET_VERSION	1
+#define	EFS_HOTSET_MAX		65536		/* inodes saved */
+#define	EFS_HOTSET_DATA_MAX	(256 * 1024 * 1024)	/* data read ahead */
+
+typedef struct efs_hotset_hdr {
+	uint32_t hh_magic;
+	uint16_t hh_version;
+	uint16_t hh_entsize;	/* sizeof (efs_hotset_ent_t) */
+	uint32_t hh_nents;
+	uint32_t hh_pad;
+	uint64_t hh_fsid;	/* hash of the super block */
+} efs_hotset_hdr_t;
+
+#define	EFS_HOTSET_DIR		1
+#define	EFS_HOTSET_DATA		2
+
+typedef struct efs_hotset_ent {
+	uint32_t he_ino;
+	uint32_t he_uses;
+	uint32_t he_reads;
+	uint32_t he_flags;	/* EFS_HOTSET_DIR, EFS_HOTSET_DATA */
+} efs_hotset_ent_t;
+
+int efs_hotset_start(efs_fs_t *fs, const char *path);
+void efs_hotset_stop(void);
+int efs_hotset_save(efs_fs_t *fs, const char *path);
+
+#endif /* EFS_HOTSET_H */
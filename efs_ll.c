@@ -0,0 +1,517 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "efs_fuse.h"
+
+#include <fuse_lowlevel.h>
+
+#include "efs_fs.h"
+#include "efs_file.h"
+#include "efs_dir.h"
+#include "efs_prefetch.h"
+#include "efs_stats.h"
+#include "efs_trace.h"
+#include "efs_record.h"
+#include "efs_hotset.h"
+#include "utils.h"
+
+#include "efs_ll.h"
+
+#define	LL_FS(req)	((efs_fs_t *)fuse_req_userdata(req))
+
+#define	NODE2INO(n)	((n) == FUSE_ROOT_ID ? FIRST_INO : (uint32_t)(n))
+#define	INO2NODE(i)	((i) == FIRST_INO ? FUSE_ROOT_ID : (fuse_ino_t)(i))
+
+/* Number of directory entries whose inodes are fetched at once. */
+#define	LL_READDIR_BATCH	64
+
+static const efs_mount_opts_t *ll_mo;
+
+/* Node IDs of the statistics files */
+#define	LL_IS_STATS(n)	((n) == EFS_FUSE_STATS_INO(0) || \
+	(n) == EFS_FUSE_STATS_INO(1))
+
+/*
+ * Gets the inode of a node ID. Bad inodes can be looked up, but not used.
+ */
+static int
+ll_iget(fuse_req_t req, fuse_ino_t node, efs_inode_t **inode)
+{
+	int err;
+
+	if (LL_IS_STATS(node))
+		return (ENODATA);
+	if ((err = efs_iget(LL_FS(req), NODE2INO(node), inode)) != 0)
+		return (err);
+	if (EFS_BAD_FILE((*inode)))
+		return (EIO);
+	return (0);
+}
+
+static void
+efs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_LOOKUP);
+	struct fuse_entry_param e;
+	efs_inode_t *dir;
+	efs_inode_t *inode;
+	uint32_t ino = 0;
+	int json;
+	int err = 0;
+
+	LOG_DBG2(LL_FS(req), "%s: parent %lu, name '%s'\n", __func__, parent,
+	    name);
+
+	memset(&e, 0, sizeof (e));
+	e.attr_timeout = ll_mo->mo_attr_timeout;
+	e.entry_timeout = ll_mo->mo_entry_timeout;
+
+	if (parent == FUSE_ROOT_ID && efs_fuse_stats_name(name, &json)) {
+		efs_fuse_stats_stat(json, &e.attr);
+		e.ino = EFS_FUSE_STATS_INO(json);
+		e.attr_timeout = 0;
+		fuse_reply_entry(req, &e);
+	} else if ((err = ll_iget(req, parent, &dir)) != 0 ||
+	    (err = efs_dir_lookup(dir, (char *)name, &ino)) != 0 ||
+	    (err = efs_iget(LL_FS(req), ino, &inode)) != 0) {
+		/* A zero node ID makes the kernel cache the miss. */
+		if (err == ENOENT && ll_mo->mo_negative_timeout > 0) {
+			e.attr_timeout = 0;
+			e.entry_timeout = ll_mo->mo_negative_timeout;
+			fuse_reply_entry(req, &e);
+		} else {
+			fuse_reply_err(req, err);
+		}
+	} else {
+		e.ino = INO2NODE(ino);
+		e.generation = GET_I32(inode->i_od.di_gen);
+		e.attr = inode->i_stat;
+		fuse_reply_entry(req, &e);
+	}
+
+	EFS_RECORD(EFS_OP_LOOKUP, start, err, name, NODE2INO(parent), 0,
+	    err == 0 ? ino : 0, 0);
+	efs_stats_op(EFS_OP_LOOKUP, start);
+}
+
+/*
+ * Inodes stay in the cache until unmount, there is nothing to forget.
+ */
+static void
+efs_ll_forget(fuse_req_t req, fuse_ino_t node, uint64_t nlookup)
+{
+	fuse_reply_none(req);
+}
+
+static void
+efs_ll_getattr(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_GETATTR);
+	efs_inode_t *inode;
+	struct stat st;
+	int err = 0;
+
+	if (LL_IS_STATS(node)) {
+		efs_fuse_stats_stat(node == EFS_FUSE_STATS_INO(1), &st);
+		fuse_reply_attr(req, &st, 0);
+	} else if ((err = ll_iget(req, node, &inode)) != 0) {
+		fuse_reply_err(req, err);
+	} else {
+		fuse_reply_attr(req, &inode->i_stat, ll_mo->mo_attr_timeout);
+	}
+
+	EFS_RECORD(EFS_OP_GETATTR, start, err, NULL, NODE2INO(node), 0, 0, 0);
+	efs_stats_op(EFS_OP_GETATTR, start);
+}
+
+static void
+efs_ll_open(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_OPEN);
+	efs_inode_t *inode = NULL;
+	efs_file_t *f;
+	int err;
+
+	if (LL_IS_STATS(node)) {
+		err = efs_fuse_stats_open(node == EFS_FUSE_STATS_INO(1), &f);
+	} else if ((err = ll_iget(req, node, &inode)) == 0) {
+		if (IS_DIR(inode))
+			err = EISDIR;
+		else
+			err = efs_file_open(inode, &f);
+	}
+
+	if (err != 0) {
+		fuse_reply_err(req, err);
+	} else {
+		fi->fh = (uintptr_t)f;
+		if (inode != NULL) {
+			fi->keep_cache = ll_mo->mo_keep_cache;
+			efs_prefetch_open(inode);
+		} else {
+			fi->direct_io = 1;
+		}
+		fuse_reply_open(req, fi);
+	}
+
+	EFS_RECORD(EFS_OP_OPEN, start, err, NULL, NODE2INO(node),
+	    err == 0 ? fi->fh : 0, 0, 0);
+	efs_stats_op(EFS_OP_OPEN, start);
+}
+
+static void
+efs_ll_read(fuse_req_t req, fuse_ino_t node, size_t size, off_t off,
+    struct fuse_file_info *fi)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_READ);
+	efs_file_t *f = (efs_file_t *)(uintptr_t)fi->fh;
+	struct fuse_bufvec *bv;
+	int err;
+
+	LOG_DBG2(LL_FS(req), "%s: node %lu, size=%ld, offset=%ld\n", __func__,
+	    node, size, off);
+
+	if ((err = efs_fuse_read_bufvec(f, size, off, &bv)) != 0) {
+		fuse_reply_err(req, err);
+	} else {
+		fuse_reply_data(req, bv, FUSE_BUF_SPLICE_MOVE);
+		efs_fuse_free_bufvec(bv);
+	}
+
+	EFS_RECORD(EFS_OP_READ, start, err, NULL, NODE2INO(node), fi->fh, off,
+	    size);
+	efs_stats_op(EFS_OP_READ, start);
+}
+
+static void
+efs_ll_release(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_RELEASE);
+
+	efs_file_close((efs_file_t *)(uintptr_t)fi->fh);
+	fuse_reply_err(req, 0);
+
+	EFS_RECORD(EFS_OP_RELEASE, start, 0, NULL, NODE2INO(node), fi->fh, 0,
+	    0);
+	efs_stats_op(EFS_OP_RELEASE, start);
+}
+
+static void
+efs_ll_lseek(fuse_req_t req, fuse_ino_t node, off_t off, int whence,
+    struct fuse_file_info *fi)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_LSEEK);
+	efs_file_t *f = (efs_file_t *)(uintptr_t)fi->fh;
+	off_t res;
+	int err;
+
+	if (f->f_inode == NULL)
+		err = EINVAL;
+	else
+		err = efs_seek_data(f->f_inode, off, whence, &res);
+
+	if (err != 0)
+		fuse_reply_err(req, err);
+	else
+		fuse_reply_lseek(req, res);
+
+	EFS_RECORD(EFS_OP_LSEEK, start, err, NULL, NODE2INO(node), fi->fh, off,
+	    whence);
+	efs_stats_op(EFS_OP_LSEEK, start);
+}
+
+static void
+efs_ll_getxattr(fuse_req_t req, fuse_ino_t node, const char *name,
+    size_t size)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_GETXATTR);
+	efs_inode_t *inode;
+	char *value = NULL;
+	size_t len;
+	int err;
+
+	if (size > 0 && (value = malloc(size)) == NULL)
+		err = ENOMEM;
+	else if ((err = ll_iget(req, node, &inode)) == 0)
+		err = efs_fuse_getxattr(inode, name, value, size, &len);
+
+	if (err != 0)
+		fuse_reply_err(req, err);
+	else if (size == 0)
+		fuse_reply_xattr(req, len);
+	else
+		fuse_reply_buf(req, value, len);
+
+	free(value);
+	EFS_RECORD(EFS_OP_GETXATTR, start, err, NULL, NODE2INO(node), 0, 0,
+	    size);
+	efs_stats_op(EFS_OP_GETXATTR, start);
+}
+
+static void
+efs_ll_listxattr(fuse_req_t req, fuse_ino_t node, size_t size)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_LISTXATTR);
+	efs_inode_t *inode;
+	char *list = NULL;
+	size_t len = 0;
+	int err = 0;
+
+	if (size > 0 && (list = malloc(size)) == NULL)
+		err = ENOMEM;
+	else if (!LL_IS_STATS(node) && (err = ll_iget(req, node, &inode)) == 0)
+		err = efs_fuse_listxattr(inode, list, size, &len);
+
+	if (err != 0)
+		fuse_reply_err(req, err);
+	else if (size == 0)
+		fuse_reply_xattr(req, len);
+	else
+		fuse_reply_buf(req, list, len);
+
+	free(list);
+	EFS_RECORD(EFS_OP_LISTXATTR, start, err, NULL, NODE2INO(node), 0, 0,
+	    size);
+	efs_stats_op(EFS_OP_LISTXATTR, start);
+}
+
+static void
+efs_ll_opendir(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_OPENDIR);
+	efs_dir_snap_t *ds;
+	efs_inode_t *inode;
+	int err;
+
+	if ((err = ll_iget(req, node, &inode)) != 0 ||
+	    (err = efs_dir_snap_get(inode, &ds)) != 0) {
+		fuse_reply_err(req, err);
+	} else {
+		fi->fh = (uintptr_t)ds;
+		fi->cache_readdir = ll_mo->mo_keep_cache;
+		efs_prefetch_dir(ds);
+		fuse_reply_open(req, fi);
+	}
+
+	EFS_RECORD(EFS_OP_OPENDIR, start, err, NULL, NODE2INO(node),
+	    err == 0 ? fi->fh : 0, 0, 0);
+	efs_stats_op(EFS_OP_OPENDIR, start);
+}
+
+/*
+ * The offset is an index into the decoded directory. Entries are added
+ * until the reply buffer is full; with readdirplus, each one carries its
+ * attributes as if it was looked up.
+ */
+static void
+ll_readdir(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi,
+    int plus)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_READDIR);
+	efs_dir_snap_t *ds = (efs_dir_snap_t *)(uintptr_t)fi->fh;
+	uint32_t idx = off;
+	size_t used = 0;
+	int full = 0;
+	char *buf;
+	int err = 0;
+
+	if ((buf = malloc(size)) == NULL) {
+		fuse_reply_err(req, ENOMEM);
+		efs_stats_op(EFS_OP_READDIR, start);
+		return;
+	}
+
+	while (!full && idx < ds->ds_nentries) {
+		efs_inode_t *items[LL_READDIR_BATCH];
+		uint32_t inos[LL_READDIR_BATCH];
+		uint32_t n = MIN(LL_READDIR_BATCH, ds->ds_nentries - idx);
+
+		for (uint32_t k = 0; k < n; k++)
+			inos[k] = ds->ds_entries[idx + k].dse_ino;
+		if ((err = efs_iget_batch(LL_FS(req), inos, n, items)) != 0)
+			break;
+
+		for (uint32_t k = 0; k < n; k++, idx++) {
+			struct fuse_entry_param e;
+			size_t len;
+
+			if (plus) {
+				memset(&e, 0, sizeof (e));
+				e.ino = INO2NODE(inos[k]);
+				e.generation = GET_I32(items[k]->i_od.di_gen);
+				e.attr = items[k]->i_stat;
+				e.attr_timeout = ll_mo->mo_attr_timeout;
+				e.entry_timeout = ll_mo->mo_entry_timeout;
+				len = fuse_add_direntry_plus(req, buf + used,
+				    size - used, DS_NAME(ds, idx), &e, idx + 1);
+			} else {
+				len = fuse_add_direntry(req, buf + used,
+				    size - used, DS_NAME(ds, idx),
+				    &items[k]->i_stat, idx + 1);
+			}
+			if (len > size - used) {
+				full = 1;
+				break;
+			}
+			used += len;
+		}
+	}
+
+	if (err != 0 && used == 0)
+		fuse_reply_err(req, err);
+	else
+		fuse_reply_buf(req, buf, used);
+
+	free(buf);
+	EFS_RECORD(EFS_OP_READDIR, start, err, NULL, ds->ds_inode->i_num,
+	    fi->fh, off, idx - off);
+	efs_stats_op(EFS_OP_READDIR, start);
+}
+
+static void
+efs_ll_readdir(fuse_req_t req, fuse_ino_t node, size_t size, off_t off,
+    struct fuse_file_info *fi)
+{
+	ll_readdir(req, size, off, fi, 0);
+}
+
+static void
+efs_ll_readdirplus(fuse_req_t req, fuse_ino_t node, size_t size, off_t off,
+    struct fuse_file_info *fi)
+{
+	ll_readdir(req, size, off, fi, 1);
+}
+
+static void
+efs_ll_releasedir(fuse_req_t req, fuse_ino_t node, struct fuse_file_info *fi)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_RELEASEDIR);
+
+	efs_dir_snap_rele((efs_dir_snap_t *)(uintptr_t)fi->fh);
+	fuse_reply_err(req, 0);
+
+	EFS_RECORD(EFS_OP_RELEASEDIR, start, 0, NULL, NODE2INO(node), fi->fh,
+	    0, 0);
+	efs_stats_op(EFS_OP_RELEASEDIR, start);
+}
+
+static void
+efs_ll_statfs(fuse_req_t req, fuse_ino_t node)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_STATFS);
+	struct statvfs st;
+
+	efs_fs_statvfs(LL_FS(req), &st);
+	fuse_reply_statfs(req, &st);
+
+	EFS_RECORD(EFS_OP_STATFS, start, 0, NULL, 0, 0, 0, 0);
+	efs_stats_op(EFS_OP_STATFS, start);
+}
+
+static void
+efs_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	efs_fuse_conn_init(ll_mo, conn);
+	(void) efs_prefetch_start(userdata, ll_mo->mo_prefetch);
+	if (ll_mo->mo_hotset_file != NULL)
+		(void) efs_hotset_start(userdata, ll_mo->mo_hotset_file);
+}
+
+static void
+efs_ll_destroy(void *userdata)
+{
+	efs_prefetch_stop();
+	efs_hotset_stop();
+	if (ll_mo->mo_hotset_file != NULL)
+		(void) efs_hotset_save(userdata, ll_mo->mo_hotset_file);
+	if (ll_mo->mo_stats_dump != NULL)
+		(void) efs_stats_dump(ll_mo->mo_stats_dump);
+	if (ll_mo->mo_trace_file != NULL)
+		(void) efs_trace_dump(ll_mo->mo_trace_file);
+	efs_record_close();
+}
+
+static struct fuse_lowlevel_ops efs_ll_oper = {
+	.lookup = efs_ll_lookup,
+	.forget = efs_ll_forget,
+	.getattr = efs_ll_getattr,
+	.open = efs_ll_open,
+	.read = efs_ll_read,
+	.release = efs_ll_release,
+	.lseek = efs_ll_lseek,
+	.getxattr = efs_ll_getxattr,
+	.listxattr = efs_ll_listxattr,
+	.opendir = efs_ll_opendir,
+	.readdir = efs_ll_readdir,
+	.readdirplus = efs_ll_readdirplus,
+	.releasedir = efs_ll_releasedir,
+	.statfs = efs_ll_statfs,
+	.init = efs_ll_init,
+	.destroy = efs_ll_destroy
+};
+
+int
+efs_ll_main(efs_fs_t *fs, const efs_mount_opts_t *mo, struct fuse_args *args)
+{
+	struct fuse_cmdline_opts opts;
+	struct fuse_loop_config config;
+	struct fuse_session *se;
+	int err = -1;
+
+	if (fuse_parse_cmdline(args, &opts) != 0)
+		return (-1);
+
+	ll_mo = mo;
+	se = fuse_session_new(args, &efs_ll_oper, sizeof (efs_ll_oper), fs);
+	if (se == NULL)
+		goto out;
+
+	if (fuse_set_signal_handlers(se) != 0)
+		goto destroy;
+	if (fuse_session_mount(se, opts.mountpoint) != 0)
+		goto remove_handlers;
+
+	if (fuse_daemonize(opts.foreground) == 0) {
+		LOG_DBG1(fs, "entering low-level fuse loop, %s\n",
+		    opts.singlethread ? "single thread" : "multithreaded");
+		if (opts.singlethread) {
+			err = fuse_session_loop(se);
+		} else {
+			config.clone_fd = opts.clone_fd;
+			config.max_idle_threads = opts.max_idle_threads;
+			err = fuse_session_loop_mt(se, &config);
+		}
+	}
+
+	fuse_session_unmount(se);
+remove_handlers:
+	fuse_remove_signal_handlers(se);
+destroy:
+	fuse_session_destroy(se);
+out:
+	free(opts.mountpoint);
+
+	return (err);
+}
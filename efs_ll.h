@@ -0,0 +1,37 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EFS_LL_H
+#define	EFS_LL_H
+
+#include "efs_fs.h"
+#include "efs_fuse.h"
+
+/*
+ * Low-level FUSE front end. Requests are addressed by inode number, FUSE
+ * node IDs map directly onto EFS inodes; only the root differs, FUSE
+ * always calls it FUSE_ROOT_ID.
+ */
+
+struct fuse_args;
+
+int efs_ll_main(efs_fs_t *fs, const efs_mount_opts_t *mo,
+    struct fuse_args *args);
+
+#endif /* EFS_LL_H */
@@ -0,0 +1,148 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+#include "efs_mem.h"
+
+#define	MEM_ALIGN	16
+#define	MEM_ROUNDUP(x)	(((x) + MEM_ALIGN - 1) & ~((size_t)MEM_ALIGN - 1))
+
+void
+efs_arena_init(efs_arena_t *a)
+{
+	a->a_used = 0;
+	a->a_chunks = NULL;
+}
+
+void *
+efs_arena_alloc(efs_arena_t *a, size_t size)
+{
+	efs_arena_chunk_t *c;
+	void *ptr;
+
+	size = MEM_ROUNDUP(size);
+
+	if (a->a_used + size <= sizeof (a->a_inline)) {
+		ptr = &a->a_inline[a->a_used];
+		a->a_used += size;
+		return (ptr);
+	}
+
+	c = a->a_chunks;
+	if (c == NULL || c->ac_used + size > c->ac_size) {
+		size_t csize = MAX(size, EFS_ARENA_CHUNK);
+
+		if ((c = malloc(sizeof (*c) + csize)) == NULL)
+			return (NULL);
+		c->ac_size = csize;
+		c->ac_used = 0;
+		c->ac_next = a->a_chunks;
+		a->a_chunks = c;
+	}
+
+	ptr = &c->ac_data[c->ac_used];
+	c->ac_used += size;
+	return (ptr);
+}
+
+char *
+efs_arena_strdup(efs_arena_t *a, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *d;
+
+	if ((d = efs_arena_alloc(a, len)) != NULL)
+		memcpy(d, s, len);
+	return (d);
+}
+
+void
+efs_arena_destroy(efs_arena_t *a)
+{
+	efs_arena_chunk_t *c = a->a_chunks;
+
+	while (c != NULL) {
+		efs_arena_chunk_t *next = c->ac_next;
+		free(c);
+		c = next;
+	}
+	efs_arena_init(a);
+}
+
+/*
+ * Each slab starts with a pointer to the next slab, objects follow. Free
+ * objects are linked through their first word.
+ */
+#define	SLAB_HDR	MEM_ROUNDUP(sizeof (void *))
+
+void *
+efs_pool_alloc(efs_pool_t *p)
+{
+	size_t objsize = MEM_ROUNDUP(p->p_objsize);
+	void *obj;
+
+	if (p->p_free == NULL) {
+		char *slab;
+
+		slab = malloc(SLAB_HDR + objsize * p->p_per_slab);
+		if (slab == NULL)
+			return (NULL);
+		*(void **)slab = p->p_slabs;
+		p->p_slabs = slab;
+		p->p_nslabs++;
+
+		for (unsigned i = 0; i < p->p_per_slab; i++) {
+			obj = slab + SLAB_HDR + i * objsize;
+			*(void **)obj = p->p_free;
+			p->p_free = obj;
+		}
+	}
+
+	obj = p->p_free;
+	p->p_free = *(void **)obj;
+	memset(obj, 0, p->p_objsize);
+
+	return (obj);
+}
+
+void
+efs_pool_free(efs_pool_t *p, void *obj)
+{
+	*(void **)obj = p->p_free;
+	p->p_free = obj;
+}
+
+void
+efs_pool_destroy(efs_pool_t *p)
+{
+	void *slab = p->p_slabs;
+
+	while (slab != NULL) {
+		void *next = *(void **)slab;
+		free(slab);
+		slab = next;
+	}
+	p->p_slabs = NULL;
+	p->p_free = NULL;
+	p->p_nslabs = 0;
+}
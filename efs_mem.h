@@ -0,0 +1,70 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EFS_MEM_H
+#define	EFS_MEM_H
+
+#include <sys/types.h>
+
+/*
+ * Arena allocator. Allocations are carved from an inline buffer first and
+ * then from malloc()ed chunks; everything is released at once by
+ * efs_arena_destroy(). A per-request arena lives on the caller's stack.
+ */
+#define	EFS_ARENA_INLINE	1024
+#define	EFS_ARENA_CHUNK		(16 * 1024)
+
+typedef struct efs_arena_chunk {
+	struct efs_arena_chunk *ac_next;
+	size_t	ac_size;
+	size_t	ac_used;
+	char	ac_data[] __attribute__((aligned(16)));
+} efs_arena_chunk_t;
+
+typedef struct efs_arena {
+	char	a_inline[EFS_ARENA_INLINE] __attribute__((aligned(16)));
+	size_t	a_used;			/* bytes used in a_inline */
+	efs_arena_chunk_t *a_chunks;	/* current chunk is the first one */
+} efs_arena_t;
+
+void efs_arena_init(efs_arena_t *a);
+void *efs_arena_alloc(efs_arena_t *a, size_t size);
+char *efs_arena_strdup(efs_arena_t *a, const char *s);
+void efs_arena_destroy(efs_arena_t *a);
+
+/*
+ * Slab pool of fixed-size objects. Objects are handed out from slabs of
+ * p_per_slab objects and recycled through a free list; the slabs are freed
+ * in bulk by efs_pool_destroy(). The pool is not locked, callers serialize.
+ */
+typedef struct efs_pool {
+	size_t	p_objsize;
+	unsigned p_per_slab;
+	void	*p_slabs;	/* list of slabs */
+	void	*p_free;	/* list of free objects */
+	size_t	p_nslabs;
+} efs_pool_t;
+
+#define	EFS_POOL_INITIALIZER(size, n)	{ (size), (n), NULL, NULL, 0 }
+
+void *efs_pool_alloc(efs_pool_t *p);
+void efs_pool_free(efs_pool_t *p, void *obj);
+void efs_pool_destroy(efs_pool_t *p);
+
+#endif /* EFS_MEM_H */
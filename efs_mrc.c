@@ -0,0 +1,292 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+#include "efs_mrc.h"
+
+#define	MRC_HASH_BITS	24		/* hashes are compared in this range */
+#define	MRC_MIN_SLOTS	1024		/* power of 2 */
+
+/* A sampled key and the time of its last reference, 0 is a free slot */
+typedef struct mrc_key {
+	uint64_t mk_key;
+	uint64_t mk_time;
+} mrc_key_t;
+
+/*
+ * Time advances by one on every sampled reference. The Fenwick tree has a
+ * 1 at the time of the last reference of each key, so the keys referenced
+ * after time t are a prefix sum away. When the time runs out of the tree,
+ * the keys are renumbered in order.
+ */
+typedef struct mrc {
+	pthread_mutex_t m_mtx;
+	mrc_key_t *m_keys;
+	uint32_t m_nslots;
+	uint32_t m_nkeys;
+	uint32_t *m_fen;
+	uint64_t m_fsize;
+	uint64_t m_now;
+	efs_mrc_curve_t m_curve;
+} mrc_t;
+
+static const char *mrc_names[EFS_MRC_NCACHES] = {
+	"blocks",
+	"inodes",
+	"names"
+};
+
+uint32_t efs_mrc_threshold;
+static uint32_t mrc_sample_rate;
+static mrc_t mrcs[EFS_MRC_NCACHES] = {
+	[0 ... EFS_MRC_NCACHES - 1] = { PTHREAD_MUTEX_INITIALIZER }
+};
+
+static uint64_t
+mrc_hash(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return (x ^ (x >> 31));
+}
+
+static void
+fen_add(mrc_t *m, uint64_t i, int v)
+{
+	for (; i <= m->m_fsize; i += i & -i)
+		m->m_fen[i] += v;
+}
+
+static uint64_t
+fen_sum(mrc_t *m, uint64_t i)
+{
+	uint64_t s = 0;
+
+	for (; i > 0; i -= i & -i)
+		s += m->m_fen[i];
+	return (s);
+}
+
+static mrc_key_t *
+mrc_slot(mrc_key_t *keys, uint32_t nslots, uint64_t key, uint64_t h)
+{
+	uint32_t i = h & (nslots - 1);
+
+	while (keys[i].mk_time != 0 && keys[i].mk_key != key)
+		i = (i + 1) & (nslots - 1);
+	return (&keys[i]);
+}
+
+static int
+mrc_grow(mrc_t *m)
+{
+	uint32_t nslots = m->m_nslots * 2;
+	mrc_key_t *keys;
+
+	if ((keys = calloc(nslots, sizeof (mrc_key_t))) == NULL)
+		return (ENOMEM);
+	for (uint32_t i = 0; i < m->m_nslots; i++) {
+		mrc_key_t *k = &m->m_keys[i];
+
+		if (k->mk_time != 0)
+			*mrc_slot(keys, nslots, k->mk_key,
+			    mrc_hash(k->mk_key)) = *k;
+	}
+	free(m->m_keys);
+	m->m_keys = keys;
+	m->m_nslots = nslots;
+
+	return (0);
+}
+
+static int
+mrc_time_cmp(const void *a, const void *b)
+{
+	uint64_t x = (*(mrc_key_t * const *)a)->mk_time;
+	uint64_t y = (*(mrc_key_t * const *)b)->mk_time;
+
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * Renumbers the last references 1..nkeys, keeping their order, and makes
+ * sure the tree has room for at least as many new references.
+ */
+static int
+mrc_compact(mrc_t *m)
+{
+	uint64_t fsize = MAX(m->m_fsize, (uint64_t)m->m_nkeys * 2);
+	mrc_key_t **order;
+	uint32_t *fen;
+	uint32_t n = 0;
+
+	if ((order = malloc(m->m_nkeys * sizeof (mrc_key_t *))) == NULL)
+		return (ENOMEM);
+	if ((fen = calloc(fsize + 1, sizeof (uint32_t))) == NULL) {
+		free(order);
+		return (ENOMEM);
+	}
+	for (uint32_t i = 0; i < m->m_nslots; i++) {
+		if (m->m_keys[i].mk_time != 0)
+			order[n++] = &m->m_keys[i];
+	}
+	qsort(order, n, sizeof (mrc_key_t *), mrc_time_cmp);
+
+	free(m->m_fen);
+	m->m_fen = fen;
+	m->m_fsize = fsize;
+	for (uint32_t i = 0; i < n; i++) {
+		order[i]->mk_time = i + 1;
+		fen_add(m, i + 1, 1);
+	}
+	m->m_now = n;
+	free(order);
+
+	return (0);
+}
+
+/*
+ * Sets up sampling of 1 in rate keys and starts it.
+ */
+int
+efs_mrc_init(uint32_t rate)
+{
+	if (rate == 0)
+		return (EINVAL);
+
+	for (int c = 0; c < EFS_MRC_NCACHES; c++) {
+		mrc_t *m = &mrcs[c];
+
+		m->m_nslots = MRC_MIN_SLOTS;
+		m->m_fsize = MRC_MIN_SLOTS;
+		m->m_keys = calloc(m->m_nslots, sizeof (mrc_key_t));
+		m->m_fen = calloc(m->m_fsize + 1, sizeof (uint32_t));
+		if (m->m_keys == NULL || m->m_fen == NULL) {
+			efs_mrc_fini();
+			return (ENOMEM);
+		}
+	}
+	mrc_sample_rate = rate;
+	__atomic_store_n(&efs_mrc_threshold,
+	    MAX((1U << MRC_HASH_BITS) / rate, 1), __ATOMIC_RELEASE);
+
+	return (0);
+}
+
+/*
+ * Stops sampling and frees the simulated caches, the request threads must
+ * be gone already.
+ */
+void
+efs_mrc_fini(void)
+{
+	efs_mrc_threshold = 0;
+	for (int c = 0; c < EFS_MRC_NCACHES; c++) {
+		free(mrcs[c].m_keys);
+		free(mrcs[c].m_fen);
+		mrcs[c].m_keys = NULL;
+		mrcs[c].m_fen = NULL;
+	}
+}
+
+uint32_t
+efs_mrc_rate(void)
+{
+	return (efs_mrc_threshold != 0 ? mrc_sample_rate : 0);
+}
+
+const char *
+efs_mrc_name(efs_mrc_cache_t c)
+{
+	return (mrc_names[c]);
+}
+
+/*
+ * Accounts a reference to the key of cache c. Only sampled keys take the
+ * lock; if memory runs out the reference is not counted.
+ */
+void
+efs_mrc_ref(efs_mrc_cache_t c, uint64_t key)
+{
+	uint64_t h = mrc_hash(key);
+	mrc_t *m = &mrcs[c];
+	mrc_key_t *k;
+	uint64_t t;
+
+	if ((h >> (64 - MRC_HASH_BITS)) >= efs_mrc_threshold)
+		return;
+
+	pthread_mutex_lock(&m->m_mtx);
+	if ((m->m_nkeys + 1) * 4 > m->m_nslots * 3 && mrc_grow(m) != 0)
+		goto out;
+	if (m->m_now == m->m_fsize && mrc_compact(m) != 0)
+		goto out;
+
+	k = mrc_slot(m->m_keys, m->m_nslots, key, h);
+	t = ++m->m_now;
+	if (k->mk_time == 0) {
+		k->mk_key = key;
+		m->m_nkeys++;
+		m->m_curve.mc_cold++;
+	} else {
+		uint64_t d = fen_sum(m, t - 1) - fen_sum(m, k->mk_time);
+		int b;
+
+		d *= mrc_sample_rate;
+		b = d == 0 ? 0 : 64 - __builtin_clzll(d);
+		m->m_curve.mc_hist[MIN(b, EFS_MRC_BUCKETS - 1)]++;
+		fen_add(m, k->mk_time, -1);
+	}
+	k->mk_time = t;
+	fen_add(m, t, 1);
+	m->m_curve.mc_refs++;
+out:
+	pthread_mutex_unlock(&m->m_mtx);
+}
+
+void
+efs_mrc_get(efs_mrc_cache_t c, efs_mrc_curve_t *cv)
+{
+	pthread_mutex_lock(&mrcs[c].m_mtx);
+	*cv = mrcs[c].m_curve;
+	pthread_mutex_unlock(&mrcs[c].m_mtx);
+}
+
+/*
+ * The estimated miss ratio of an LRU cache of 2^b objects.
+ */
+double
+efs_mrc_miss_ratio(const efs_mrc_curve_t *cv, int b)
+{
+	uint64_t miss = cv->mc_cold;
+
+	if (cv->mc_refs == 0)
+		return (0);
+	for (int j = b + 1; j < EFS_MRC_BUCKETS; j++)
+		miss += cv->mc_hist[j];
+	return ((double)miss / cv->mc_refs);
+}
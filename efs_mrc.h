@@ -0,0 +1,71 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef EFS_MRC_H
+#define	EFS_MRC_H
+
+#include <stdint.h>
+
+/*
+ * Miss ratio curves of the block, inode and name caches, estimated at
+ * runtime with SHARDS (spatially hashed sampling of reuse distances).
+ * A key is sampled when its hash falls below a threshold, so 1 in
+ * efs_mrc_init(rate) keys is tracked, with all its references. The reuse
+ * distance of a reference, the number of distinct sampled keys seen since
+ * the previous reference to the same key, is scaled by the rate and
+ * counted in a log2 histogram; a reference hits an LRU cache of n objects
+ * if its distance is below n.
+ *
+ * Sampling is off unless efs_mrc_init() is called, the check before any
+ * work is a single load.
+ */
+typedef enum efs_mrc_cache {
+	EFS_MRC_BLOCK,		/* basic blocks read by efs_bread_bbs() */
+	EFS_MRC_INODE,		/* efs_iget() */
+	EFS_MRC_NAME,		/* paths resolved by efs_dir_namei() */
+	EFS_MRC_NCACHES
+} efs_mrc_cache_t;
+
+/* Bucket b counts references hitting a cache of 2^b, but not 2^(b-1) */
+#define	EFS_MRC_BUCKETS		32
+
+typedef struct efs_mrc_curve {
+	uint64_t mc_refs;	/* sampled references */
+	uint64_t mc_cold;	/* first references, never hit */
+	uint64_t mc_hist[EFS_MRC_BUCKETS];
+} efs_mrc_curve_t;
+
+extern uint32_t efs_mrc_threshold;
+
+int efs_mrc_init(uint32_t rate);
+void efs_mrc_fini(void);
+uint32_t efs_mrc_rate(void);
+void efs_mrc_ref(efs_mrc_cache_t c, uint64_t key);
+void efs_mrc_get(efs_mrc_cache_t c, efs_mrc_curve_t *cv);
+double efs_mrc_miss_ratio(const efs_mrc_curve_t *cv, int b);
+const char *efs_mrc_name(efs_mrc_cache_t c);
+
+#define	EFS_MRC_REF(c, key)						\
+	do {								\
+		if (__builtin_expect(efs_mrc_threshold != 0, 0))	\
+			efs_mrc_ref((c), (key));			\
+	} while (0)
+
+#endif /* EFS_MRC_H */
@@ -0,0 +1,269 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "efs_stats.h"
+#include "efs_trace.h"
+
+#include "efs_prefetch.h"
+
+#define	PF_DIRS		8	/* recently listed directories tracked */
+#define	PF_WINDOW	4	/* entries an open may skip and still be in order */
+#define	PF_MIN_SEQ	2	/* opens in order before prefetch starts */
+#define	PF_QUEUE	16	/* pending prefetch requests */
+#define	PF_BATCH	64	/* inodes read at once */
+#define	PF_DATA_MAX	(64 * 1024)	/* read ahead of the first extent */
+
+typedef struct pf_dir {
+	efs_dir_snap_t	*pd_ds;		/* NULL if the slot is free */
+	uint32_t	pd_next;	/* entry expected to be opened next */
+	uint32_t	pd_done;	/* entries below are prefetched */
+	int		pd_seq;		/* opens in directory order */
+	uint64_t	pd_used;	/* LRU clock */
+} pf_dir_t;
+
+typedef struct pf_req {
+	efs_dir_snap_t	*pr_ds;
+	uint32_t	pr_from;
+	uint32_t	pr_to;
+} pf_req_t;
+
+static pthread_mutex_t pf_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pf_cv = PTHREAD_COND_INITIALIZER;
+static pf_dir_t pf_dirs[PF_DIRS];
+static uint64_t pf_clock;
+static pf_req_t pf_queue[PF_QUEUE];
+static int pf_head;
+static int pf_count;
+static int pf_running;
+static int pf_depth;
+static efs_fs_t *pf_fs;
+static pthread_t pf_thread;
+
+static void
+pf_fetch(efs_dir_snap_t *ds, uint32_t from, uint32_t to)
+{
+	LOG_DBG2(pf_fs, "%s: dir inode %u, entries %u-%u\n", __func__,
+	    ds->ds_inode->i_num, from, to - 1);
+
+	while (from < to) {
+		efs_inode_t *inodes[PF_BATCH];
+		uint32_t inos[PF_BATCH];
+		uint32_t n = MIN(PF_BATCH, to - from);
+
+		for (uint32_t k = 0; k < n; k++)
+			inos[k] = ds->ds_entries[from + k].dse_ino;
+		from += n;
+
+		if (efs_iget_batch(pf_fs, inos, n, inodes) != 0)
+			continue;
+		EFS_STAT_ADD(EFS_STAT_PREFETCH, n);
+		EFS_TRACE(2, EFS_TR_PREFETCH, inos[0], n);
+
+		for (uint32_t k = 0; k < n; k++) {
+			efs_inode_t *i = inodes[k];
+			efs_extent_t *e;
+
+			if (!S_ISREG(i->i_mode) || EFS_BAD_FILE(i) ||
+			    i->i_nextents == 0)
+				continue;
+			e = &i->i_extents[0];
+			(void) posix_fadvise(pf_fs->fd,
+			    pf_fs->start + (off_t)e->e_blk * BBS,
+			    MIN((off_t)e->e_len * BBS, PF_DATA_MAX),
+			    POSIX_FADV_WILLNEED);
+			EFS_STAT_INC(EFS_STAT_SYSCALLS);
+		}
+	}
+}
+
+static void *
+pf_worker(void *arg)
+{
+	pthread_mutex_lock(&pf_mtx);
+	while (pf_running) {
+		pf_req_t r;
+
+		if (pf_count == 0) {
+			pthread_cond_wait(&pf_cv, &pf_mtx);
+			continue;
+		}
+		r = pf_queue[pf_head];
+		pf_head = (pf_head + 1) % PF_QUEUE;
+		pf_count--;
+		pthread_mutex_unlock(&pf_mtx);
+
+		pf_fetch(r.pr_ds, r.pr_from, r.pr_to);
+		efs_dir_snap_rele(r.pr_ds);
+
+		pthread_mutex_lock(&pf_mtx);
+	}
+	pthread_mutex_unlock(&pf_mtx);
+
+	return (NULL);
+}
+
+/*
+ * Starts the prefetch thread; with depth 0, prefetch stays disabled. Must
+ * be called after the process daemonized.
+ */
+int
+efs_prefetch_start(efs_fs_t *fs, int depth)
+{
+	int err;
+
+	if (depth <= 0)
+		return (0);
+
+	pf_fs = fs;
+	pf_depth = depth;
+	pf_running = 1;
+	if ((err = pthread_create(&pf_thread, NULL, pf_worker, NULL)) != 0) {
+		LOG_ERR("%s: cannot start prefetch thread, error %d\n",
+		    __func__, err);
+		pf_running = 0;
+		pf_depth = 0;
+		return (err);
+	}
+
+	return (0);
+}
+
+void
+efs_prefetch_stop(void)
+{
+	if (pf_depth == 0)
+		return;
+
+	pthread_mutex_lock(&pf_mtx);
+	pf_running = 0;
+	pthread_cond_signal(&pf_cv);
+	pthread_mutex_unlock(&pf_mtx);
+	(void) pthread_join(pf_thread, NULL);
+
+	for (; pf_count > 0; pf_count--) {
+		efs_dir_snap_rele(pf_queue[pf_head].pr_ds);
+		pf_head = (pf_head + 1) % PF_QUEUE;
+	}
+	for (int d = 0; d < PF_DIRS; d++) {
+		if (pf_dirs[d].pd_ds != NULL)
+			efs_dir_snap_rele(pf_dirs[d].pd_ds);
+		pf_dirs[d].pd_ds = NULL;
+	}
+	pf_depth = 0;
+}
+
+/*
+ * A directory is being listed, the opens that follow are matched against
+ * its entries. The least recently used directory is forgotten.
+ */
+void
+efs_prefetch_dir(efs_dir_snap_t *ds)
+{
+	efs_dir_snap_t *old = NULL;
+	efs_dir_snap_t *ref;
+	pf_dir_t *pd = &pf_dirs[0];
+
+	if (pf_depth == 0 || efs_dir_snap_get(ds->ds_inode, &ref) != 0)
+		return;
+
+	pthread_mutex_lock(&pf_mtx);
+	for (int d = 0; d < PF_DIRS; d++) {
+		if (pf_dirs[d].pd_ds == ds) {
+			pf_dirs[d].pd_used = ++pf_clock;
+			pthread_mutex_unlock(&pf_mtx);
+			efs_dir_snap_rele(ref);
+			return;
+		}
+		if (pf_dirs[d].pd_used < pd->pd_used)
+			pd = &pf_dirs[d];
+	}
+	old = pd->pd_ds;
+	pd->pd_ds = ref;
+	pd->pd_next = 0;
+	pd->pd_done = 0;
+	pd->pd_seq = 0;
+	pd->pd_used = ++pf_clock;
+	pthread_mutex_unlock(&pf_mtx);
+
+	if (old != NULL)
+		efs_dir_snap_rele(old);
+}
+
+static void
+pf_match(pf_dir_t *pd, uint32_t ino)
+{
+	efs_dir_snap_t *ds = pd->pd_ds;
+	uint32_t end = MIN(pd->pd_next + PF_WINDOW, ds->ds_nentries);
+	pf_req_t *r;
+	uint32_t from;
+	uint32_t to;
+	uint32_t k;
+
+	for (k = pd->pd_next; k < end; k++) {
+		if (ds->ds_entries[k].dse_ino == ino)
+			break;
+	}
+	if (k == end)
+		return;
+
+	pd->pd_next = k + 1;
+	pd->pd_used = ++pf_clock;
+	if (++pd->pd_seq < PF_MIN_SEQ)
+		return;
+
+	/* Keep at least half of the depth prefetched ahead. */
+	if (pd->pd_done >= k + 1 + pf_depth / 2 || pf_count == PF_QUEUE)
+		return;
+	from = MAX(k + 1, pd->pd_done);
+	to = MIN(k + 1 + pf_depth, ds->ds_nentries);
+	if (from >= to)
+		return;
+
+	r = &pf_queue[(pf_head + pf_count) % PF_QUEUE];
+	if (efs_dir_snap_get(ds->ds_inode, &r->pr_ds) != 0)
+		return;
+	r->pr_from = from;
+	r->pr_to = to;
+	pf_count++;
+	pd->pd_done = to;
+	pthread_cond_signal(&pf_cv);
+}
+
+/*
+ * A file was opened, check whether it continues a directory order walk.
+ */
+void
+efs_prefetch_open(efs_inode_t *inode)
+{
+	if (pf_depth == 0)
+		return;
+
+	pthread_mutex_lock(&pf_mtx);
+	for (int d = 0; d < PF_DIRS; d++) {
+		if (pf_dirs[d].pd_ds != NULL)
+			pf_match(&pf_dirs[d], inode->i_num);
+	}
+	pthread_mutex_unlock(&pf_mtx);
+}
@@ -0,0 +1,40 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EFS_PREFETCH_H
+#define	EFS_PREFETCH_H
+
+#include "efs_fs.h"
+#include "efs_file.h"
+#include "efs_dir.h"
+
+/*
+ * Directory order prefetch. Tools like tar or rsync open files in the order
+ * readdir returned them. Once a few files of a recently listed directory
+ * were opened in that order, a background thread reads the inodes of the
+ * next entries and asks the kernel to read ahead their first extent.
+ */
+#define	EFS_PREFETCH_DEPTH	32	/* default number of entries ahead */
+
+int efs_prefetch_start(efs_fs_t *fs, int depth);
+void efs_prefetch_stop(void);
+void efs_prefetch_dir(efs_dir_snap_t *ds);
+void efs_prefetch_open(efs_inode_t *inode);
+
+#endif /* EFS_PREFETCH_H */
@@ -0,0 +1,58 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef EFS_PROBES_H
+#define	EFS_PROBES_H
+
+/*
+ * USDT probes of the "efs" provider, built in with make USDT=1 (needs
+ * <sys/sdt.h> from systemtap). A disabled probe is a single nop, but its
+ * arguments are still computed, so keep them cheap.
+ *
+ *	op__entry(op)			FUSE operation starts (efs_op_t)
+ *	op__return(op, ns)		FUSE operation finished
+ *	iget__hit(ino)			inode found in the cache
+ *	iget__miss(ino)			inode not cached
+ *	iget__load(ino, err)		inode read from the image
+ *	ncache__hit(path, ino)		path found in the name cache
+ *	ncache__miss(path)		path not cached
+ *	bread__start(offset, size)	image read submitted
+ *	bread__done(offset, size, err)	image read complete
+ *	iread__map(ino, blk, pblk, n)	n file blocks from blk map to pblk
+ */
+#ifdef EFS_USDT
+
+#include <sys/sdt.h>
+
+#define	EFS_PROBE1(name, a)		DTRACE_PROBE1(efs, name, a)
+#define	EFS_PROBE2(name, a, b)		DTRACE_PROBE2(efs, name, a, b)
+#define	EFS_PROBE3(name, a, b, c)	DTRACE_PROBE3(efs, name, a, b, c)
+#define	EFS_PROBE4(name, a, b, c, d)	DTRACE_PROBE4(efs, name, a, b, c, d)
+
+#else
+
+#define	EFS_PROBE1(name, a)		do { } while (0)
+#define	EFS_PROBE2(name, a, b)		do { } while (0)
+#define	EFS_PROBE3(name, a, b, c)	do { } while (0)
+#define	EFS_PROBE4(name, a, b, c, d)	do { } while (0)
+
+#endif /* EFS_USDT */
+
+#endif /* EFS_PROBES_H */
@@ -0,0 +1,123 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "utils.h"
+
+#include "efs_record.h"
+
+#define	RECORD_BUFSIZE	(1024 * 1024)
+
+int efs_recording;
+
+static FILE *record_fp;
+static uint64_t record_start;	/* efs_stats_now() at open */
+static __thread uint32_t record_tid;
+
+int
+efs_record_open(const char *path)
+{
+	efs_record_hdr_t rh;
+	struct timespec ts;
+	int err;
+
+	if ((record_fp = fopen(path, "w")) == NULL) {
+		err = errno;
+		LOG_ERR("cannot create recording '%s', error: %d\n", path, err);
+		return (err);
+	}
+	(void) setvbuf(record_fp, NULL, _IOFBF, RECORD_BUFSIZE);
+
+	(void) clock_gettime(CLOCK_REALTIME, &ts);
+	record_start = efs_stats_now();
+	memset(&rh, 0, sizeof (rh));
+	rh.rh_magic = EFS_RECORD_MAGIC;
+	rh.rh_version = EFS_RECORD_VERSION;
+	rh.rh_recsize = sizeof (efs_record_t);
+	rh.rh_start = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	if (fwrite(&rh, sizeof (rh), 1, record_fp) != 1 ||
+	    fflush(record_fp) != 0) {
+		LOG_ERR("cannot write recording '%s'\n", path);
+		(void) fclose(record_fp);
+		record_fp = NULL;
+		return (EIO);
+	}
+	efs_recording = 1;
+
+	return (0);
+}
+
+/*
+ * Called once the request threads are done.
+ */
+void
+efs_record_close(void)
+{
+	if (record_fp == NULL)
+		return;
+	efs_recording = 0;
+	if (fclose(record_fp) != 0)
+		LOG_ERR("cannot write recording, error: %d\n", errno);
+	record_fp = NULL;
+}
+
+/*
+ * Appends one operation. A record and its path are written under the
+ * stream lock so that records of different threads do not interleave.
+ * Recording stops at the first write error.
+ */
+void
+efs_record_op(efs_op_t op, uint64_t start, int err, const char *path,
+    uint32_t ino, uint64_t fh, uint64_t off, uint32_t size)
+{
+	efs_record_t r;
+	int fail;
+
+	if (record_tid == 0)
+		record_tid = syscall(SYS_gettid);
+
+	r.r_ts = start - record_start;
+	r.r_off = off;
+	r.r_fh = fh;
+	r.r_ino = ino;
+	r.r_size = size;
+	r.r_tid = record_tid;
+	r.r_op = op;
+	r.r_err = MIN(err, UINT8_MAX);
+	r.r_pathlen = path != NULL ? MIN(strlen(path), UINT16_MAX) : 0;
+
+	flockfile(record_fp);
+	fail = !efs_recording ||
+	    fwrite_unlocked(&r, sizeof (r), 1, record_fp) != 1 ||
+	    (r.r_pathlen > 0 && fwrite_unlocked(path, 1, r.r_pathlen,
+	    record_fp) != r.r_pathlen);
+	if (fail && efs_recording) {
+		efs_recording = 0;
+		LOG_ERR("recording stopped, write error: %d\n", errno);
+	}
+	funlockfile(record_fp);
+}
@@ -0,0 +1,75 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef EFS_RECORD_H
+#define	EFS_RECORD_H
+
+#include <stdint.h>
+
+#include "efs_stats.h"
+
+/*
+ * Access recording. Unlike the trace rings, which keep only the latest
+ * events, a recording holds every FUSE operation since mount. It is
+ * written to a stdio stream as the operations finish and replayed by
+ * tools/efs-replay.
+ *
+ * The file is a header followed by records, each trailed by r_pathlen
+ * bytes of path (high-level API) or name (low-level lookup), without a
+ * NUL. Everything is in host byte order. Records are written in
+ * completion order; r_ts is the start of the operation.
+ */
+#define	EFS_RECORD_MAGIC	0x45465352	/* "EFSR" */
+#define	EFS_RECORD_VERSION	1
+
+typedef struct efs_record_hdr {
+	uint32_t rh_magic;
+	uint16_t rh_version;
+	uint16_t rh_recsize;	/* sizeof (efs_record_t) */
+	uint64_t rh_start;	/* CLOCK_REALTIME at r_ts 0, ns */
+} efs_record_hdr_t;
+
+typedef struct efs_record {
+	uint64_t r_ts;		/* ns since the recording started */
+	uint64_t r_off;		/* offset; for lookup the inode found */
+	uint64_t r_fh;		/* file or directory handle, 0 if none */
+	uint32_t r_ino;		/* inode, 0 if not known */
+	uint32_t r_size;	/* bytes requested; entries for readdir */
+	uint32_t r_tid;
+	uint8_t r_op;		/* efs_op_t */
+	uint8_t r_err;		/* errno */
+	uint16_t r_pathlen;
+} efs_record_t;
+
+extern int efs_recording;
+
+int efs_record_open(const char *path);
+void efs_record_close(void);
+void efs_record_op(efs_op_t op, uint64_t start, int err, const char *path,
+    uint32_t ino, uint64_t fh, uint64_t off, uint32_t size);
+
+#define	EFS_RECORD(op, start, err, path, ino, fh, off, size)		\
+	do {								\
+		if (__builtin_expect(efs_recording, 0))			\
+			efs_record_op((op), (start), (err), (path),	\
+			    (ino), (fh), (off), (size));		\
+	} while (0)
+
+#endif /* EFS_RECORD_H */
@@ -0,0 +1,449 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+#include "efs_stats.h"
+#include "efs_trace.h"
+#include "efs_mrc.h"
+
+static const char *stat_names[EFS_STAT_NSTATS] = {
+	"icache_hits",
+	"icache_misses",
+	"icache_bytes",
+	"ncache_hits",
+	"ncache_misses",
+	"ncache_bytes",
+	"dircache_hits",
+	"dircache_misses",
+	"dircache_bytes",
+	"block_reads",
+	"block_read_bytes",
+	"syscalls",
+	"prefetched_inodes",
+	"warmed_inodes"
+};
+
+static const char *op_names[EFS_OP_NOPS] = {
+	"lookup",
+	"getattr",
+	"open",
+	"read",
+	"release",
+	"lseek",
+	"getxattr",
+	"listxattr",
+	"opendir",
+	"readdir",
+	"releasedir",
+	"statfs"
+};
+
+const char *
+efs_stats_op_name(efs_op_t op)
+{
+	return (op < EFS_OP_NOPS ? op_names[op] : "unknown");
+}
+
+/*
+ * All per-thread blocks. When a thread exits, its counters are folded into
+ * stats_retired and its block is freed, so worker churn does not grow the
+ * list.
+ */
+static pthread_mutex_t stats_mtx = PTHREAD_MUTEX_INITIALIZER;
+static efs_stats_t *stats_list;
+static efs_stats_t stats_retired;
+static __thread efs_stats_t *stats_self;
+static efs_stats_t stats_fallback;	/* used if calloc() fails */
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static int stats_key_ok;
+
+/* Adds the counters of st to sum, the caller holds stats_mtx. */
+static void
+stats_add_block(efs_stats_t *sum, efs_stats_t *st)
+{
+	for (int c = 0; c < EFS_STAT_NSTATS; c++) {
+		sum->st_ctrs[c] += __atomic_load_n(&st->st_ctrs[c],
+		    __ATOMIC_RELAXED);
+	}
+	for (int op = 0; op < EFS_OP_NOPS; op++) {
+		sum->st_ops[op] += __atomic_load_n(&st->st_ops[op],
+		    __ATOMIC_RELAXED);
+		sum->st_op_us[op] += __atomic_load_n(&st->st_op_us[op],
+		    __ATOMIC_RELAXED);
+		for (int b = 0; b < EFS_STATS_HBUCKETS; b++) {
+			sum->st_hist[op][b] += __atomic_load_n(
+			    &st->st_hist[op][b], __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static void
+stats_thread_exit(void *arg)
+{
+	efs_stats_t *st = arg;
+	efs_stats_t **pp;
+
+	pthread_mutex_lock(&stats_mtx);
+	stats_add_block(&stats_retired, st);
+	for (pp = &stats_list; *pp != NULL; pp = &(*pp)->st_next) {
+		if (*pp == st) {
+			*pp = st->st_next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&stats_mtx);
+
+	/* a later destructor may still count, it gets a new block */
+	stats_self = NULL;
+	free(st);
+}
+
+static void
+stats_key_create(void)
+{
+	stats_key_ok = pthread_key_create(&stats_key, stats_thread_exit) == 0;
+}
+
+efs_stats_t *
+efs_stats_self(void)
+{
+	efs_stats_t *st = stats_self;
+
+	if (st != NULL)
+		return (st);
+
+	(void) pthread_once(&stats_once, stats_key_create);
+	if (!stats_key_ok || (st = calloc(1, sizeof (*st))) == NULL)
+		return (&stats_fallback);
+	if (pthread_setspecific(stats_key, st) != 0) {
+		free(st);
+		return (&stats_fallback);
+	}
+	pthread_mutex_lock(&stats_mtx);
+	st->st_next = stats_list;
+	stats_list = st;
+	pthread_mutex_unlock(&stats_mtx);
+
+	return (stats_self = st);
+}
+
+uint64_t
+efs_stats_now(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static void
+stat_add(uint64_t *p, uint64_t v)
+{
+	__atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v,
+	    __ATOMIC_RELAXED);
+}
+
+/*
+ * Accounts a finished request that started at start (efs_stats_now()).
+ */
+void
+efs_stats_op(efs_op_t op, uint64_t start)
+{
+	efs_stats_t *st = efs_stats_self();
+	uint64_t ns = efs_stats_now() - start;
+	uint64_t us = ns / 1000;
+	int b = us == 0 ? 0 : 64 - __builtin_clzll(us);
+
+	EFS_PROBE2(op__return, op, ns);
+	EFS_TRACE(1, EFS_TR_OP, op, ns);
+
+	stat_add(&st->st_ops[op], 1);
+	stat_add(&st->st_op_us[op], us);
+	stat_add(&st->st_hist[op][MIN(b, EFS_STATS_HBUCKETS - 1)], 1);
+}
+
+static void
+stats_merge(efs_stats_t *sum)
+{
+	efs_stats_t *st;
+
+	memset(sum, 0, sizeof (*sum));
+	pthread_mutex_lock(&stats_mtx);
+	stats_add_block(sum, &stats_retired);
+	for (st = stats_list; st != NULL; st = st->st_next)
+		stats_add_block(sum, st);
+	pthread_mutex_unlock(&stats_mtx);
+}
+
+/* Upper bound (in us) of the bucket holding the given percentile. */
+static uint64_t
+stats_percentile(const uint64_t *hist, uint64_t count, int pct)
+{
+	uint64_t want = (count * pct + 99) / 100;
+	uint64_t seen = 0;
+
+	for (int b = 0; b < EFS_STATS_HBUCKETS; b++) {
+		seen += hist[b];
+		if (seen >= want)
+			return (1ULL << b);
+	}
+	return (1ULL << (EFS_STATS_HBUCKETS - 1));
+}
+
+/*
+ * Appends to a growing buffer, like snprintf() into a string builder.
+ */
+typedef struct sbuf {
+	char	*sb_buf;
+	size_t	sb_len;
+	size_t	sb_size;
+	int	sb_err;
+} sbuf_t;
+
+static void __attribute__((format(printf, 2, 3)))
+sbuf_printf(sbuf_t *sb, const char *fmt, ...)
+{
+	va_list ap;
+	char *nb;
+	size_t size;
+	int n;
+
+	if (sb->sb_err != 0)
+		return;
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(sb->sb_buf + sb->sb_len, sb->sb_size - sb->sb_len,
+		    fmt, ap);
+		va_end(ap);
+		if (n < 0) {
+			sb->sb_err = EINVAL;
+			return;
+		}
+		if (sb->sb_len + n < sb->sb_size)
+			break;
+
+		size = MAX(sb->sb_size * 2, sb->sb_len + n + 1);
+		if ((nb = realloc(sb->sb_buf, size)) == NULL) {
+			sb->sb_err = ENOMEM;
+			return;
+		}
+		sb->sb_buf = nb;
+		sb->sb_size = size;
+	}
+	sb->sb_len += n;
+}
+
+/*
+ * Miss ratio curves, one row per cache size (in objects: basic blocks,
+ * inodes, paths) up to the largest reuse distance seen.
+ */
+static void
+stats_mrc_text(sbuf_t *sb)
+{
+	efs_mrc_curve_t cv[EFS_MRC_NCACHES];
+	int maxb = 0;
+
+	for (int c = 0; c < EFS_MRC_NCACHES; c++) {
+		efs_mrc_get(c, &cv[c]);
+		for (int b = 0; b < EFS_MRC_BUCKETS; b++) {
+			if (cv[c].mc_hist[b] != 0)
+				maxb = MAX(maxb, b);
+		}
+	}
+	maxb = MIN(maxb + 1, EFS_MRC_BUCKETS - 1);
+
+	sbuf_printf(sb, "\nmiss ratio (1 in %u keys sampled)\n%-20s",
+	    efs_mrc_rate(), "cache size");
+	for (int c = 0; c < EFS_MRC_NCACHES; c++)
+		sbuf_printf(sb, " %10s", efs_mrc_name(c));
+	sbuf_printf(sb, "\n");
+	for (int b = 0; b <= maxb; b++) {
+		sbuf_printf(sb, "%-20llu", 1ULL << b);
+		for (int c = 0; c < EFS_MRC_NCACHES; c++) {
+			if (cv[c].mc_refs == 0)
+				sbuf_printf(sb, " %10s", "-");
+			else
+				sbuf_printf(sb, " %10.4f",
+				    efs_mrc_miss_ratio(&cv[c], b));
+		}
+		sbuf_printf(sb, "\n");
+	}
+}
+
+static void
+stats_mrc_json(sbuf_t *sb)
+{
+	sbuf_printf(sb, ",\n  \"mrc\": {\n    \"sample_rate\": %u",
+	    efs_mrc_rate());
+	for (int c = 0; c < EFS_MRC_NCACHES; c++) {
+		const char *sep = "";
+		efs_mrc_curve_t cv;
+
+		efs_mrc_get(c, &cv);
+		sbuf_printf(sb, ",\n    \"%s\": { \"refs\": %llu, "
+		    "\"cold\": %llu, \"miss_ratio\": [", efs_mrc_name(c),
+		    (unsigned long long)cv.mc_refs,
+		    (unsigned long long)cv.mc_cold);
+		for (int b = 0; b < EFS_MRC_BUCKETS; b++) {
+			sbuf_printf(sb, "%s%.4f", sep,
+			    efs_mrc_miss_ratio(&cv, b));
+			sep = ", ";
+		}
+		sbuf_printf(sb, "] }");
+	}
+	sbuf_printf(sb, "\n  }");
+}
+
+static void
+stats_text(sbuf_t *sb, efs_stats_t *sum)
+{
+	sbuf_printf(sb, "%-20s %12s %12s %10s %10s %10s\n", "operation",
+	    "count", "total_us", "p50_us", "p90_us", "p99_us");
+	for (int op = 0; op < EFS_OP_NOPS; op++) {
+		uint64_t n = sum->st_ops[op];
+
+		if (n == 0)
+			continue;
+		sbuf_printf(sb, "%-20s %12llu %12llu %10llu %10llu %10llu\n",
+		    op_names[op], (unsigned long long)n,
+		    (unsigned long long)sum->st_op_us[op],
+		    (unsigned long long)stats_percentile(sum->st_hist[op], n,
+		    50),
+		    (unsigned long long)stats_percentile(sum->st_hist[op], n,
+		    90),
+		    (unsigned long long)stats_percentile(sum->st_hist[op], n,
+		    99));
+	}
+	sbuf_printf(sb, "\n");
+	for (int c = 0; c < EFS_STAT_NSTATS; c++) {
+		sbuf_printf(sb, "%-20s %12llu\n", stat_names[c],
+		    (unsigned long long)sum->st_ctrs[c]);
+	}
+	if (efs_mrc_rate() != 0)
+		stats_mrc_text(sb);
+}
+
+static void
+stats_json(sbuf_t *sb, efs_stats_t *sum)
+{
+	const char *sep = "";
+
+	sbuf_printf(sb, "{\n  \"counters\": {");
+	for (int c = 0; c < EFS_STAT_NSTATS; c++) {
+		sbuf_printf(sb, "%s\n    \"%s\": %llu", sep, stat_names[c],
+		    (unsigned long long)sum->st_ctrs[c]);
+		sep = ",";
+	}
+	sbuf_printf(sb, "\n  },\n  \"operations\": {");
+	sep = "";
+	for (int op = 0; op < EFS_OP_NOPS; op++) {
+		const char *hsep = "";
+
+		sbuf_printf(sb, "%s\n    \"%s\": { \"count\": %llu, "
+		    "\"total_us\": %llu, \"hist_us\": [", sep, op_names[op],
+		    (unsigned long long)sum->st_ops[op],
+		    (unsigned long long)sum->st_op_us[op]);
+		for (int b = 0; b < EFS_STATS_HBUCKETS; b++) {
+			sbuf_printf(sb, "%s%llu", hsep,
+			    (unsigned long long)sum->st_hist[op][b]);
+			hsep = ", ";
+		}
+		sbuf_printf(sb, "] }");
+		sep = ",";
+	}
+	sbuf_printf(sb, "\n  }");
+	if (efs_mrc_rate() != 0)
+		stats_mrc_json(sb);
+	sbuf_printf(sb, "\n}\n");
+}
+
+/*
+ * Formats the current statistics as text or JSON into a malloc()ed buffer.
+ * In JSON, hist_us[b] counts the requests that took [2^(b-1), 2^b) us and
+ * mrc miss_ratio[b] is the estimated miss ratio of a cache of 2^b objects.
+ */
+int
+efs_stats_format(int json, char **buf, size_t *len)
+{
+	sbuf_t sb = { NULL, 0, 4096, 0 };
+	efs_stats_t *sum;
+
+	if ((sum = malloc(sizeof (*sum))) == NULL)
+		return (ENOMEM);
+	if ((sb.sb_buf = malloc(sb.sb_size)) == NULL) {
+		free(sum);
+		return (ENOMEM);
+	}
+	stats_merge(sum);
+
+	if (json)
+		stats_json(&sb, sum);
+	else
+		stats_text(&sb, sum);
+	free(sum);
+
+	if (sb.sb_err != 0) {
+		free(sb.sb_buf);
+		return (sb.sb_err);
+	}
+	*buf = sb.sb_buf;
+	*len = sb.sb_len;
+
+	return (0);
+}
+
+/*
+ * Writes the statistics in text to the file path, "-" is stderr.
+ */
+int
+efs_stats_dump(const char *path)
+{
+	FILE *f = stderr;
+	size_t len;
+	char *buf;
+	int err;
+
+	if ((err = efs_stats_format(0, &buf, &len)) != 0)
+		return (err);
+	if (strcmp(path, "-") != 0 && (f = fopen(path, "w")) == NULL) {
+		err = errno;
+		LOG_ERR("cannot write statistics to '%s', error: %d\n", path,
+		    err);
+		free(buf);
+		return (err);
+	}
+
+	(void) fwrite(buf, 1, len, f);
+	if (f != stderr)
+		(void) fclose(f);
+	free(buf);
+
+	return (0);
+}
@@ -0,0 +1,115 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EFS_STATS_H
+#define	EFS_STATS_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "efs_probes.h"
+
+/*
+ * Performance statistics. Every thread counts into a block of its own,
+ * without any locking; the blocks are summed up when the statistics are
+ * read. Counters keep counting for the lifetime of the process.
+ */
+typedef enum efs_stat {
+	EFS_STAT_ICACHE_HIT,
+	EFS_STAT_ICACHE_MISS,
+	EFS_STAT_ICACHE_MEM,	/* bytes */
+	EFS_STAT_NCACHE_HIT,
+	EFS_STAT_NCACHE_MISS,
+	EFS_STAT_NCACHE_MEM,
+	EFS_STAT_DSNAP_HIT,
+	EFS_STAT_DSNAP_MISS,
+	EFS_STAT_DSNAP_MEM,
+	EFS_STAT_BREAD,		/* block read requests */
+	EFS_STAT_BREAD_BYTES,
+	EFS_STAT_SYSCALLS,	/* I/O system calls issued */
+	EFS_STAT_PREFETCH,	/* inodes prefetched */
+	EFS_STAT_WARMED,	/* inodes read from the hot set */
+	EFS_STAT_NSTATS
+} efs_stat_t;
+
+/* FUSE operations whose latency is tracked */
+typedef enum efs_op {
+	EFS_OP_LOOKUP,
+	EFS_OP_GETATTR,
+	EFS_OP_OPEN,
+	EFS_OP_READ,
+	EFS_OP_RELEASE,
+	EFS_OP_LSEEK,
+	EFS_OP_GETXATTR,
+	EFS_OP_LISTXATTR,
+	EFS_OP_OPENDIR,
+	EFS_OP_READDIR,
+	EFS_OP_RELEASEDIR,
+	EFS_OP_STATFS,
+	EFS_OP_NOPS
+} efs_op_t;
+
+/* Latency histogram bucket b counts requests of [2^(b-1), 2^b) us */
+#define	EFS_STATS_HBUCKETS	32
+
+typedef struct efs_stats {
+	uint64_t st_ctrs[EFS_STAT_NSTATS];
+	uint64_t st_ops[EFS_OP_NOPS];
+	uint64_t st_op_us[EFS_OP_NOPS];		/* total latency */
+	uint64_t st_hist[EFS_OP_NOPS][EFS_STATS_HBUCKETS];
+	struct efs_stats *st_next;
+} efs_stats_t;
+
+/* Virtual files with the statistics, in the root directory */
+#define	EFS_STATS_NAME		".efs-stats"
+#define	EFS_STATS_JSON_NAME	".efs-stats.json"
+
+efs_stats_t *efs_stats_self(void);
+uint64_t efs_stats_now(void);
+const char *efs_stats_op_name(efs_op_t op);
+void efs_stats_op(efs_op_t op, uint64_t start);
+
+/*
+ * Marks the start of a FUSE operation, the result is passed on to
+ * efs_stats_op() when it is done.
+ */
+static inline uint64_t
+efs_stats_begin(efs_op_t op)
+{
+	EFS_PROBE1(op__entry, op);
+	return (efs_stats_now());
+}
+
+int efs_stats_format(int json, char **buf, size_t *len);
+int efs_stats_dump(const char *path);
+
+/*
+ * Counters are only ever written by their thread, a relaxed load and store
+ * is enough for the reader to see a consistent value.
+ */
+#define	EFS_STAT_ADD(c, v)						\
+	do {								\
+		uint64_t *_p = &efs_stats_self()->st_ctrs[(c)];		\
+		__atomic_store_n(_p, __atomic_load_n(_p,		\
+		    __ATOMIC_RELAXED) + (uint64_t)(v), __ATOMIC_RELAXED);	\
+	} while (0)
+
+#define	EFS_STAT_INC(c)		EFS_STAT_ADD((c), 1)
+
+#endif /* EFS_STATS_H */
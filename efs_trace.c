@@ -0,0 +1,194 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "utils.h"
+
+#include "efs_stats.h"
+#include "efs_trace.h"
+
+typedef struct trace_ring {
+	uint64_t tr_head;		/* records ever written */
+	uint32_t tr_tid;
+	struct trace_ring *tr_next;
+	struct trace_ring *tr_free_next;
+	efs_trace_rec_t tr_recs[EFS_TRACE_RING];
+} trace_ring_t;
+
+int efs_trace_level;
+
+/*
+ * All rings. The ring of an exited thread stays on the list with its
+ * records until another thread takes it from trace_free, so the number of
+ * rings is bounded by the number of threads alive at once.
+ */
+static pthread_mutex_t trace_mtx = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t *trace_list;
+static trace_ring_t *trace_free;
+static uint32_t trace_nrings;
+static __thread trace_ring_t *trace_self;
+static __thread int trace_nomem;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static int trace_key_ok;
+
+static void
+trace_thread_exit(void *arg)
+{
+	trace_ring_t *r = arg;
+
+	pthread_mutex_lock(&trace_mtx);
+	r->tr_free_next = trace_free;
+	trace_free = r;
+	pthread_mutex_unlock(&trace_mtx);
+	trace_self = NULL;
+}
+
+static void
+trace_key_create(void)
+{
+	trace_key_ok = pthread_key_create(&trace_key, trace_thread_exit) == 0;
+}
+
+static trace_ring_t *
+trace_ring_get(void)
+{
+	trace_ring_t *r;
+
+	(void) pthread_once(&trace_once, trace_key_create);
+	if (!trace_key_ok) {
+		trace_nomem = 1;
+		return (NULL);
+	}
+
+	pthread_mutex_lock(&trace_mtx);
+	if ((r = trace_free) != NULL) {
+		trace_free = r->tr_free_next;
+		/* the records are of the previous thread */
+		__atomic_store_n(&r->tr_head, 0, __ATOMIC_RELEASE);
+		r->tr_tid = syscall(SYS_gettid);
+	}
+	pthread_mutex_unlock(&trace_mtx);
+
+	if (r == NULL) {
+		if ((r = calloc(1, sizeof (*r))) == NULL) {
+			trace_nomem = 1;
+			return (NULL);
+		}
+		r->tr_tid = syscall(SYS_gettid);
+		pthread_mutex_lock(&trace_mtx);
+		r->tr_next = trace_list;
+		trace_list = r;
+		trace_nrings++;
+		pthread_mutex_unlock(&trace_mtx);
+	}
+
+	if (pthread_setspecific(trace_key, r) != 0) {
+		trace_thread_exit(r);
+		trace_nomem = 1;
+		return (NULL);
+	}
+
+	return (trace_self = r);
+}
+
+/*
+ * Appends an event to the ring of the calling thread. Only this thread
+ * writes the ring; the head is published after the record is filled in.
+ */
+void
+efs_trace_emit(efs_trace_ev_t ev, uint32_t a0, uint64_t a1)
+{
+	trace_ring_t *r = trace_self;
+	efs_trace_rec_t *rec;
+	uint64_t head;
+
+	if (r == NULL && (trace_nomem || (r = trace_ring_get()) == NULL))
+		return;
+
+	head = r->tr_head;
+	rec = &r->tr_recs[head & (EFS_TRACE_RING - 1)];
+	rec->tr_ts = efs_stats_now();
+	rec->tr_ev = ev;
+	rec->tr_a0 = a0;
+	rec->tr_a1 = a1;
+	__atomic_store_n(&r->tr_head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Writes all rings to the file path. Meant to be called once the request
+ * threads are done; a record written during the dump may come out torn.
+ */
+int
+efs_trace_dump(const char *path)
+{
+	efs_trace_hdr_t th;
+	trace_ring_t *r;
+	FILE *f;
+	int err = 0;
+
+	if ((f = fopen(path, "w")) == NULL) {
+		err = errno;
+		LOG_ERR("cannot write trace to '%s', error: %d\n", path, err);
+		return (err);
+	}
+
+	pthread_mutex_lock(&trace_mtx);
+	memset(&th, 0, sizeof (th));
+	th.th_magic = EFS_TRACE_MAGIC;
+	th.th_version = EFS_TRACE_VERSION;
+	th.th_recsize = sizeof (efs_trace_rec_t);
+	th.th_nrings = trace_nrings;
+	if (fwrite(&th, sizeof (th), 1, f) != 1)
+		err = EIO;
+
+	for (r = trace_list; r != NULL && err == 0; r = r->tr_next) {
+		uint64_t head = __atomic_load_n(&r->tr_head, __ATOMIC_ACQUIRE);
+		uint32_t n = MIN(head, EFS_TRACE_RING);
+		uint32_t first = (head - n) & (EFS_TRACE_RING - 1);
+		uint32_t n1 = MIN(n, EFS_TRACE_RING - first);
+		efs_trace_ring_hdr_t rh;
+
+		rh.rh_tid = r->tr_tid;
+		rh.rh_nrecs = n;
+		rh.rh_total = head;
+		if (fwrite(&rh, sizeof (rh), 1, f) != 1 ||
+		    fwrite(&r->tr_recs[first], sizeof (efs_trace_rec_t), n1,
+		    f) != n1 ||
+		    fwrite(&r->tr_recs[0], sizeof (efs_trace_rec_t), n - n1,
+		    f) != n - n1)
+			err = EIO;
+	}
+	pthread_mutex_unlock(&trace_mtx);
+
+	if (fclose(f) != 0 && err == 0)
+		err = errno;
+	if (err != 0)
+		LOG_ERR("cannot write trace to '%s', error: %d\n", path, err);
+
+	return (err);
+}
@@ -0,0 +1,97 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef EFS_TRACE_H
+#define	EFS_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Binary event tracing. Every thread appends fixed-size records to a ring
+ * of its own, without locks or stdio; the rings are written to a file at
+ * unmount and decoded by tools/efs-tracedump. Only the last
+ * EFS_TRACE_RING events of each thread are kept.
+ *
+ * An event is recorded if its level is at most efs_trace_level (set at
+ * mount time) and EFS_TRACE_MAX (set at build time). The level is checked
+ * before the arguments are evaluated; with EFS_TRACE_MAX=0 the trace points
+ * are compiled out.
+ *
+ *	1	FUSE operations
+ *	2	inode cache and prefetching
+ *	3	block reads and mapping
+ */
+#ifndef EFS_TRACE_MAX
+#define	EFS_TRACE_MAX	3
+#endif
+
+#define	EFS_TRACE_RING	4096		/* records per thread, power of 2 */
+
+typedef enum efs_trace_ev {
+	EFS_TR_OP = 1,		/* a0 = efs_op_t, a1 = latency in ns */
+	EFS_TR_IGET,		/* a0 = inode, a1 = 1 if cached */
+	EFS_TR_PREFETCH,	/* a0 = first inode, a1 = inodes */
+	EFS_TR_INO2LOC,		/* a0 = inode, a1 = BB << 32 | offset */
+	EFS_TR_BREAD,		/* a0 = bytes, a1 = image offset */
+	EFS_TR_IREAD,		/* a0 = inode, a1 = BB << 32 | BBs */
+	EFS_TR_NEVENTS
+} efs_trace_ev_t;
+
+typedef struct efs_trace_rec {
+	uint64_t tr_ts;		/* CLOCK_MONOTONIC, ns */
+	uint32_t tr_ev;
+	uint32_t tr_a0;
+	uint64_t tr_a1;
+} efs_trace_rec_t;
+
+/*
+ * The trace file: a header, then for each thread a ring header followed by
+ * rh_nrecs records, oldest first. Everything is in host byte order.
+ */
+#define	EFS_TRACE_MAGIC		0x45465354	/* "EFST" */
+#define	EFS_TRACE_VERSION	1
+
+typedef struct efs_trace_hdr {
+	uint32_t th_magic;
+	uint16_t th_version;
+	uint16_t th_recsize;	/* sizeof (efs_trace_rec_t) */
+	uint32_t th_nrings;
+	uint32_t th_pad;
+} efs_trace_hdr_t;
+
+typedef struct efs_trace_ring_hdr {
+	uint32_t rh_tid;
+	uint32_t rh_nrecs;	/* records that follow */
+	uint64_t rh_total;	/* records ever written, some may be lost */
+} efs_trace_ring_hdr_t;
+
+extern int efs_trace_level;
+
+void efs_trace_emit(efs_trace_ev_t ev, uint32_t a0, uint64_t a1);
+int efs_trace_dump(const char *path);
+
+#define	EFS_TRACE(lvl, ev, a0, a1)					\
+	do {								\
+		if ((lvl) <= EFS_TRACE_MAX &&				\
+		    __builtin_expect(efs_trace_level >= (lvl), 0))	\
+			efs_trace_emit((ev), (a0), (a1));		\
+	} while (0)
+
+#endif /* EFS_TRACE_H */
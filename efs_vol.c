@@ -28,6 +28,10 @@
 #include <string.h>
 
 #include "utils.h"
+#include "efs_stats.h"
+#include "efs_trace.h"
+#include "efs_probes.h"
+#include "efs_mrc.h"
 
 #include "efs_vol.h"
 
@@ -50,26 +54,42 @@ efs_get_vol_hdr(int fd, efs_vol_hdr_t *hdr)
 static int
 efs_bread_common(efs_fs_t *fs, off_t offset, void *buffer, size_t bytes)
 {
+	size_t size = bytes;
+	off_t pos;
+	int err = 0;
+
 	/* XXX add check for reads after the end of the image */
 
 	offset += fs->start;
+	pos = offset;
+
+	EFS_TRACE(3, EFS_TR_BREAD, size, offset);
+	EFS_PROBE2(bread__start, offset, size);
 
-	LOG_DBG2(fs, "%s: seek to 0x%lx, %ld\n", __func__, offset, offset);
+	EFS_STAT_INC(EFS_STAT_BREAD);
+	EFS_STAT_ADD(EFS_STAT_BREAD_BYTES, size);
 
 	do {
-		size_t got = pread(fs->fd, buffer, bytes, offset);
+		size_t got = pread(fs->fd, buffer, bytes, pos);
+
+		EFS_STAT_INC(EFS_STAT_SYSCALLS);
 		if (got == -1) {
 			/* syscall interrupted, retry */
 			assert(errno == EINTR);
 			continue;
 		}
-		if (got == 0)
-			return (errno);
+		if (got == 0) {
+			err = errno;
+			break;
+		}
 		bytes -= got;
 		buffer += got;
+		pos += got;
 	} while (bytes > 0);
 
-	return (0);
+	EFS_PROBE3(bread__done, offset, size, err);
+
+	return (err);
 }
 
 int
@@ -78,6 +98,11 @@ efs_bread_bbs(efs_fs_t *fs, uint32_t bbs, void *buffer, uint32_t nblks)
 	off_t offset = bbs * BBS;
 	size_t bytes = nblks * BBS;
 
+	if (efs_mrc_threshold != 0) {
+		for (uint32_t k = 0; k < nblks; k++)
+			efs_mrc_ref(EFS_MRC_BLOCK, bbs + k);
+	}
+
 	return (efs_bread_common(fs, offset, buffer, bytes));
 }
 
@@ -0,0 +1,183 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "efs_vol.h"
+#include "efs_dir.h"
+
+#include "libefs.h"
+
+/* Number of directory entries whose inodes are fetched at once. */
+#define	CTX_READDIR_BATCH	64
+
+struct efs_ctx {
+	efs_fs_t	c_fs;
+};
+
+int
+efs_ctx_open(const char *image, int part_no, int log_lvl, efs_ctx_t **ctxp)
+{
+	efs_ctx_t *ctx;
+	int err;
+
+	if ((ctx = calloc(1, sizeof (efs_ctx_t))) == NULL)
+		return (ENOMEM);
+	ctx->c_fs.log_lvl = log_lvl;
+
+	if ((err = efs_vol_open(&ctx->c_fs, image, part_no)) != 0) {
+		free(ctx);
+		return (err);
+	}
+	if ((err = efs_mount(&ctx->c_fs)) != 0) {
+		efs_vol_close(&ctx->c_fs);
+		free(ctx);
+		return (err);
+	}
+	*ctxp = ctx;
+
+	return (0);
+}
+
+/*
+ * All files of the context must be closed already.
+ */
+void
+efs_ctx_close(efs_ctx_t *ctx)
+{
+	efs_umount(&ctx->c_fs);
+	efs_vol_close(&ctx->c_fs);
+	free(ctx);
+}
+
+void
+efs_ctx_statvfs(efs_ctx_t *ctx, struct statvfs *st)
+{
+	efs_fs_statvfs(&ctx->c_fs, st);
+}
+
+static int
+ctx_namei(efs_ctx_t *ctx, const char *path, efs_inode_t **inode)
+{
+	int err;
+
+	if (path[0] != '/')
+		return (EINVAL);
+	if ((err = efs_dir_namei(&ctx->c_fs, path, inode)) != 0)
+		return (err);
+	if (EFS_BAD_FILE((*inode)))
+		return (EIO);
+
+	return (0);
+}
+
+int
+efs_ctx_stat(efs_ctx_t *ctx, const char *path, struct stat *st)
+{
+	efs_inode_t *inode;
+	int err;
+
+	if ((err = ctx_namei(ctx, path, &inode)) == 0)
+		memcpy(st, &inode->i_stat, sizeof (*st));
+
+	return (err);
+}
+
+int
+efs_ctx_readlink(efs_ctx_t *ctx, const char *path, char *buf, size_t size)
+{
+	efs_inode_t *inode;
+	int err;
+
+	if ((err = ctx_namei(ctx, path, &inode)) != 0)
+		return (err);
+
+	return (efs_readlink(inode, buf, size));
+}
+
+/*
+ * Calls cb for every entry of a directory, "." and ".." included, in the
+ * on-disk order.
+ */
+int
+efs_ctx_readdir(efs_ctx_t *ctx, const char *path, efs_ctx_dir_cb_t cb,
+    void *arg)
+{
+	efs_inode_t *items[CTX_READDIR_BATCH];
+	uint32_t inos[CTX_READDIR_BATCH];
+	efs_dir_snap_t *ds;
+	efs_inode_t *inode;
+	uint32_t idx = 0;
+	int done = 0;
+	int err;
+
+	if ((err = ctx_namei(ctx, path, &inode)) != 0)
+		return (err);
+	if (!IS_DIR(inode))
+		return (ENOTDIR);
+	if ((err = efs_dir_snap_get(inode, &ds)) != 0)
+		return (err);
+
+	while (!done && idx < ds->ds_nentries) {
+		uint32_t n = MIN(CTX_READDIR_BATCH, ds->ds_nentries - idx);
+
+		for (uint32_t k = 0; k < n; k++)
+			inos[k] = ds->ds_entries[idx + k].dse_ino;
+		if ((err = efs_iget_batch(&ctx->c_fs, inos, n, items)) != 0)
+			break;
+		for (uint32_t k = 0; k < n && !done; k++, idx++)
+			done = cb(DS_NAME(ds, idx), &items[k]->i_stat, arg);
+	}
+	efs_dir_snap_rele(ds);
+
+	return (err);
+}
+
+int
+efs_ctx_fopen(efs_ctx_t *ctx, const char *path, efs_ctx_file_t **fp)
+{
+	efs_inode_t *inode;
+	int err;
+
+	if ((err = ctx_namei(ctx, path, &inode)) != 0)
+		return (err);
+	if (IS_DIR(inode))
+		return (EISDIR);
+	if (S_ISLNK(inode->i_mode))
+		return (ELOOP);	/* links are not followed */
+
+	return (efs_file_open(inode, fp));
+}
+
+int
+efs_ctx_pread(efs_ctx_file_t *f, void *buf, size_t size, off_t off,
+    size_t *nread)
+{
+	return (efs_file_pread(f, buf, size, off, nread));
+}
+
+void
+efs_ctx_fclose(efs_ctx_file_t *f)
+{
+	efs_file_close(f);
+}
@@ -0,0 +1,58 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBEFS_H
+#define	LIBEFS_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+/*
+ * libefs - read-only access to EFS images without FUSE.
+ *
+ * A context is one opened and mounted image, everything it caches belongs
+ * to it. All functions may be called concurrently on the same context and
+ * on the same open file. Paths are absolute, errors are errno values.
+ */
+typedef struct efs_ctx efs_ctx_t;
+typedef struct efs_file efs_ctx_file_t;
+
+/* Called for every directory entry, a non-zero return value stops the walk */
+typedef int (*efs_ctx_dir_cb_t)(const char *name, const struct stat *st,
+    void *arg);
+
+int efs_ctx_open(const char *image, int part_no, int log_lvl,
+    efs_ctx_t **ctxp);
+void efs_ctx_close(efs_ctx_t *ctx);
+void efs_ctx_statvfs(efs_ctx_t *ctx, struct statvfs *st);
+
+int efs_ctx_stat(efs_ctx_t *ctx, const char *path, struct stat *st);
+/* The target is NUL terminated and truncated to fit in size bytes */
+int efs_ctx_readlink(efs_ctx_t *ctx, const char *path, char *buf,
+    size_t size);
+int efs_ctx_readdir(efs_ctx_t *ctx, const char *path, efs_ctx_dir_cb_t cb,
+    void *arg);
+
+int efs_ctx_fopen(efs_ctx_t *ctx, const char *path, efs_ctx_file_t **fp);
+int efs_ctx_pread(efs_ctx_file_t *f, void *buf, size_t size, off_t off,
+    size_t *nread);
+void efs_ctx_fclose(efs_ctx_file_t *f);
+
+#endif /* LIBEFS_H */
@@ -26,8 +26,9 @@
 #include <string.h>
 #include <stddef.h>
 #include <errno.h>
+#include <stdint.h>
 
-#define	FUSE_USE_VERSION 26
+#include "efs_fuse.h"
 
 #include <fuse.h>
 
@@ -37,15 +38,38 @@
 #include "efs_vol.h"
 #include "efs_file.h"
 #include "efs_dir.h"
+#include "efs_ll.h"
+#include "efs_prefetch.h"
+#include "efs_stats.h"
+#include "efs_trace.h"
+#include "efs_mrc.h"
+#include "efs_record.h"
+#include "efs_hotset.h"
 
 #include "utils.h"
 
-efs_fs_t fs = { 0 };
+/* The mounted file system is the private data of the FUSE session. */
+#define	HL_FS()	((efs_fs_t *)fuse_get_context()->private_data)
+
+/* Number of directory entries whose inodes are fetched at once. */
+#define	READDIR_BATCH	64
+
+/* Inode number for a recording, 0 if the lookup failed */
+#define	REC_INO(err, inode)	((err) == 0 && (inode) != NULL ? \
+	(inode)->i_num : 0)
 
 static struct options {
 	char *fs_image;
+	char *record_file;
 	int log_lvl;
+	int trace_lvl;
+	int mrc_rate;
 	int part;
+	int lowlevel;
+	int clone_fd;
+	int max_idle_threads;
+	int max_read;
+	efs_mount_opts_t mo;
 	int show_help;
 } options;
 
@@ -55,6 +79,27 @@ static struct fuse_opt efs_opts[] = {
 	OPTION("--fs=%s", fs_image),
 	OPTION("--debug=%d", log_lvl),
 	OPTION("--partition=%d", part),
+	OPTION("--lowlevel", lowlevel),
+	OPTION("--clone-fd", clone_fd),
+	OPTION("--max-idle-threads=%d", max_idle_threads),
+	OPTION("--max-read=%d", max_read),
+	OPTION("--max-readahead=%d", mo.mo_max_readahead),
+	OPTION("--max-background=%d", mo.mo_max_background),
+	OPTION("--congestion-threshold=%d", mo.mo_congestion_threshold),
+	OPTION("--prefetch=%d", mo.mo_prefetch),
+	OPTION("--stats-dump=%s", mo.mo_stats_dump),
+	OPTION("--trace=%s", mo.mo_trace_file),
+	OPTION("--trace-level=%d", trace_lvl),
+	OPTION("--mrc=%d", mrc_rate),
+	OPTION("--record=%s", record_file),
+	OPTION("--hotset=%s", mo.mo_hotset_file),
+	OPTION("--keep-cache", mo.mo_keep_cache),
+	{ "--no-keep-cache", offsetof(struct options, mo.mo_keep_cache), 0 },
+	OPTION("--use-ino", mo.mo_use_ino),
+	{ "--no-use-ino", offsetof(struct options, mo.mo_use_ino), 0 },
+	OPTION("--entry-timeout=%lf", mo.mo_entry_timeout),
+	OPTION("--attr-timeout=%lf", mo.mo_attr_timeout),
+	OPTION("--negative-timeout=%lf", mo.mo_negative_timeout),
 	OPTION("-h", show_help),
 	OPTION("--help", show_help),
 	FUSE_OPT_END
@@ -63,18 +108,12 @@ static struct fuse_opt efs_opts[] = {
 static int
 efs_statfs(const char *path, struct statvfs *st)
 {
-	st->f_bsize = BBS;
-	st->f_frsize = BBS;
-	st->f_blocks = GET_I32(fs.sb.s_size);
-	st->f_bfree = GET_I32(fs.sb.s_blk_free);
-	st->f_bavail = st->f_bfree;
-	st->f_files = GET_I32(fs.sb.s_ino_free) * 2;
-	st->f_ffree = GET_I32(fs.sb.s_ino_free);
-	st->f_favail = st->f_ffree;
-	st->f_fsid = 0;
-#if defined(__SOLARIS__)
-	(void) strncpy(st->f_basetype, EFS_NAME, FSTYPSZ);
-#endif
+	uint64_t start = efs_stats_begin(EFS_OP_STATFS);
+
+	efs_fs_statvfs(HL_FS(), st);
+
+	EFS_RECORD(EFS_OP_STATFS, start, 0, path, 0, 0, 0, 0);
+	efs_stats_op(EFS_OP_STATFS, start);
 	return (0);
 }
 
@@ -84,14 +123,14 @@ efs_statfs(const char *path, struct statvfs *st)
  */
 static int
 efs_readdir_alt(const char *path, void *buf, fuse_fill_dir_t filler,
-    off_t offset, struct fuse_file_info *fi)
+    off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
 {
 	efs_inode_t *inode;
 	mode_t mode;
 	uint32_t blkno = 0;
 	int err;
 
-	if ((err = efs_dir_namei(&fs, path, &inode)) != 0) {
+	if ((err = efs_dir_namei(HL_FS(), path, &inode)) != 0) {
 		LOG_ERR("err=%d\n", err);
 		return (err);
 	}
@@ -122,15 +161,21 @@ efs_readdir_alt(const char *path, void *buf, fuse_fill_dir_t filler,
 		LOG_DBG1(inode->i_fs, "%s: has %d slots\n", __func__,
 		    db.db_slots);
 		for (int i = 0; i < db.db_slots; i++) {
-			char *name;
+			char name[EFS_NAME_MAX + 1];
+			const char *nm;
+			int nlen;
 			uint32_t ino;
-			err = efs_dir_get_dirent(&db, i, &ino, &name);
+			err = efs_dir_get_dirent(&db, i, &ino, &nm, &nlen);
+			if (err == ENOENT)
+				continue;
 			if (err != 0)
 				break;
+			memcpy(name, nm, nlen);
+			name[nlen] = '\0';
 			err = efs_iget(inode->i_fs, ino, &item_inode);
 			LOG_DBG1(inode->i_fs, "%s: slot %d, inode %d: '%s'\n",
 			    __func__, i, ino, name);
-			filler(buf, name, &item_inode->i_stat, 0);
+			filler(buf, name, &item_inode->i_stat, 0, 0);
 		}
 	}
 
@@ -141,168 +186,342 @@ efs_readdir_alt(const char *path, void *buf, fuse_fill_dir_t filler,
 #endif
 
 static int
-efs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-    off_t offset, struct fuse_file_info *fi)
+efs_opendir(const char *path, struct fuse_file_info *fi)
 {
-	efs_inode_t *inode;
-	mode_t mode;
-	uint32_t blkno = offset / EFS_DIR_ENTRY_MOD;
-	uint8_t slotno = offset % EFS_DIR_ENTRY_MOD;
+	uint64_t start = efs_stats_begin(EFS_OP_OPENDIR);
+	efs_dir_snap_t *ds;
+	efs_inode_t *inode = NULL;
 	int err;
-	int done = 0;
 
-	LOG_DBG2(&fs, "%s: path '%s', offset %lu, blkno %u, "
-	    "slotno=%u\n", __func__, path, offset, blkno, slotno);
-
-	if ((err = efs_dir_namei(&fs, path, &inode)) != 0) {
+	if ((err = efs_dir_namei(HL_FS(), path, &inode)) != 0) {
 		LOG_ERR("cannot find '%s'.\n", path);
-		return (err);
+	} else if ((err = efs_dir_snap_get(inode, &ds)) != 0) {
+		LOG_ERR("%s: cannot read directory '%s', error: %d\n",
+		    __func__, path, err);
+	} else {
+		fi->fh = (uintptr_t)ds;
+		fi->cache_readdir = options.mo.mo_keep_cache;
+		efs_prefetch_dir(ds);
+
+		LOG_DBG2(HL_FS(), "%s: path '%s', %u entries\n", __func__, path,
+		    ds->ds_nentries);
 	}
 
-	mode = inode->i_mode;
-	if ((mode & S_IFMT) != S_IFDIR) {
-		LOG_ERR("%s is not a directory\n", path);
-		return (ENOENT);
-	}
+	EFS_RECORD(EFS_OP_OPENDIR, start, err, path, REC_INO(err, inode),
+	    err == 0 ? fi->fh : 0, 0, 0);
+	efs_stats_op(EFS_OP_OPENDIR, start);
+	return (-err);
+}
 
-	while (!done) {
-		efs_inode_t *item_inode;
-		efs_dirblk_t db;
+/*
+ * The offset is an index into the decoded directory attached to the
+ * handle by efs_opendir().
+ */
+static int
+efs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+    off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_READDIR);
+	efs_dir_snap_t *ds = (efs_dir_snap_t *)(uintptr_t)fi->fh;
+	enum fuse_fill_dir_flags fill_flags = 0;
+	uint32_t idx = offset;
+	int err = 0;
+	int done = 0;
 
-		err = efs_iread(inode, blkno, 1, &db);
-		if (err != 0) {
-			done = 1;
-			if (err == ENXIO) {
-				/* Reached the end of the directory. */
-				err = 0;
-			} else {
-				LOG_ERR("%s: iread failed for blk %d of '%s', "
-				    "error: %d\n", __func__, blkno, path, err);
-			}
-			break;
-		}
-		if (GET_U16(db.db_magic) != 0xbeef) {
-			LOG_ERR("%s: block %u of %s has wrong magic number 0%x",
-			    __func__, blkno - 1, path, GET_U16(db.db_magic));
-			err = ENXIO;
-			done = 1;
+	/* Attributes are always at hand, pass them with readdirplus. */
+	if (flags & FUSE_READDIR_PLUS)
+		fill_flags = FUSE_FILL_DIR_PLUS;
+
+	LOG_DBG2(HL_FS(), "%s: path '%s', offset %lu\n", __func__, path,
+	    offset);
+
+	while (!done && idx < ds->ds_nentries) {
+		efs_inode_t *items[READDIR_BATCH];
+		uint32_t inos[READDIR_BATCH];
+		uint32_t n = MIN(READDIR_BATCH, ds->ds_nentries - idx);
+
+		for (uint32_t k = 0; k < n; k++)
+			inos[k] = ds->ds_entries[idx + k].dse_ino;
+		if ((err = efs_iget_batch(HL_FS(), inos, n, items)) != 0) {
+			LOG_ERR("%s: cannot get inodes of '%s', error: %d\n",
+			    __func__, path, err);
 			break;
 		}
-		LOG_DBG2(&fs, "%s: has %d slots\n", __func__, db.db_slots);
-		while ((slotno < db.db_slots) && (done == 0)) {
-			char *name;
-			uint32_t ino;
-			off_t new_off;
 
-			err = efs_dir_get_dirent(&db, slotno++, &ino, &name);
-			if (err != 0)
-				break;
-			err = efs_iget(inode->i_fs, ino, &item_inode);
-			new_off = blkno * EFS_DIR_ENTRY_MOD + slotno;
-			done = filler(buf, name, &item_inode->i_stat, new_off);
-
-			LOG_DBG2(&fs, "%s: slot %u, ino %u: '%s', "
-			    "new_ofs: %lu, returned %d\n", __func__, slotno,
-			    ino, name, new_off, done);
-			if (done)
+		/* idx counts only the entries the buffer took */
+		for (uint32_t k = 0; k < n; k++, idx++) {
+			if (filler(buf, DS_NAME(ds, idx), &items[k]->i_stat,
+			    idx + 1, fill_flags) != 0) {
+				done = 1;
 				break;
+			}
 		}
-		blkno++;
 	}
 
-	LOG_DBG2(&fs, "%s: dir '%s', done - blkno=%u\n", __func__, path,
-	    blkno - 1);
+	LOG_DBG2(HL_FS(), "%s: dir '%s', done - idx=%u\n", __func__, path,
+	    idx);
 
-	return (err);
+	EFS_RECORD(EFS_OP_READDIR, start, err, path, ds->ds_inode->i_num,
+	    fi->fh, offset, idx - offset);
+	efs_stats_op(EFS_OP_READDIR, start);
+	return (-err);
 }
 
 static int
-efs_getattr(const char *path, struct stat *stbuf)
+efs_releasedir(const char *path, struct fuse_file_info *fi)
 {
-	efs_inode_t *inode;
+	uint64_t start = efs_stats_begin(EFS_OP_RELEASEDIR);
+
+	efs_dir_snap_rele((efs_dir_snap_t *)(uintptr_t)fi->fh);
+
+	EFS_RECORD(EFS_OP_RELEASEDIR, start, 0, path, 0, fi->fh, 0, 0);
+	efs_stats_op(EFS_OP_RELEASEDIR, start);
+	return (0);
+}
+
+/* Checks whether path is one of the statistics files. */
+static int
+stats_path(const char *path, int *json)
+{
+	return (path[0] == '/' && efs_fuse_stats_name(path + 1, json));
+}
+
+static int
+efs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_GETATTR);
+	efs_inode_t *inode = NULL;
+	int json;
 	int err;
 
-	LOG_DBG2(&fs, "%s: path='%s'\n", __func__, path);
+	LOG_DBG2(HL_FS(), "%s: path='%s'\n", __func__, path);
 
 	memset(stbuf, 0, sizeof (struct stat));
 
-	if ((err = efs_dir_namei(&fs, path, &inode)) != 0) {
+	if (stats_path(path, &json)) {
+		efs_fuse_stats_stat(json, stbuf);
+		err = 0;
+	} else if ((err = efs_dir_namei(HL_FS(), path, &inode)) != 0) {
 		LOG_ERR("%s: failed for '%s', error: %d\n", __func__,
 		    path, err);
-	    return (-err);
-	}
-
-	if (EFS_BAD_FILE(inode) != 0) {
+	} else if (EFS_BAD_FILE(inode) != 0) {
 		LOG_ERR("%s: bad file '%s'.\n", __func__, path);
-		return (-EIO);
+		err = EIO;
+	} else {
+		memcpy(stbuf, &inode->i_stat, sizeof (*stbuf));
 	}
 
-	memcpy(stbuf, &inode->i_stat, sizeof (*stbuf));
-
-	return (0);
+	EFS_RECORD(EFS_OP_GETATTR, start, err, path, REC_INO(err, inode), 0,
+	    0, 0);
+	efs_stats_op(EFS_OP_GETATTR, start);
+	return (-err);
 }
 
 static int
 efs_open(const char *path, struct fuse_file_info *fi)
 {
-	efs_inode_t *inode;
+	uint64_t start = efs_stats_begin(EFS_OP_OPEN);
+	efs_inode_t *inode = NULL;
+	efs_file_t *f;
+	int json;
 	int err;
 
-	err = efs_dir_namei(&fs, path, &inode);
-	if (err == 0 && EFS_BAD_FILE(inode))
-		err = EIO;
-
-	LOG_DBG2(&fs, "%s: path='%s', err=%d\n", __func__, path, err);
+	if (stats_path(path, &json)) {
+		err = efs_fuse_stats_open(json, &f);
+	} else {
+		err = efs_dir_namei(HL_FS(), path, &inode);
+		if (err == 0 && EFS_BAD_FILE(inode))
+			err = EIO;
+		if (err == 0)
+			err = efs_file_open(inode, &f);
+	}
 
-	if (err != 0)
-		LOG_ERR("cannot open file '%s', error: %n", path, err);
+	LOG_DBG2(HL_FS(), "%s: path='%s', err=%d\n", __func__, path, err);
+
+	if (err != 0) {
+		LOG_ERR("cannot open file '%s', error: %d\n", path, err);
+	} else {
+		fi->fh = (uintptr_t)f;
+		if (inode != NULL) {
+			fi->keep_cache = options.mo.mo_keep_cache;
+			efs_prefetch_open(inode);
+		} else {
+			fi->direct_io = 1;
+		}
+	}
 
+	EFS_RECORD(EFS_OP_OPEN, start, err, path, REC_INO(err, inode),
+	    err == 0 ? fi->fh : 0, 0, 0);
+	efs_stats_op(EFS_OP_OPEN, start);
 	return (-err);
 }
 
+static int
+efs_release(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_RELEASE);
+
+	efs_file_close((efs_file_t *)(uintptr_t)fi->fh);
+
+	EFS_RECORD(EFS_OP_RELEASE, start, 0, path, 0, fi->fh, 0, 0);
+	efs_stats_op(EFS_OP_RELEASE, start);
+	return (0);
+}
+
+/*
+ * The file is read through the handle set up by efs_open(), the path is
+ * not resolved again.
+ */
 static int
 efs_read(const char *path, char *buf, size_t size, off_t offset,
     struct fuse_file_info *fi)
 {
-	efs_inode_t *inode;
-	uint32_t blkno = offset / BBS;
-	uint32_t nblks = size / BBS;
+	uint64_t start = efs_stats_begin(EFS_OP_READ);
+	efs_file_t *f = (efs_file_t *)(uintptr_t)fi->fh;
+	size_t nread;
 	int err;
 
-	LOG_DBG2(&fs, "%s: path='%s', size=%ld, offset=%ld\n",
+	LOG_DBG2(HL_FS(), "%s: path='%s', size=%ld, offset=%ld\n",
 	    __func__, path, size, offset);
 
-	if ((err = efs_dir_namei(&fs, path, &inode)) != 0) {
-		LOG_ERR("find file '%s', error: %d\n", path, err);
-		return (-err);
+	if ((err = efs_file_pread(f, buf, size, offset, &nread)) != 0) {
+		LOG_ERR("cannot read file '%s' at offset %lu, %lu bytes\n",
+		    path, offset, size);
 	}
 
-	nblks = MIN(nblks, inode->i_nblks - blkno);
+	EFS_RECORD(EFS_OP_READ, start, err, path, REC_INO(0, f->f_inode),
+	    fi->fh, offset, size);
+	efs_stats_op(EFS_OP_READ, start);
+	return (err != 0 ? -err : nread);
+}
 
-	LOG_DBG3(&fs, "%s: fixed nblks=%d\n", __func__, nblks);
+/*
+ * Used instead of efs_read(), the data are spliced from the image.
+ */
+static int
+efs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+    off_t offset, struct fuse_file_info *fi)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_READ);
+	efs_file_t *f = (efs_file_t *)(uintptr_t)fi->fh;
+	int err;
 
-	if ((err = efs_iread(inode, blkno, nblks, buf)) != 0) {
-		LOG_ERR("cannot read file '%s' at offset %lu, %lu bytes\n",
-		    path, offset, size);
-		return (-err);
-	}
+	LOG_DBG2(HL_FS(), "%s: path='%s', size=%ld, offset=%ld\n",
+	    __func__, path, size, offset);
+
+	err = efs_fuse_read_bufvec(f, size, offset, bufp);
+
+	EFS_RECORD(EFS_OP_READ, start, err, path, REC_INO(0, f->f_inode),
+	    fi->fh, offset, size);
+	efs_stats_op(EFS_OP_READ, start);
+	return (-err);
+}
+
+static off_t
+efs_lseek(const char *path, off_t off, int whence, struct fuse_file_info *fi)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_LSEEK);
+	efs_file_t *f = (efs_file_t *)(uintptr_t)fi->fh;
+	off_t res;
+	int err;
+
+	if (f->f_inode == NULL)
+		err = EINVAL;
+	else
+		err = efs_seek_data(f->f_inode, off, whence, &res);
 
-	return (nblks * BBS);
+	EFS_RECORD(EFS_OP_LSEEK, start, err, path, REC_INO(0, f->f_inode),
+	    fi->fh, off, whence);
+	efs_stats_op(EFS_OP_LSEEK, start);
+	return (err != 0 ? -err : res);
+}
+
+static int
+efs_getxattr(const char *path, const char *name, char *value, size_t size)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_GETXATTR);
+	efs_inode_t *inode = NULL;
+	size_t len;
+	int json;
+	int err;
+
+	if (stats_path(path, &json))
+		err = ENODATA;
+	else if ((err = efs_dir_namei(HL_FS(), path, &inode)) == 0)
+		err = efs_fuse_getxattr(inode, name, value, size, &len);
+
+	EFS_RECORD(EFS_OP_GETXATTR, start, err, path, REC_INO(err, inode), 0,
+	    0, size);
+	efs_stats_op(EFS_OP_GETXATTR, start);
+	return (err != 0 ? -err : len);
+}
+
+static int
+efs_listxattr(const char *path, char *list, size_t size)
+{
+	uint64_t start = efs_stats_begin(EFS_OP_LISTXATTR);
+	efs_inode_t *inode = NULL;
+	size_t len = 0;
+	int json;
+	int err = 0;
+
+	if (!stats_path(path, &json) &&
+	    (err = efs_dir_namei(HL_FS(), path, &inode)) == 0)
+		err = efs_fuse_listxattr(inode, list, size, &len);
+
+	EFS_RECORD(EFS_OP_LISTXATTR, start, err, path, REC_INO(err, inode), 0,
+	    0, size);
+	efs_stats_op(EFS_OP_LISTXATTR, start);
+	return (err != 0 ? -err : len);
+}
+
+static void *
+efs_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
+{
+	efs_fuse_conn_init(&options.mo, conn);
+
+	cfg->use_ino = options.mo.mo_use_ino;
+	cfg->kernel_cache = options.mo.mo_keep_cache;
+	cfg->entry_timeout = options.mo.mo_entry_timeout;
+	cfg->attr_timeout = options.mo.mo_attr_timeout;
+	cfg->negative_timeout = options.mo.mo_negative_timeout;
+
+	(void) efs_prefetch_start(HL_FS(), options.mo.mo_prefetch);
+	if (options.mo.mo_hotset_file != NULL)
+		(void) efs_hotset_start(HL_FS(), options.mo.mo_hotset_file);
+
+	/* The return value replaces the private data. */
+	return (HL_FS());
 }
 
 static void
 efs_destroy(void *data)
 {
-	ncache_destroy();
-	icache_destroy();
+	efs_prefetch_stop();
+	efs_hotset_stop();
+	if (options.mo.mo_hotset_file != NULL)
+		(void) efs_hotset_save(data, options.mo.mo_hotset_file);
+	if (options.mo.mo_stats_dump != NULL)
+		(void) efs_stats_dump(options.mo.mo_stats_dump);
+	if (options.mo.mo_trace_file != NULL)
+		(void) efs_trace_dump(options.mo.mo_trace_file);
+	efs_record_close();
 }
 
 struct fuse_operations efs_oper = {
 	.statfs = efs_statfs,
+	.opendir = efs_opendir,
 	.readdir = efs_readdir,
+	.releasedir = efs_releasedir,
 	.getattr = efs_getattr,
 	.open = efs_open,
 	.read = efs_read,
+	.read_buf = efs_read_buf,
+	.release = efs_release,
+	.lseek = efs_lseek,
+	.getxattr = efs_getxattr,
+	.listxattr = efs_listxattr,
+	.init = efs_init,
 	.destroy = efs_destroy
 };
 
@@ -314,6 +533,43 @@ usage(const char *prog_name)
 	fprintf(stderr, "\t--partition=<N>\tNumber of partition to mount\n");
 	fprintf(stderr, "\t--debug=<N>\tDebug message verbosity level (0-3)\n");
 	fprintf(stderr, "\t--fs=<path>\tPath to file system image\n");
+	fprintf(stderr, "\t--lowlevel\tUse the inode based low-level "
+	    "FUSE API\n");
+	fprintf(stderr, "\t--clone-fd\tUse a separate /dev/fuse fd for each "
+	    "worker thread\n");
+	fprintf(stderr, "\t--max-idle-threads=<N>\tIdle worker threads to "
+	    "keep\n");
+	fprintf(stderr, "\t--max-read=<N>\tMaximum size of a read request\n");
+	fprintf(stderr, "\t--max-readahead=<N>\tMaximum kernel readahead\n");
+	fprintf(stderr, "\t--max-background=<N>\tMaximum pending background "
+	    "requests\n");
+	fprintf(stderr, "\t--congestion-threshold=<N>\tBackground requests "
+	    "that mark the mount congested\n");
+	fprintf(stderr, "\t--prefetch=<N>\tDirectory entries to prefetch "
+	    "ahead of an in-order walk, 0 disables (default %d)\n",
+	    EFS_PREFETCH_DEPTH);
+	fprintf(stderr, "\t--stats-dump=<path>\tWrite statistics to an "
+	    "absolute path (or - for stderr) at unmount\n");
+	fprintf(stderr, "\t--trace=<path>\tRecord events and write them to "
+	    "an absolute path at unmount, see efs-tracedump\n");
+	fprintf(stderr, "\t--trace-level=<N>\tEvents to record: 1 operations "
+	    "(default), 2 inode cache, 3 block I/O\n");
+	fprintf(stderr, "\t--mrc=<N>\tEstimate cache miss ratio curves from "
+	    "1 in N keys, reported with the statistics\n");
+	fprintf(stderr, "\t--record=<path>\tRecord all operations to an "
+	    "absolute path, see efs-replay\n");
+	fprintf(stderr, "\t--hotset=<path>\tWarm the caches from a manifest "
+	    "at an absolute path, save it at unmount\n");
+	fprintf(stderr, "\t--no-keep-cache\tDrop cached file data on "
+	    "every open\n");
+	fprintf(stderr, "\t--no-use-ino\tLet FUSE assign inode numbers "
+	    "(high-level API)\n");
+	fprintf(stderr, "\t--entry-timeout=<S>\tName lookup cache timeout "
+	    "(default %.0f)\n", EFS_CACHE_TIMEOUT);
+	fprintf(stderr, "\t--attr-timeout=<S>\tAttribute cache timeout "
+	    "(default %.0f)\n", EFS_CACHE_TIMEOUT);
+	fprintf(stderr, "\t--negative-timeout=<S>\tFailed lookup cache "
+	    "timeout (default %.0f)\n", EFS_CACHE_TIMEOUT);
 	fprintf(stderr, "\t--help | -h\tThis message\n");
 }
 
@@ -321,10 +577,12 @@ int
 main(int argc, char **argv)
 {
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	efs_fs_t fs = { 0 };
 	int rc = EXIT_SUCCESS;
 
 	/* Process options and report eventual errors. */
 	options.part = -1;
+	efs_mount_opts_init(&options.mo);
 	if (fuse_opt_parse(&args, &options, efs_opts, NULL) == -1)
 		return (EXIT_FAILURE);
 
@@ -337,6 +595,14 @@ main(int argc, char **argv)
 		LOG_ERR("debug must be between 0 and 3.\n");
 		rc = EXIT_FAILURE;
 	}
+	if (options.trace_lvl < 0 || options.trace_lvl > 3) {
+		LOG_ERR("trace-level must be between 0 and 3.\n");
+		rc = EXIT_FAILURE;
+	}
+	if (options.mrc_rate < 0) {
+		LOG_ERR("mrc must not be negative.\n");
+		rc = EXIT_FAILURE;
+	}
 	if (options.fs_image == NULL) {
 		LOG_ERR("file system image is not specified.\n");
 		rc = EXIT_FAILURE;
@@ -356,6 +622,36 @@ main(int argc, char **argv)
 	}
 
 	fs.log_lvl = options.log_lvl;
+	if (options.mo.mo_trace_file != NULL)
+		efs_trace_level = MAX(options.trace_lvl, 1);
+	if (options.mrc_rate > 0 && efs_mrc_init(options.mrc_rate) != 0) {
+		LOG_ERR("cannot set up miss ratio curves.\n");
+		rc = EXIT_FAILURE;
+		goto out;
+	}
+	if (options.record_file != NULL &&
+	    efs_record_open(options.record_file) != 0) {
+		rc = EXIT_FAILURE;
+		goto out;
+	}
+
+	/* Options libfuse handles itself are passed on as -o options. */
+	if (options.clone_fd)
+		(void) fuse_opt_add_arg(&args, "-oclone_fd");
+	if (options.max_idle_threads > 0) {
+		char opt[64];
+
+		(void) snprintf(opt, sizeof (opt), "-omax_idle_threads=%d",
+		    options.max_idle_threads);
+		(void) fuse_opt_add_arg(&args, opt);
+	}
+	if (options.max_read > 0) {
+		char opt[64];
+
+		(void) snprintf(opt, sizeof (opt), "-omax_read=%d",
+		    options.max_read);
+		(void) fuse_opt_add_arg(&args, opt);
+	}
 
 	/*
 	 * Open the file system image. We assume a EFS volume here, not sure if
@@ -374,12 +670,16 @@ main(int argc, char **argv)
 
 	LOG_DBG1(&fs, "entering fuse with argc %d.\n", args.argc);
 
-	if (fuse_main(args.argc, args.argv, &efs_oper, NULL) == -1) {
+	if (options.lowlevel) {
+		if (efs_ll_main(&fs, &options.mo, &args) != 0)
+			rc = EXIT_FAILURE;
+	} else if (fuse_main(args.argc, args.argv, &efs_oper, &fs) != 0) {
 		perror("fuse");
 		rc = EXIT_FAILURE;
 	}
 
 	LOG_DBG1(&fs, "fuse_main ended\n");
+	efs_umount(&fs);
 out:
 	fuse_opt_free_args(&args);
 
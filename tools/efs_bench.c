@@ -0,0 +1,432 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Microbenchmarks of the core library, without FUSE. The tree of an image
+ * is scanned once to find all directories and files, then each benchmark
+ * times single operations over all of them in random order:
+ *
+ *	readdir_cold/warm	one directory: iget, snapshot and entry walk
+ *	iget_cold/warm		one file inode
+ *	namei_cold/warm		one absolute path
+ *	iread			one chunk of a file, files read in full
+ *
+ * Cold runs start with empty inode, name and directory caches (the image
+ * itself stays in the page cache). Results are written as JSON.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "../utils.h"
+#include "../efs_fs.h"
+#include "../efs_vol.h"
+#include "../efs_file.h"
+#include "../efs_dir.h"
+#include "../efs_stats.h"
+
+typedef struct bench_obj {
+	uint32_t o_ino;
+	char *o_path;
+} bench_obj_t;
+
+typedef struct bench {
+	efs_fs_t b_fs;
+	bench_obj_t *b_dirs;
+	uint32_t b_ndirs;
+	bench_obj_t *b_files;
+	uint32_t b_nfiles;
+	uint32_t b_iters;
+	uint32_t b_chunk;	/* iread size in BBs */
+	uint64_t *b_lat;	/* latencies of the current benchmark */
+	size_t b_nlat;
+	size_t b_maxlat;
+	const char *b_sep;
+} bench_t;
+
+static int
+bench_add(bench_obj_t **objs, uint32_t *n, uint32_t ino, const char *path)
+{
+	bench_obj_t *no;
+
+	if ((*n & (*n - 1)) == 0) {
+		if ((no = realloc(*objs, MAX(*n * 2, 1) *
+		    sizeof (bench_obj_t))) == NULL)
+			return (ENOMEM);
+		*objs = no;
+	}
+	if (((*objs)[*n].o_path = strdup(path)) == NULL)
+		return (ENOMEM);
+	(*objs)[(*n)++].o_ino = ino;
+
+	return (0);
+}
+
+/*
+ * Finds all directories and regular files, breadth first.
+ */
+static int
+bench_scan(bench_t *b)
+{
+	int err;
+
+	if ((err = bench_add(&b->b_dirs, &b->b_ndirs, FIRST_INO, "")) != 0)
+		return (err);
+	for (uint32_t d = 0; d < b->b_ndirs; d++) {
+		efs_dir_snap_t *ds;
+		efs_inode_t *dir;
+
+		if ((err = efs_iget(&b->b_fs, b->b_dirs[d].o_ino, &dir)) != 0 ||
+		    (err = efs_dir_snap_get(dir, &ds)) != 0)
+			return (err);
+		for (uint32_t k = 0; k < ds->ds_nentries && err == 0; k++) {
+			const char *nm = DS_NAME(ds, k);
+			uint32_t ino = ds->ds_entries[k].dse_ino;
+			efs_inode_t *inode;
+			char path[4096];
+
+			if (strcmp(nm, ".") == 0 || strcmp(nm, "..") == 0)
+				continue;
+			(void) snprintf(path, sizeof (path), "%s/%s",
+			    b->b_dirs[d].o_path, nm);
+			if ((err = efs_iget(&b->b_fs, ino, &inode)) != 0 ||
+			    EFS_BAD_FILE(inode))
+				continue;
+			if (IS_DIR(inode))
+				err = bench_add(&b->b_dirs, &b->b_ndirs, ino,
+				    path);
+			else if (S_ISREG(inode->i_mode))
+				err = bench_add(&b->b_files, &b->b_nfiles, ino,
+				    path);
+		}
+		efs_dir_snap_rele(ds);
+		if (err != 0)
+			return (err);
+	}
+
+	return (0);
+}
+
+static void
+bench_free(bench_obj_t *objs, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++)
+		free(objs[i].o_path);
+	free(objs);
+}
+
+static void
+bench_shuffle(bench_obj_t *objs, uint32_t n, uint64_t *rng)
+{
+	for (uint32_t i = n; i > 1; i--) {
+		uint32_t j;
+		bench_obj_t t;
+
+		*rng ^= *rng << 13;
+		*rng ^= *rng >> 7;
+		*rng ^= *rng << 17;
+		j = *rng % i;
+		t = objs[i - 1];
+		objs[i - 1] = objs[j];
+		objs[j] = t;
+	}
+}
+
+/*
+ * Mounting again starts with empty caches.
+ */
+static int
+bench_drop_caches(bench_t *b)
+{
+	efs_umount(&b->b_fs);
+	return (efs_mount(&b->b_fs));
+}
+
+static int
+bench_start(bench_t *b, size_t maxops)
+{
+	if (maxops > b->b_maxlat) {
+		uint64_t *nl;
+
+		if ((nl = realloc(b->b_lat, maxops * sizeof (uint64_t))) ==
+		    NULL)
+			return (ENOMEM);
+		b->b_lat = nl;
+		b->b_maxlat = maxops;
+	}
+	b->b_nlat = 0;
+
+	return (0);
+}
+
+static int
+lat_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static void
+bench_report(bench_t *b, const char *name, uint64_t ns, uint64_t bytes)
+{
+	uint64_t *l = b->b_lat;
+	size_t n = b->b_nlat;
+	double secs = ns / 1e9;
+
+	if (n == 0)
+		return;
+	qsort(l, n, sizeof (uint64_t), lat_cmp);
+	printf("%s\n    { \"name\": \"%s\", \"ops\": %zu, \"seconds\": %.6f, "
+	    "\"ops_per_sec\": %.1f, \"p50_ns\": %llu, \"p90_ns\": %llu, "
+	    "\"p99_ns\": %llu, \"max_ns\": %llu", b->b_sep, name, n, secs,
+	    secs > 0 ? n / secs : 0, (unsigned long long)l[n * 50 / 100],
+	    (unsigned long long)l[n * 90 / 100],
+	    (unsigned long long)l[n * 99 / 100],
+	    (unsigned long long)l[n - 1]);
+	if (bytes != 0) {
+		printf(", \"bytes\": %llu, \"mb_per_sec\": %.1f",
+		    (unsigned long long)bytes,
+		    secs > 0 ? bytes / secs / 1e6 : 0);
+	}
+	printf(" }");
+	b->b_sep = ",";
+}
+
+static int
+bench_readdir(bench_t *b, int cold)
+{
+	uint64_t t0, ns = 0;
+	int err = 0;
+
+	if ((err = bench_start(b, (size_t)b->b_ndirs * b->b_iters)) != 0)
+		return (err);
+	/* the time to drop the caches is not measured */
+	for (uint32_t it = 0; it < b->b_iters && err == 0; it++) {
+		if (cold && (err = bench_drop_caches(b)) != 0)
+			break;
+		t0 = efs_stats_now();
+		for (uint32_t d = 0; d < b->b_ndirs && err == 0; d++) {
+			uint64_t start = efs_stats_now();
+			volatile uint32_t sum = 0;
+			efs_dir_snap_t *ds;
+			efs_inode_t *dir;
+
+			if ((err = efs_iget(&b->b_fs, b->b_dirs[d].o_ino,
+			    &dir)) != 0 ||
+			    (err = efs_dir_snap_get(dir, &ds)) != 0)
+				break;
+			for (uint32_t k = 0; k < ds->ds_nentries; k++)
+				sum += ds->ds_entries[k].dse_ino;
+			efs_dir_snap_rele(ds);
+			b->b_lat[b->b_nlat++] = efs_stats_now() - start;
+		}
+		ns += efs_stats_now() - t0;
+	}
+	if (err == 0)
+		bench_report(b, cold ? "readdir_cold" : "readdir_warm", ns, 0);
+
+	return (err);
+}
+
+static int
+bench_iget(bench_t *b, int cold)
+{
+	uint64_t t0, ns = 0;
+	int err = 0;
+
+	if ((err = bench_start(b, (size_t)b->b_nfiles * b->b_iters)) != 0)
+		return (err);
+	/* the time to drop the caches is not measured */
+	for (uint32_t it = 0; it < b->b_iters && err == 0; it++) {
+		if (cold && (err = bench_drop_caches(b)) != 0)
+			break;
+		t0 = efs_stats_now();
+		for (uint32_t f = 0; f < b->b_nfiles && err == 0; f++) {
+			uint64_t start = efs_stats_now();
+			efs_inode_t *inode;
+
+			err = efs_iget(&b->b_fs, b->b_files[f].o_ino, &inode);
+			b->b_lat[b->b_nlat++] = efs_stats_now() - start;
+		}
+		ns += efs_stats_now() - t0;
+	}
+	if (err == 0)
+		bench_report(b, cold ? "iget_cold" : "iget_warm", ns, 0);
+
+	return (err);
+}
+
+static int
+bench_namei(bench_t *b, int cold)
+{
+	uint64_t t0, ns = 0;
+	int err = 0;
+
+	if ((err = bench_start(b, (size_t)b->b_nfiles * b->b_iters)) != 0)
+		return (err);
+	/* the time to drop the caches is not measured */
+	for (uint32_t it = 0; it < b->b_iters && err == 0; it++) {
+		if (cold && (err = bench_drop_caches(b)) != 0)
+			break;
+		t0 = efs_stats_now();
+		for (uint32_t f = 0; f < b->b_nfiles && err == 0; f++) {
+			uint64_t start = efs_stats_now();
+			efs_inode_t *inode;
+
+			err = efs_dir_namei(&b->b_fs, b->b_files[f].o_path,
+			    &inode);
+			b->b_lat[b->b_nlat++] = efs_stats_now() - start;
+		}
+		ns += efs_stats_now() - t0;
+	}
+	if (err == 0)
+		bench_report(b, cold ? "namei_cold" : "namei_warm", ns, 0);
+
+	return (err);
+}
+
+static int
+bench_iread(bench_t *b)
+{
+	uint64_t bytes = 0;
+	size_t nops = 0;
+	char *buf;
+	uint64_t t0;
+	int err = 0;
+
+	/* count the chunks first, the inodes are cached by now */
+	for (uint32_t f = 0; f < b->b_nfiles && err == 0; f++) {
+		efs_inode_t *inode;
+
+		if ((err = efs_iget(&b->b_fs, b->b_files[f].o_ino, &inode)) ==
+		    0)
+			nops += (inode->i_nblks + b->b_chunk - 1) / b->b_chunk;
+	}
+	if (err != 0 || (err = bench_start(b, nops * b->b_iters)) != 0)
+		return (err);
+	if ((buf = malloc((size_t)b->b_chunk * BBS)) == NULL)
+		return (ENOMEM);
+
+	t0 = efs_stats_now();
+	for (uint32_t it = 0; it < b->b_iters && err == 0; it++) {
+		for (uint32_t f = 0; f < b->b_nfiles && err == 0; f++) {
+			efs_inode_t *inode;
+
+			if ((err = efs_iget(&b->b_fs, b->b_files[f].o_ino,
+			    &inode)) != 0)
+				break;
+			for (uint32_t blk = 0; blk < inode->i_nblks &&
+			    err == 0; blk += b->b_chunk) {
+				uint32_t n = MIN(b->b_chunk,
+				    inode->i_nblks - blk);
+				uint64_t start = efs_stats_now();
+
+				err = efs_iread(inode, blk, n, buf);
+				b->b_lat[b->b_nlat++] = efs_stats_now() -
+				    start;
+				bytes += (uint64_t)n * BBS;
+			}
+		}
+	}
+	if (err == 0)
+		bench_report(b, "iread", efs_stats_now() - t0, bytes);
+	free(buf);
+
+	return (err);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <image>\n", prog);
+	fprintf(stderr, "\t-i <N>\tIterations of each benchmark (default 3)\n");
+	fprintf(stderr, "\t-c <N>\tRead chunk size in BBs (default 128)\n");
+	fprintf(stderr, "\t-r <N>\tRandom seed of the access order "
+	    "(default 1)\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	bench_t b;
+	uint64_t rng = 1;
+	int err;
+	int c;
+
+	memset(&b, 0, sizeof (b));
+	b.b_iters = 3;
+	b.b_chunk = 128;
+	b.b_sep = "";
+	while ((c = getopt(argc, argv, "i:c:r:")) != -1) {
+		switch (c) {
+		case 'i':
+			b.b_iters = atoi(optarg);
+			break;
+		case 'c':
+			b.b_chunk = atoi(optarg);
+			break;
+		case 'r':
+			rng = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return (2);
+		}
+	}
+	if (optind != argc - 1 || b.b_iters < 1 || b.b_chunk < 1 || rng == 0) {
+		usage(argv[0]);
+		return (2);
+	}
+
+	if (efs_vol_open(&b.b_fs, argv[optind], -1) != 0)
+		return (1);
+	if (efs_mount(&b.b_fs) != 0 || (err = bench_scan(&b)) != 0) {
+		fprintf(stderr, "%s: cannot scan the image\n", argv[optind]);
+		return (1);
+	}
+	bench_shuffle(b.b_dirs, b.b_ndirs, &rng);
+	bench_shuffle(b.b_files, b.b_nfiles, &rng);
+
+	printf("{\n  \"image\": \"%s\",\n  \"directories\": %u,\n"
+	    "  \"files\": %u,\n  \"iterations\": %u,\n  \"results\": [",
+	    argv[optind], b.b_ndirs, b.b_nfiles, b.b_iters);
+	if ((err = bench_readdir(&b, 1)) != 0 ||
+	    (err = bench_readdir(&b, 0)) != 0 ||
+	    (err = bench_iget(&b, 1)) != 0 ||
+	    (err = bench_iget(&b, 0)) != 0 ||
+	    (err = bench_namei(&b, 1)) != 0 ||
+	    (err = bench_namei(&b, 0)) != 0 ||
+	    (err = bench_iread(&b)) != 0)
+		fprintf(stderr, "benchmark failed: %s\n", strerror(err));
+	printf("\n  ]\n}\n");
+
+	efs_umount(&b.b_fs);
+	efs_vol_close(&b.b_fs);
+	bench_free(b.b_dirs, b.b_ndirs);
+	bench_free(b.b_files, b.b_nfiles);
+	free(b.b_lat);
+
+	return (err != 0);
+}
@@ -0,0 +1,129 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Writes files of an EFS image to the standard output, without mounting
+ * it:
+ *
+ *	efs-cat [-p <N>] <image> <path> ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "../libefs.h"
+
+#define	CAT_BUFSIZE	(1024 * 1024)
+
+static int
+cat_write(const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(STDOUT_FILENO, buf, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno);
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return (0);
+}
+
+static int
+cat_file(efs_ctx_t *ctx, const char *path, char *buf)
+{
+	efs_ctx_file_t *f;
+	off_t off = 0;
+	size_t n;
+	int err;
+
+	if ((err = efs_ctx_fopen(ctx, path, &f)) != 0)
+		return (err);
+	while ((err = efs_ctx_pread(f, buf, CAT_BUFSIZE, off, &n)) == 0 &&
+	    n > 0) {
+		if ((err = cat_write(buf, n)) != 0)
+			break;
+		off += n;
+	}
+	efs_ctx_fclose(f);
+
+	return (err);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <image> <path> ...\n", prog);
+	fprintf(stderr, "\t-p <N>\tPartition of the image\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	efs_ctx_t *ctx;
+	char *buf;
+	int part = -1;
+	int rc = 0;
+	int c, err;
+
+	while ((c = getopt(argc, argv, "p:")) != -1) {
+		switch (c) {
+		case 'p':
+			part = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return (2);
+		}
+	}
+	if (optind + 2 > argc) {
+		usage(argv[0]);
+		return (2);
+	}
+
+	if ((buf = malloc(CAT_BUFSIZE)) == NULL) {
+		perror("malloc");
+		return (1);
+	}
+	if ((err = efs_ctx_open(argv[optind], part, 0, &ctx)) != 0) {
+		fprintf(stderr, "%s: cannot open the image: %s\n", argv[optind],
+		    strerror(err));
+		free(buf);
+		return (1);
+	}
+
+	for (int k = optind + 1; k < argc; k++) {
+		if ((err = cat_file(ctx, argv[k], buf)) != 0) {
+			fprintf(stderr, "%s: %s\n", argv[k], strerror(err));
+			rc = 1;
+		}
+	}
+
+	efs_ctx_close(ctx);
+	free(buf);
+
+	return (rc);
+}
@@ -0,0 +1,736 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks the consistency of an EFS image, read only:
+ *
+ *	efs-check [-q] [-j <N>] [-p <N>] <image>
+ *
+ * Cylinder groups are checked in parallel, each worker reads the inode
+ * table of its group sequentially. The first pass checks every allocated
+ * inode and its extents (magic, bounds against s_size) and marks the
+ * blocks it uses, a block marked twice is used by two files or overlaps
+ * metadata. The second pass reads the directories of each group and
+ * checks the block magic and slot offsets, that entries point to
+ * allocated inodes, and counts the references of every inode. Finally the
+ * link counts are compared to the references, and the used blocks and
+ * free inodes to the superblock and the free block bitmap.
+ *
+ * Problems are printed as they are found. The superblock summary counts
+ * are only warnings, they are updated lazily. The exit status is 0 when
+ * no error was found, 1 if there are errors and 2 if the image cannot be
+ * checked at all.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../utils.h"
+#include "../efs_fs.h"
+#include "../efs_vol.h"
+#include "../efs_file.h"
+#include "../efs_dir.h"
+
+#define	CK_MAX_THREADS	64
+#define	CK_BITMAPBB	2	/* bitmap location on old file systems */
+
+typedef struct ck_ino {
+	uint16_t	ci_mode;	/* 0 if free */
+	int16_t		ci_nlink;
+	uint32_t	ci_refs;	/* directory entries pointing here */
+} ck_ino_t;
+
+typedef struct ck_dir {
+	uint32_t	cd_ino;
+	int		cd_nextents;
+	efs_extent_t	*cd_ext;
+} ck_dir_t;
+
+typedef struct ck_cg {
+	ck_dir_t	*cg_dirs;
+	uint32_t	cg_ndirs;
+	uint32_t	cg_maxdirs;
+} ck_cg_t;
+
+typedef struct ck {
+	efs_fs_t	c_fs;
+	int		c_quiet;
+	int32_t		c_ncg;
+	int32_t		c_cgsize;
+	int32_t		c_firstcg;
+	int32_t		c_ino_bbs;
+	uint32_t	c_size;		/* s_size */
+	uint32_t	c_maxino;
+	ck_ino_t	*c_inos;
+	uint64_t	*c_used;	/* one bit per BB */
+	ck_cg_t		*c_cgs;
+	int		c_pass;
+	int32_t		c_next;		/* next CG to check */
+	uint32_t	c_errors;
+	uint32_t	c_warnings;
+	pthread_mutex_t	c_out_mtx;
+} ck_t;
+
+static void __attribute__((format(printf, 3, 4)))
+ck_report(ck_t *c, int error, const char *fmt, ...)
+{
+	va_list ap;
+
+	__atomic_add_fetch(error ? &c->c_errors : &c->c_warnings, 1,
+	    __ATOMIC_RELAXED);
+	if (c->c_quiet)
+		return;
+
+	pthread_mutex_lock(&c->c_out_mtx);
+	printf("%s: ", error ? "error" : "warning");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+	pthread_mutex_unlock(&c->c_out_mtx);
+}
+
+#define	CK_ERR(c, ...)	ck_report((c), 1, __VA_ARGS__)
+#define	CK_WARN(c, ...)	ck_report((c), 0, __VA_ARGS__)
+
+static uint32_t
+ck_cg_start(ck_t *c, int32_t cg)
+{
+	return (c->c_firstcg + cg * c->c_cgsize);
+}
+
+/*
+ * Marks blocks [bn, bn + len) used, returns the number of blocks which
+ * were marked already.
+ */
+static uint32_t
+ck_mark(ck_t *c, uint32_t bn, uint32_t len)
+{
+	uint32_t dups = 0;
+
+	for (uint32_t b = bn; b < bn + len; b++) {
+		uint64_t bit = 1ULL << (b & 63);
+
+		if (__atomic_fetch_or(&c->c_used[b >> 6], bit,
+		    __ATOMIC_RELAXED) & bit)
+			dups++;
+	}
+
+	return (dups);
+}
+
+static int
+ck_used(ck_t *c, uint32_t bn)
+{
+	return ((c->c_used[bn >> 6] & (1ULL << (bn & 63))) != 0);
+}
+
+/*
+ * Decodes and checks one extent. Data and indirect extents must lie in
+ * the cylinder groups.
+ */
+static int
+ck_extent(ck_t *c, uint32_t ino, const efs_od_extent_t *od,
+    const char *what, int n, efs_extent_t *e)
+{
+	uint32_t ext1 = GET_U32(od->ext1);
+	uint32_t ext2 = GET_U32(od->ext2);
+	uint32_t dups;
+
+	if (EXT_MAGIC(ext1) != 0) {
+		CK_ERR(c, "inode %u: %s %d has wrong magic 0x%x", ino, what,
+		    n, EXT_MAGIC(ext1));
+		return (EINVAL);
+	}
+	e->e_blk = EXT_BN(ext1);
+	e->e_len = EXT_LEN(ext2);
+	e->e_offset = EXT_OFFSET(ext2);
+	if (e->e_len == 0) {
+		CK_ERR(c, "inode %u: %s %d is empty", ino, what, n);
+		return (EINVAL);
+	}
+	if (e->e_blk < (uint32_t)c->c_firstcg ||
+	    e->e_blk + e->e_len > c->c_size) {
+		CK_ERR(c, "inode %u: %s %d (blocks %u-%u) is out of the "
+		    "file system (%d-%u)", ino, what, n, e->e_blk,
+		    e->e_blk + e->e_len - 1, c->c_firstcg, c->c_size - 1);
+		return (EINVAL);
+	}
+	if ((dups = ck_mark(c, e->e_blk, e->e_len)) != 0) {
+		CK_ERR(c, "inode %u: %s %d (blocks %u-%u) has %u blocks "
+		    "used elsewhere", ino, what, n, e->e_blk,
+		    e->e_blk + e->e_len - 1, dups);
+	}
+
+	return (0);
+}
+
+/*
+ * Loads the extents of an inode, following the indirect extents. The
+ * returned array has *np extents, NULL means the inode is damaged.
+ */
+static efs_extent_t *
+ck_extents(ck_t *c, uint32_t ino, efs_od_inode_t *di, int *np)
+{
+	int n = GET_I16(di->di_nextents);
+	efs_od_extent_t *ind;
+	efs_extent_t *ext;
+	efs_extent_t ie;
+	int nind, extn = 0;
+
+	if (n < 0) {
+		CK_ERR(c, "inode %u: bad number of extents %d", ino, n);
+		return (NULL);
+	}
+	if ((ext = calloc(MAX(n, 1), sizeof (efs_extent_t))) == NULL)
+		return (NULL);
+	if (n <= EFS_DIRECTEXTENTS) {
+		for (int i = 0; i < n; i++) {
+			if (ck_extent(c, ino, &di->di_u.di_extents[i],
+			    "extent", i, &ext[i]) != 0)
+				goto bad;
+		}
+		*np = n;
+		return (ext);
+	}
+
+	nind = EXT_OFFSET(GET_U32(di->di_u.di_extents[0].ext2));
+	if (nind == 0 || nind > EFS_DIRECTEXTENTS) {
+		CK_ERR(c, "inode %u: bad number of indirect extents %d", ino,
+		    nind);
+		goto bad;
+	}
+	for (int i = 0; i < nind && extn < n; i++) {
+		int cnt;
+
+		if (ck_extent(c, ino, &di->di_u.di_extents[i],
+		    "indirect extent", i, &ie) != 0)
+			goto bad;
+		if ((ind = malloc(ie.e_len * BBS)) == NULL)
+			goto bad;
+		if (efs_bread_bbs(&c->c_fs, ie.e_blk, ind, ie.e_len) != 0) {
+			CK_ERR(c, "inode %u: cannot read indirect extent %d",
+			    ino, i);
+			free(ind);
+			goto bad;
+		}
+		cnt = MIN(ie.e_len * (int)EFS_EXTENTS_PER_BB, n - extn);
+		for (int k = 0; k < cnt; k++, extn++) {
+			if (ck_extent(c, ino, &ind[k], "extent", extn,
+			    &ext[extn]) != 0) {
+				free(ind);
+				goto bad;
+			}
+		}
+		free(ind);
+	}
+	if (extn != n) {
+		CK_ERR(c, "inode %u: has %d extents, indirect extents hold %d",
+		    ino, n, extn);
+		goto bad;
+	}
+	*np = n;
+	return (ext);
+
+bad:
+	free(ext);
+	return (NULL);
+}
+
+static int
+ck_add_dir(ck_cg_t *cg, uint32_t ino, efs_extent_t *ext, int n)
+{
+	if (cg->cg_ndirs == cg->cg_maxdirs) {
+		uint32_t max = MAX(cg->cg_maxdirs * 2, 16);
+		ck_dir_t *d = realloc(cg->cg_dirs, max * sizeof (ck_dir_t));
+
+		if (d == NULL)
+			return (ENOMEM);
+		cg->cg_dirs = d;
+		cg->cg_maxdirs = max;
+	}
+	cg->cg_dirs[cg->cg_ndirs].cd_ino = ino;
+	cg->cg_dirs[cg->cg_ndirs].cd_ext = ext;
+	cg->cg_dirs[cg->cg_ndirs].cd_nextents = n;
+	cg->cg_ndirs++;
+
+	return (0);
+}
+
+static void
+ck_inode(ck_t *c, ck_cg_t *cg, uint32_t ino, efs_od_inode_t *di)
+{
+	uint16_t mode = GET_U16(di->di_mode);
+	int32_t size = GET_I32(di->di_size);
+	efs_extent_t *ext;
+	uint32_t end = 0;
+	int n;
+
+	c->c_inos[ino].ci_mode = mode;
+	c->c_inos[ino].ci_nlink = GET_I16(di->di_nlink);
+
+	switch (mode & S_IFMT) {
+	case S_IFREG:
+	case S_IFDIR:
+	case S_IFLNK:
+		break;
+	case S_IFCHR:
+	case S_IFBLK:
+	case S_IFIFO:
+	case S_IFSOCK:
+		if (GET_I16(di->di_nextents) != 0)
+			CK_ERR(c, "inode %u: special file has extents", ino);
+		return;
+	default:
+		CK_ERR(c, "inode %u: bad mode 0%o", ino, mode);
+		return;
+	}
+	if (c->c_inos[ino].ci_nlink <= 0)
+		CK_WARN(c, "inode %u: allocated with link count %d", ino,
+		    c->c_inos[ino].ci_nlink);
+	if (size < 0) {
+		CK_ERR(c, "inode %u: negative size %d", ino, size);
+		return;
+	}
+	if (S_ISLNK(mode) && GET_I16(di->di_nextents) == 0) {
+		if (size > (int32_t)sizeof (di->di_u.di_symlink))
+			CK_ERR(c, "inode %u: inline symlink of %d bytes", ino,
+			    size);
+		return;
+	}
+
+	if ((ext = ck_extents(c, ino, di, &n)) == NULL)
+		return;
+	for (int i = 0; i < n; i++) {
+		if (ext[i].e_offset < end) {
+			CK_ERR(c, "inode %u: extent %d overlaps the previous "
+			    "one at block %u", ino, i, ext[i].e_offset);
+			break;
+		}
+		end = ext[i].e_offset + ext[i].e_len;
+	}
+	if ((uint64_t)end * BBS >= (uint64_t)size + BBS)
+		CK_WARN(c, "inode %u: %u blocks mapped for %d bytes", ino, end,
+		    size);
+
+	if (S_ISDIR(mode)) {
+		if (size % BBS != 0)
+			CK_ERR(c, "inode %u: directory size %d is not a "
+			    "multiple of %d", ino, size, BBS);
+		if (ck_add_dir(cg, ino, ext, n) == 0)
+			return;
+		CK_ERR(c, "inode %u: out of memory", ino);
+	}
+	free(ext);
+}
+
+/* First pass: the inode table of one cylinder group */
+static void
+ck_cg_inodes(ck_t *c, int32_t cgno)
+{
+	uint32_t first = cgno * c->c_ino_bbs * INOS_PER_BB;
+	char *buf;
+
+	if ((buf = malloc(c->c_ino_bbs * BBS)) == NULL) {
+		CK_ERR(c, "cg %d: out of memory", cgno);
+		return;
+	}
+	if (efs_bread_bbs(&c->c_fs, ck_cg_start(c, cgno), buf,
+	    c->c_ino_bbs) != 0) {
+		CK_ERR(c, "cg %d: cannot read the inode table", cgno);
+		free(buf);
+		return;
+	}
+	for (int k = 0; k < c->c_ino_bbs * INOS_PER_BB; k++) {
+		efs_od_inode_t *di = (efs_od_inode_t *)(buf + k * INO_SIZE);
+
+		if (first + k >= FIRST_INO && GET_U16(di->di_mode) != 0)
+			ck_inode(c, &c->c_cgs[cgno], first + k, di);
+	}
+	free(buf);
+}
+
+static void
+ck_dirent(ck_t *c, uint32_t dir, uint32_t bn, efs_dirblk_t *db, int slot,
+    int *dots)
+{
+	int offset = db->db_space[slot] << 1;
+	efs_dirent_t *de = (efs_dirent_t *)((char *)db + offset);
+	char name[EFS_NAME_MAX + 1];
+	uint32_t ino;
+
+	/* the entry header must be in the block before it is read */
+	if (offset < db->db_first << 1 ||
+	    offset < EFS_DIRBLK_HDR_SIZE + db->db_slots ||
+	    offset + offsetof(efs_dirent_t, de_name) > BBS) {
+		CK_ERR(c, "directory %u: block %u, slot %d has bad offset %d",
+		    dir, bn, slot, offset);
+		return;
+	}
+	if (offset + offsetof(efs_dirent_t, de_name) + de->de_namelen > BBS) {
+		CK_ERR(c, "directory %u: block %u, slot %d has a name of %d "
+		    "bytes past the block", dir, bn, slot, de->de_namelen);
+		return;
+	}
+	if (de->de_namelen == 0) {
+		CK_ERR(c, "directory %u: block %u, slot %d has an empty name",
+		    dir, bn, slot);
+		return;
+	}
+	memcpy(name, de->de_name, de->de_namelen);
+	name[de->de_namelen] = '\0';
+	ino = GET_U32(de->de_ino);
+
+	if (ino < FIRST_INO || ino >= c->c_maxino ||
+	    c->c_inos[ino].ci_mode == 0) {
+		CK_ERR(c, "directory %u: entry '%s' points to %s inode %u",
+		    dir, name, ino >= c->c_maxino ? "invalid" : "free", ino);
+		return;
+	}
+	__atomic_add_fetch(&c->c_inos[ino].ci_refs, 1, __ATOMIC_RELAXED);
+
+	if (strcmp(name, ".") == 0) {
+		(*dots)++;
+		if (ino != dir)
+			CK_ERR(c, "directory %u: '.' points to inode %u", dir,
+			    ino);
+	} else if (strcmp(name, "..") == 0) {
+		(*dots)++;
+		if (!S_ISDIR(c->c_inos[ino].ci_mode))
+			CK_ERR(c, "directory %u: '..' points to non-directory "
+			    "inode %u", dir, ino);
+	}
+}
+
+static void
+ck_dirblk(ck_t *c, uint32_t dir, uint32_t bn, efs_dirblk_t *db, int *dots)
+{
+	if (GET_U16(db->db_magic) != EFS_DIRBLK_MAGIC) {
+		CK_ERR(c, "directory %u: block %u has wrong magic 0x%x", dir,
+		    bn, GET_U16(db->db_magic));
+		return;
+	}
+	if (db->db_slots > EFS_DIRBLK_SLOTS_MAX ||
+	    (db->db_first << 1) < EFS_DIRBLK_HDR_SIZE + db->db_slots) {
+		CK_ERR(c, "directory %u: block %u has bad header (%d slots, "
+		    "first %d)", dir, bn, db->db_slots, db->db_first << 1);
+		return;
+	}
+	for (int slot = 0; slot < db->db_slots; slot++) {
+		if (db->db_space[slot] != 0)
+			ck_dirent(c, dir, bn, db, slot, dots);
+	}
+}
+
+/* Second pass: the directories whose inodes are in one cylinder group */
+static void
+ck_cg_dirs(ck_t *c, int32_t cgno)
+{
+	ck_cg_t *cg = &c->c_cgs[cgno];
+
+	for (uint32_t d = 0; d < cg->cg_ndirs; d++) {
+		ck_dir_t *dir = &cg->cg_dirs[d];
+		int dots = 0;
+
+		for (int i = 0; i < dir->cd_nextents; i++) {
+			efs_extent_t *e = &dir->cd_ext[i];
+			char *buf;
+
+			if ((buf = malloc(e->e_len * BBS)) == NULL) {
+				CK_ERR(c, "directory %u: out of memory",
+				    dir->cd_ino);
+				break;
+			}
+			if (efs_bread_bbs(&c->c_fs, e->e_blk, buf,
+			    e->e_len) != 0) {
+				CK_ERR(c, "directory %u: cannot read blocks "
+				    "%u-%u", dir->cd_ino, e->e_blk,
+				    e->e_blk + e->e_len - 1);
+			} else {
+				for (int b = 0; b < e->e_len; b++)
+					ck_dirblk(c, dir->cd_ino, e->e_blk + b,
+					    (efs_dirblk_t *)(buf + b * BBS),
+					    &dots);
+			}
+			free(buf);
+		}
+		if (dots != 2)
+			CK_ERR(c, "directory %u: has %d '.' and '..' entries",
+			    dir->cd_ino, dots);
+	}
+}
+
+static void *
+ck_worker(void *arg)
+{
+	ck_t *c = arg;
+	int32_t cg;
+
+	while ((cg = __atomic_fetch_add(&c->c_next, 1, __ATOMIC_RELAXED)) <
+	    c->c_ncg) {
+		if (c->c_pass == 1)
+			ck_cg_inodes(c, cg);
+		else
+			ck_cg_dirs(c, cg);
+	}
+
+	return (NULL);
+}
+
+static void
+ck_run_pass(ck_t *c, int pass, int nthreads)
+{
+	pthread_t tids[CK_MAX_THREADS];
+	int n;
+
+	c->c_pass = pass;
+	c->c_next = 0;
+	for (n = 0; n < nthreads; n++) {
+		if (pthread_create(&tids[n], NULL, ck_worker, c) != 0)
+			break;
+	}
+	if (n == 0)
+		(void) ck_worker(c);
+	while (n > 0)
+		(void) pthread_join(tids[--n], NULL);
+}
+
+/*
+ * Compares the blocks found in use with the free block bitmap, a set bit
+ * is a free block.
+ */
+static void
+ck_bitmap(ck_t *c, uint32_t *bm_free)
+{
+	efs_sb_t *sb = &c->c_fs.sb;
+	int32_t bmsize = GET_I32(sb->s_bmsize);
+	uint32_t bmbbs = (bmsize + BBS - 1) / BBS;
+	uint32_t bmblock = CK_BITMAPBB;
+	uint32_t used_free = 0, leaked = 0;
+	uint8_t *bm;
+
+	if (GET_I32(sb->s_magic) == EFS_NEWMAGIC && GET_I32(sb->s_bmblock) > 0)
+		bmblock = GET_I32(sb->s_bmblock);
+	if (bmsize <= 0 || (uint64_t)bmsize * 8 < c->c_size) {
+		CK_WARN(c, "superblock: bitmap of %d bytes does not cover %u "
+		    "blocks, not checked", bmsize, c->c_size);
+		return;
+	}
+	if ((bm = malloc(bmbbs * BBS)) == NULL ||
+	    efs_bread_bbs(&c->c_fs, bmblock, bm, bmbbs) != 0) {
+		CK_ERR(c, "superblock: cannot read the bitmap at block %u",
+		    bmblock);
+		free(bm);
+		return;
+	}
+
+	*bm_free = 0;
+	for (int32_t cg = 0; cg < c->c_ncg; cg++) {
+		uint32_t start = ck_cg_start(c, cg) + c->c_ino_bbs;
+		uint32_t end = ck_cg_start(c, cg) + c->c_cgsize;
+
+		for (uint32_t b = start; b < end; b++) {
+			int is_free = (bm[b >> 3] >> (b & 7)) & 1;
+
+			*bm_free += is_free;
+			if (is_free && ck_used(c, b))
+				used_free++;
+			else if (!is_free && !ck_used(c, b))
+				leaked++;
+		}
+	}
+	free(bm);
+
+	if (used_free != 0)
+		CK_ERR(c, "bitmap: %u blocks in use are marked free",
+		    used_free);
+	if (leaked != 0)
+		CK_WARN(c, "bitmap: %u unused blocks are marked allocated",
+		    leaked);
+}
+
+static void
+ck_summary(ck_t *c, uint32_t *ninodes, uint32_t *ndirs, uint32_t *nused)
+{
+	efs_sb_t *sb = &c->c_fs.sb;
+	uint32_t ino_free = 0;
+	uint32_t bm_free = UINT32_MAX;
+	uint32_t data = 0;
+
+	*ninodes = *ndirs = *nused = 0;
+	for (uint32_t ino = FIRST_INO; ino < c->c_maxino; ino++) {
+		ck_ino_t *ci = &c->c_inos[ino];
+
+		if (ci->ci_mode == 0) {
+			ino_free++;
+			continue;
+		}
+		(*ninodes)++;
+		if (S_ISDIR(ci->ci_mode))
+			(*ndirs)++;
+		if (ci->ci_refs == 0)
+			CK_ERR(c, "inode %u: not referenced by any directory",
+			    ino);
+		else if (ci->ci_refs != (uint32_t)ci->ci_nlink)
+			CK_ERR(c, "inode %u: link count %d, %u references",
+			    ino, ci->ci_nlink, ci->ci_refs);
+	}
+
+	for (int32_t cg = 0; cg < c->c_ncg; cg++) {
+		uint32_t start = ck_cg_start(c, cg) + c->c_ino_bbs;
+
+		for (uint32_t b = start; b < start + c->c_cgsize -
+		    c->c_ino_bbs; b++) {
+			data++;
+			*nused += ck_used(c, b);
+		}
+	}
+
+	if (ino_free != (uint32_t)GET_I32(sb->s_ino_free))
+		CK_WARN(c, "superblock: %d free inodes, found %u",
+		    GET_I32(sb->s_ino_free), ino_free);
+	if (data - *nused != (uint32_t)GET_I32(sb->s_blk_free))
+		CK_WARN(c, "superblock: %d free blocks, found %u",
+		    GET_I32(sb->s_blk_free), data - *nused);
+	ck_bitmap(c, &bm_free);
+	if (bm_free != UINT32_MAX && bm_free != data - *nused)
+		CK_WARN(c, "bitmap: %u free blocks, found %u", bm_free,
+		    data - *nused);
+}
+
+/*
+ * Checks the superblock geometry, everything else depends on it.
+ */
+static int
+ck_super(ck_t *c)
+{
+	efs_sb_t *sb = &c->c_fs.sb;
+
+	c->c_ncg = GET_I16(sb->s_ncg);
+	c->c_cgsize = GET_I32(sb->s_cg_size);
+	c->c_firstcg = GET_I32(sb->s_first_cg);
+	c->c_ino_bbs = GET_I16(sb->s_cg_ino_bbs);
+	c->c_size = GET_I32(sb->s_size);
+
+	if (c->c_ncg <= 0 || c->c_cgsize <= 0 || c->c_firstcg <= 1 ||
+	    c->c_ino_bbs <= 0 || c->c_ino_bbs >= c->c_cgsize ||
+	    (int64_t)c->c_firstcg + (int64_t)c->c_ncg * c->c_cgsize >
+	    (int64_t)c->c_size) {
+		CK_ERR(c, "superblock: bad geometry: size %u, first CG %d, "
+		    "%d CGs of %d blocks, %d inode blocks", c->c_size,
+		    c->c_firstcg, c->c_ncg, c->c_cgsize, c->c_ino_bbs);
+		return (EINVAL);
+	}
+	c->c_maxino = c->c_ncg * c->c_ino_bbs * INOS_PER_BB;
+
+	return (0);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <image>\n", prog);
+	fprintf(stderr, "\t-j <N>\tCheck with N threads (default: online "
+	    "CPUs)\n");
+	fprintf(stderr, "\t-p <N>\tPartition of the image\n");
+	fprintf(stderr, "\t-q\tPrint only the summary\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static ck_t c;
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t ninodes, ndirs, nused;
+	int part = -1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:p:q")) != -1) {
+		switch (opt) {
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'p':
+			part = atoi(optarg);
+			break;
+		case 'q':
+			c.c_quiet = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return (2);
+		}
+	}
+	if (optind != argc - 1 || nthreads < 1) {
+		usage(argv[0]);
+		return (2);
+	}
+	nthreads = MIN(nthreads, CK_MAX_THREADS);
+	(void) pthread_mutex_init(&c.c_out_mtx, NULL);
+
+	if (efs_vol_open(&c.c_fs, argv[optind], part) != 0 ||
+	    efs_mount(&c.c_fs) != 0) {
+		fprintf(stderr, "%s: cannot open the image\n", argv[optind]);
+		return (2);
+	}
+	if (ck_super(&c) != 0)
+		return (2);
+	c.c_inos = calloc(c.c_maxino, sizeof (ck_ino_t));
+	c.c_used = calloc(c.c_size / 64 + 1, sizeof (uint64_t));
+	c.c_cgs = calloc(c.c_ncg, sizeof (ck_cg_t));
+	if (c.c_inos == NULL || c.c_used == NULL || c.c_cgs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return (2);
+	}
+
+	/* The superblock, the bitmap and the inode tables are not data. */
+	(void) ck_mark(&c, 0, c.c_firstcg);
+	for (int32_t cg = 0; cg < c.c_ncg; cg++)
+		(void) ck_mark(&c, ck_cg_start(&c, cg), c.c_ino_bbs);
+
+	ck_run_pass(&c, 1, nthreads);
+	if (c.c_maxino <= FIRST_INO || !S_ISDIR(c.c_inos[FIRST_INO].ci_mode))
+		CK_ERR(&c, "inode %u: the root is not a directory", FIRST_INO);
+	ck_run_pass(&c, 2, nthreads);
+	ck_summary(&c, &ninodes, &ndirs, &nused);
+
+	printf("%s: %u inodes (%u directories), %u data blocks used, "
+	    "%u errors, %u warnings\n", argv[optind], ninodes, ndirs, nused,
+	    c.c_errors, c.c_warnings);
+
+	for (int32_t cg = 0; cg < c.c_ncg; cg++) {
+		for (uint32_t d = 0; d < c.c_cgs[cg].cg_ndirs; d++)
+			free(c.c_cgs[cg].cg_dirs[d].cd_ext);
+		free(c.c_cgs[cg].cg_dirs);
+	}
+	free(c.c_cgs);
+	free(c.c_used);
+	free(c.c_inos);
+	efs_umount(&c.c_fs);
+	efs_vol_close(&c.c_fs);
+
+	return (c.c_errors != 0);
+}
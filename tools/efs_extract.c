@@ -0,0 +1,591 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Extracts a whole EFS image into a host directory:
+ *
+ *	efs-extract [-v] [-j <N>] [-p <N>] <image> <directory>
+ *
+ * Copying a mounted image file by file seeks all over the disk. Instead,
+ * the inode tables are read sequentially, one cylinder group after
+ * another, and the directories are walked from the inode cache to build
+ * the namespace. All files are created empty and sparse first; their data
+ * is then copied by a pool of workers from a list of all extents sorted by
+ * the position in the image, so the image is read front to back. Runs are
+ * copied with copy_file_range(2) where the kernel supports it between the
+ * two file systems, with pread/pwrite otherwise. Unallocated ranges are
+ * never written and stay holes.
+ *
+ * Hard links, symbolic links, device nodes, modes and times are restored,
+ * owners only when running as root. Directory attributes are set last,
+ * deepest first.
+ */
+
+#define	_GNU_SOURCE	/* copy_file_range() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "../utils.h"
+#include "../efs_fs.h"
+#include "../efs_vol.h"
+#include "../efs_file.h"
+#include "../efs_dir.h"
+#include "../efs_stats.h"
+
+#define	EX_SCAN_BBS	256		/* inode table BBs read at once */
+#define	EX_IGET_BATCH	256
+#define	EX_CHUNK	16		/* runs taken by a worker at once */
+#define	EX_BUFSIZE	(1024 * 1024)
+#define	EX_MAX_THREADS	64
+
+typedef struct ex_node {
+	char		*n_path;	/* host path */
+	efs_inode_t	*n_inode;
+	int64_t		n_link;		/* node of the first link, or -1 */
+} ex_node_t;
+
+/* A contiguous range of a file's data in the image */
+typedef struct ex_run {
+	off_t		r_pos;		/* in the image */
+	off_t		r_off;		/* in the file */
+	size_t		r_len;
+	uint32_t	r_node;
+} ex_run_t;
+
+typedef struct ex {
+	efs_fs_t	x_fs;
+	const char	*x_dest;
+	int		x_verbose;
+	ex_node_t	*x_nodes;
+	uint32_t	x_nnodes;
+	uint32_t	x_maxnodes;
+	uint32_t	*x_byino;	/* inode number -> node + 1 */
+	uint32_t	x_maxino;
+	uint32_t	x_ninodes;	/* allocated inodes found by the scan */
+	ex_run_t	*x_runs;
+	size_t		x_nruns;
+	size_t		x_maxruns;
+	size_t		x_next;		/* next run to copy */
+	int		x_no_cfr;	/* copy_file_range() does not work */
+	uint64_t	x_bytes;
+	uint32_t	x_errors;
+} ex_t;
+
+static void
+ex_error(ex_t *x, const char *path, const char *what, int err)
+{
+	fprintf(stderr, "%s: %s: %s\n", path, what, strerror(err));
+	__atomic_add_fetch(&x->x_errors, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Reads the inode tables of all cylinder groups in order and loads the
+ * allocated inodes into the cache.
+ */
+static int
+ex_scan_inodes(ex_t *x)
+{
+	efs_fs_t *fs = &x->x_fs;
+	int32_t ncg = GET_I16(fs->sb.s_ncg);
+	int32_t cgsize = GET_I32(fs->sb.s_cg_size);
+	int32_t firstcg = GET_I32(fs->sb.s_first_cg);
+	int32_t ino_bbs = GET_I16(fs->sb.s_cg_ino_bbs);
+	efs_inode_t *inodes[EX_IGET_BATCH];
+	uint32_t inos[EX_IGET_BATCH];
+	char *buf;
+	int n = 0;
+	int err = 0;
+
+	if ((buf = malloc(EX_SCAN_BBS * BBS)) == NULL)
+		return (ENOMEM);
+
+	for (int32_t cg = 0; cg < ncg && err == 0; cg++) {
+		for (int32_t bb = 0; bb < ino_bbs && err == 0;
+		    bb += EX_SCAN_BBS) {
+			int32_t nbbs = MIN(EX_SCAN_BBS, ino_bbs - bb);
+
+			err = efs_bread_bbs(fs, firstcg + cg * cgsize + bb, buf,
+			    nbbs);
+			for (int k = 0; k < nbbs * INOS_PER_BB && err == 0;
+			    k++) {
+				efs_od_inode_t *di = (efs_od_inode_t *)(buf +
+				    k * INO_SIZE);
+				uint32_t ino = (cg * ino_bbs + bb) *
+				    INOS_PER_BB + k;
+
+				if (ino < FIRST_INO || GET_U16(di->di_mode) ==
+				    0 || GET_I16(di->di_nlink) <= 0)
+					continue;
+				x->x_ninodes++;
+				inos[n++] = ino;
+				if (n == EX_IGET_BATCH) {
+					err = efs_iget_batch(fs, inos, n,
+					    inodes);
+					n = 0;
+				}
+			}
+		}
+	}
+	if (err == 0 && n > 0)
+		err = efs_iget_batch(fs, inos, n, inodes);
+	free(buf);
+
+	return (err);
+}
+
+static int
+ex_add_node(ex_t *x, const char *path, efs_inode_t *inode)
+{
+	ex_node_t *nd;
+
+	if (x->x_nnodes == x->x_maxnodes) {
+		uint32_t max = x->x_maxnodes == 0 ? 1024 : x->x_maxnodes * 2;
+
+		if ((nd = realloc(x->x_nodes, max * sizeof (ex_node_t))) ==
+		    NULL)
+			return (ENOMEM);
+		x->x_nodes = nd;
+		x->x_maxnodes = max;
+	}
+	nd = &x->x_nodes[x->x_nnodes];
+	if ((nd->n_path = strdup(path)) == NULL)
+		return (ENOMEM);
+	nd->n_inode = inode;
+	nd->n_link = -1;
+	if (inode->i_num < x->x_maxino) {
+		if (x->x_byino[inode->i_num] != 0)
+			nd->n_link = x->x_byino[inode->i_num] - 1;
+		else
+			x->x_byino[inode->i_num] = x->x_nnodes + 1;
+	}
+	x->x_nnodes++;
+
+	return (0);
+}
+
+/*
+ * Walks the directories breadth first, so every node follows its parent.
+ * A directory reached twice is not entered again.
+ */
+static int
+ex_walk(ex_t *x)
+{
+	efs_inode_t *root;
+	int err;
+
+	if ((err = efs_iget(&x->x_fs, FIRST_INO, &root)) != 0 ||
+	    (err = ex_add_node(x, x->x_dest, root)) != 0)
+		return (err);
+
+	for (uint32_t d = 0; d < x->x_nnodes; d++) {
+		ex_node_t *dir = &x->x_nodes[d];
+		efs_dir_snap_t *ds;
+
+		if (!IS_DIR(dir->n_inode) || dir->n_link != -1)
+			continue;
+		if (EFS_BAD_FILE(dir->n_inode) ||
+		    (err = efs_dir_snap_get(dir->n_inode, &ds)) != 0) {
+			ex_error(x, dir->n_path, "cannot read directory",
+			    EFS_BAD_FILE(dir->n_inode) ? EIO : err);
+			continue;
+		}
+		for (uint32_t k = 0; k < ds->ds_nentries; k++) {
+			const char *nm = DS_NAME(ds, k);
+			char path[PATH_MAX];
+			efs_inode_t *inode;
+
+			if (strcmp(nm, ".") == 0 || strcmp(nm, "..") == 0)
+				continue;
+			/* x_nodes may move, dir is not valid here */
+			if (snprintf(path, sizeof (path), "%s/%s",
+			    x->x_nodes[d].n_path, nm) >= (int)sizeof (path)) {
+				ex_error(x, x->x_nodes[d].n_path, nm,
+				    ENAMETOOLONG);
+				continue;
+			}
+			if ((err = efs_iget(&x->x_fs, ds->ds_entries[k].dse_ino,
+			    &inode)) != 0) {
+				ex_error(x, path, "cannot read inode", err);
+				continue;
+			}
+			if ((err = ex_add_node(x, path, inode)) != 0)
+				break;
+		}
+		efs_dir_snap_rele(ds);
+		if (err != 0)
+			return (err);
+	}
+
+	return (0);
+}
+
+static int
+ex_add_runs(ex_t *x, uint32_t node)
+{
+	efs_inode_t *inode = x->x_nodes[node].n_inode;
+	size_t size = inode->i_stat.st_size;
+	efs_seg_t *segs;
+	off_t off = 0;
+	int n;
+
+	if (size == 0)
+		return (0);
+	n = efs_bmap(inode, 0, size, NULL);
+	if ((segs = malloc(n * sizeof (efs_seg_t))) == NULL)
+		return (ENOMEM);
+	(void) efs_bmap(inode, 0, size, segs);
+
+	for (int k = 0; k < n; off += segs[k++].s_len) {
+		ex_run_t *r;
+
+		if (segs[k].s_pos == EFS_SEG_HOLE)
+			continue;
+		if (x->x_nruns == x->x_maxruns) {
+			size_t max = MAX(x->x_maxruns * 2, 1024);
+
+			if ((r = realloc(x->x_runs, max * sizeof (ex_run_t))) ==
+			    NULL) {
+				free(segs);
+				return (ENOMEM);
+			}
+			x->x_runs = r;
+			x->x_maxruns = max;
+		}
+		r = &x->x_runs[x->x_nruns++];
+		r->r_pos = segs[k].s_pos;
+		r->r_off = off;
+		r->r_len = segs[k].s_len;
+		r->r_node = node;
+	}
+	free(segs);
+
+	return (0);
+}
+
+/*
+ * Creates the node itself: directories, empty files of the right size and
+ * all links. Attributes come later.
+ */
+static int
+ex_create(ex_t *x, uint32_t node)
+{
+	ex_node_t *nd = &x->x_nodes[node];
+	efs_inode_t *inode = nd->n_inode;
+	char target[PATH_MAX];
+	int fd, err;
+
+	if (x->x_verbose)
+		printf("%s\n", nd->n_path);
+
+	if (nd->n_link != -1) {
+		/* A second link to a directory cannot be made, skip it. */
+		if (IS_DIR(inode))
+			return (EMLINK);
+		if (link(x->x_nodes[nd->n_link].n_path, nd->n_path) != 0)
+			return (errno);
+		return (0);
+	}
+	if (EFS_BAD_FILE(inode))
+		return (EIO);
+
+	switch (inode->i_mode & S_IFMT) {
+	case S_IFDIR:
+		if (mkdir(nd->n_path, 0700) != 0 &&
+		    (node != 0 || errno != EEXIST))
+			return (errno);
+		break;
+	case S_IFREG:
+		fd = open(nd->n_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+		if (fd < 0)
+			return (errno);
+		err = ftruncate(fd, inode->i_stat.st_size) != 0 ? errno : 0;
+		(void) close(fd);
+		if (err == 0)
+			err = ex_add_runs(x, node);
+		return (err);
+	case S_IFLNK:
+		if ((err = efs_readlink(inode, target, sizeof (target))) != 0)
+			return (err);
+		if (symlink(target, nd->n_path) != 0)
+			return (errno);
+		break;
+	default:
+		if (mknod(nd->n_path, (inode->i_mode & S_IFMT) | 0600,
+		    inode->i_stat.st_rdev) != 0)
+			return (errno);
+	}
+
+	return (0);
+}
+
+static int
+ex_copy_run(ex_t *x, const ex_run_t *r, int fd, char *buf)
+{
+	off_t pos = r->r_pos;
+	off_t off = r->r_off;
+	size_t left = r->r_len;
+
+	while (left > 0 && !__atomic_load_n(&x->x_no_cfr, __ATOMIC_RELAXED)) {
+		ssize_t n = copy_file_range(x->x_fs.fd, &pos, fd, &off, left,
+		    0);
+
+		if (n > 0) {
+			left -= n;
+		} else if (n == 0) {
+			return (EIO);	/* the image is truncated */
+		} else if (errno == EXDEV || errno == EINVAL ||
+		    errno == ENOSYS || errno == EOPNOTSUPP) {
+			__atomic_store_n(&x->x_no_cfr, 1, __ATOMIC_RELAXED);
+		} else if (errno != EINTR) {
+			return (errno);
+		}
+	}
+
+	while (left > 0) {
+		ssize_t n = pread(x->x_fs.fd, buf, MIN(left, EX_BUFSIZE), pos);
+		ssize_t w;
+
+		if (n == 0)
+			return (EIO);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno);
+		}
+		for (ssize_t done = 0; done < n; done += w) {
+			if ((w = pwrite(fd, buf + done, n - done,
+			    off + done)) < 0) {
+				if (errno != EINTR)
+					return (errno);
+				w = 0;
+			}
+		}
+		pos += n;
+		off += n;
+		left -= n;
+	}
+
+	return (0);
+}
+
+/*
+ * Copies chunks of runs in image order. Neighbouring runs often belong to
+ * the same file, the destination stays open until another file comes.
+ */
+static void *
+ex_worker(void *arg)
+{
+	ex_t *x = arg;
+	int64_t node = -1;
+	uint64_t bytes = 0;
+	char *buf;
+	int fd = -1;
+
+	if ((buf = malloc(EX_BUFSIZE)) == NULL) {
+		ex_error(x, x->x_dest, "worker", ENOMEM);
+		return (NULL);
+	}
+
+	for (;;) {
+		size_t first = __atomic_fetch_add(&x->x_next, EX_CHUNK,
+		    __ATOMIC_RELAXED);
+
+		if (first >= x->x_nruns)
+			break;
+		for (size_t k = first; k < MIN(first + EX_CHUNK, x->x_nruns);
+		    k++) {
+			const ex_run_t *r = &x->x_runs[k];
+			const char *path = x->x_nodes[r->r_node].n_path;
+			int err;
+
+			if (r->r_node != node) {
+				if (fd >= 0)
+					(void) close(fd);
+				node = r->r_node;
+				if ((fd = open(path, O_WRONLY)) < 0) {
+					ex_error(x, path, "open", errno);
+					continue;
+				}
+			}
+			if (fd < 0)
+				continue;
+			if ((err = ex_copy_run(x, r, fd, buf)) != 0)
+				ex_error(x, path, "copy", err);
+			else
+				bytes += r->r_len;
+		}
+	}
+	if (fd >= 0)
+		(void) close(fd);
+	free(buf);
+	__atomic_add_fetch(&x->x_bytes, bytes, __ATOMIC_RELAXED);
+
+	return (NULL);
+}
+
+static int
+ex_run_cmp(const void *a, const void *b)
+{
+	const ex_run_t *ra = a;
+	const ex_run_t *rb = b;
+
+	return (ra->r_pos < rb->r_pos ? -1 : ra->r_pos > rb->r_pos);
+}
+
+static void
+ex_set_attrs(ex_t *x, uint32_t node)
+{
+	ex_node_t *nd = &x->x_nodes[node];
+	const struct stat *st = &nd->n_inode->i_stat;
+	struct timespec ts[2];
+
+	if (nd->n_link != -1 || EFS_BAD_FILE(nd->n_inode))
+		return;
+
+	if (geteuid() == 0 && lchown(nd->n_path, st->st_uid, st->st_gid) != 0)
+		ex_error(x, nd->n_path, "chown", errno);
+	if (!S_ISLNK(st->st_mode) &&
+	    chmod(nd->n_path, st->st_mode & 07777) != 0)
+		ex_error(x, nd->n_path, "chmod", errno);
+	ts[0] = st->st_atim;
+	ts[1] = st->st_mtim;
+	if (utimensat(AT_FDCWD, nd->n_path, ts, AT_SYMLINK_NOFOLLOW) != 0)
+		ex_error(x, nd->n_path, "utimensat", errno);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <image> <directory>\n", prog);
+	fprintf(stderr, "\t-j <N>\tCopy with N threads (default: online "
+	    "CPUs)\n");
+	fprintf(stderr, "\t-p <N>\tPartition of the image\n");
+	fprintf(stderr, "\t-v\tPrint the paths as they are created\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static ex_t x;
+	pthread_t tids[EX_MAX_THREADS];
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t t0, t1;
+	int part = -1;
+	int c, err;
+
+	while ((c = getopt(argc, argv, "j:p:v")) != -1) {
+		switch (c) {
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'p':
+			part = atoi(optarg);
+			break;
+		case 'v':
+			x.x_verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return (2);
+		}
+	}
+	if (optind != argc - 2 || nthreads < 1) {
+		usage(argv[0]);
+		return (2);
+	}
+	nthreads = MIN(nthreads, EX_MAX_THREADS);
+	x.x_dest = argv[optind + 1];
+
+	if (efs_vol_open(&x.x_fs, argv[optind], part) != 0 ||
+	    efs_mount(&x.x_fs) != 0) {
+		fprintf(stderr, "%s: cannot open the image\n", argv[optind]);
+		return (1);
+	}
+	x.x_maxino = GET_I16(x.x_fs.sb.s_ncg) *
+	    GET_I16(x.x_fs.sb.s_cg_ino_bbs) * INOS_PER_BB;
+	if ((x.x_byino = calloc(x.x_maxino, sizeof (uint32_t))) == NULL) {
+		perror("calloc");
+		return (1);
+	}
+
+	t0 = efs_stats_now();
+	if ((err = ex_scan_inodes(&x)) != 0 || (err = ex_walk(&x)) != 0) {
+		fprintf(stderr, "%s: cannot scan the image: %s\n", argv[optind],
+		    strerror(err));
+		return (1);
+	}
+
+	for (uint32_t k = 0; k < x.x_nnodes; k++) {
+		if ((err = ex_create(&x, k)) == ENOMEM) {
+			fprintf(stderr, "out of memory\n");
+			return (1);
+		} else if (err != 0) {
+			ex_error(&x, x.x_nodes[k].n_path, "cannot create", err);
+			/* keep it from the attribute pass */
+			x.x_nodes[k].n_link = k;
+		}
+		if (k == 0 && err != 0)
+			return (1);
+	}
+
+	qsort(x.x_runs, x.x_nruns, sizeof (ex_run_t), ex_run_cmp);
+	nthreads = MIN(nthreads, (long)(x.x_nruns / EX_CHUNK) + 1);
+	for (long k = 0; k < nthreads; k++) {
+		if ((err = pthread_create(&tids[k], NULL, ex_worker, &x)) !=
+		    0) {
+			fprintf(stderr, "cannot start a thread: %s\n",
+			    strerror(err));
+			nthreads = k;
+			break;
+		}
+	}
+	for (long k = 0; k < nthreads; k++)
+		(void) pthread_join(tids[k], NULL);
+	if (nthreads == 0 && x.x_nruns > 0)
+		ex_worker(&x);
+
+	for (uint32_t k = x.x_nnodes; k > 0; k--)
+		ex_set_attrs(&x, k - 1);
+	t1 = efs_stats_now();
+
+	fprintf(stderr, "%u inodes, %u paths, %zu runs, %llu bytes in %.3f s "
+	    "(%.1f MB/s), %u errors\n", x.x_ninodes, x.x_nnodes, x.x_nruns,
+	    (unsigned long long)x.x_bytes, (t1 - t0) / 1e9,
+	    x.x_bytes / 1e6 / ((t1 - t0) / 1e9 + 1e-9), x.x_errors);
+
+	for (uint32_t k = 0; k < x.x_nnodes; k++)
+		free(x.x_nodes[k].n_path);
+	free(x.x_nodes);
+	free(x.x_runs);
+	free(x.x_byino);
+	efs_umount(&x.x_fs);
+	efs_vol_close(&x.x_fs);
+
+	return (x.x_errors != 0);
+}
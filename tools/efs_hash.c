@@ -0,0 +1,904 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Hashes every file of an EFS image and prints a manifest, or compares the
+ * image with a previous manifest:
+ *
+ *	efs-hash [-a sha256 | xxh64] [-j <N>] [-p <N>] [-c <manifest>] <image>
+ *
+ * The tree is walked first and the inodes are sorted by the position of
+ * their first extent. A pool of threads then takes them in that order, so
+ * the image is read roughly front to back while all threads hash. A file
+ * is read in chunks with efs_iread(); the next chunk is announced to the
+ * kernel before the current one is hashed. Files with several links are
+ * hashed once, symbolic links are hashed over their target.
+ *
+ * Each manifest line is "<hash> <size> <inode> <path>", sorted by path,
+ * after a "# efs-hash <algorithm>" header. Backslashes and newlines in
+ * paths are escaped. A comparison prints the changed, missing and added
+ * paths and exits with 1 if there are any.
+ */
+
+#define	_GNU_SOURCE	/* asprintf() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../utils.h"
+#include "../efs_fs.h"
+#include "../efs_vol.h"
+#include "../efs_file.h"
+#include "../efs_dir.h"
+#include "../efs_stats.h"
+
+#define	EH_CHUNK_BBS	2048		/* read and hashed at once */
+#define	EH_MAX_THREADS	64
+#define	EH_HASH_MAX	32		/* bytes of the longest digest */
+#define	EH_MAX_SEGS	64		/* readahead hints per chunk */
+
+#define	EH_BIT_TEST(m, i)	((m)[(i) / 8] & (1 << ((i) % 8)))
+#define	EH_BIT_SET(m, i)	((m)[(i) / 8] |= (1 << ((i) % 8)))
+
+/*
+ * SHA-256, FIPS 180-4
+ */
+typedef struct sha256 {
+	uint32_t s_h[8];
+	uint64_t s_len;
+	uint8_t	s_buf[64];
+	size_t	s_used;
+} sha256_t;
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define	ROR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+sha256_block(sha256_t *s, const uint8_t *p)
+{
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, h;
+
+	for (int i = 0; i < 16; i++)
+		w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+		    (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^
+		    (w[i - 15] >> 3);
+		uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^
+		    (w[i - 2] >> 10);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	a = s->s_h[0];
+	b = s->s_h[1];
+	c = s->s_h[2];
+	d = s->s_h[3];
+	e = s->s_h[4];
+	f = s->s_h[5];
+	g = s->s_h[6];
+	h = s->s_h[7];
+	for (int i = 0; i < 64; i++) {
+		uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) +
+		    ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) +
+		    ((a & b) ^ (a & c) ^ (b & c));
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	s->s_h[0] += a;
+	s->s_h[1] += b;
+	s->s_h[2] += c;
+	s->s_h[3] += d;
+	s->s_h[4] += e;
+	s->s_h[5] += f;
+	s->s_h[6] += g;
+	s->s_h[7] += h;
+}
+
+static void
+sha256_init(sha256_t *s)
+{
+	static const uint32_t h0[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(s->s_h, h0, sizeof (h0));
+	s->s_len = 0;
+	s->s_used = 0;
+}
+
+static void
+sha256_update(sha256_t *s, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	s->s_len += len;
+	if (s->s_used > 0) {
+		size_t n = MIN(len, 64 - s->s_used);
+
+		memcpy(s->s_buf + s->s_used, p, n);
+		s->s_used += n;
+		p += n;
+		len -= n;
+		if (s->s_used < 64)
+			return;
+		sha256_block(s, s->s_buf);
+		s->s_used = 0;
+	}
+	for (; len >= 64; p += 64, len -= 64)
+		sha256_block(s, p);
+	memcpy(s->s_buf, p, len);
+	s->s_used = len;
+}
+
+static void
+sha256_final(sha256_t *s, uint8_t *out)
+{
+	uint64_t bits = s->s_len * 8;
+	uint8_t pad[72] = { 0x80 };
+	size_t n = (s->s_used < 56 ? 56 : 120) - s->s_used;
+
+	for (int i = 0; i < 8; i++)
+		pad[n + i] = bits >> (56 - 8 * i);
+	sha256_update(s, pad, n + 8);
+	for (int i = 0; i < 8; i++) {
+		out[4 * i] = s->s_h[i] >> 24;
+		out[4 * i + 1] = s->s_h[i] >> 16;
+		out[4 * i + 2] = s->s_h[i] >> 8;
+		out[4 * i + 3] = s->s_h[i];
+	}
+}
+
+/*
+ * XXH64 with seed 0, see https://github.com/Cyan4973/xxHash
+ */
+#define	XXH_P1	11400714785074694791ULL
+#define	XXH_P2	14029467366897019727ULL
+#define	XXH_P3	1609587929392839161ULL
+#define	XXH_P4	9650029242287828579ULL
+#define	XXH_P5	2870177450012600261ULL
+
+#define	ROL64(x, n)	(((x) << (n)) | ((x) >> (64 - (n))))
+
+typedef struct xxh64 {
+	uint64_t x_v[4];
+	uint64_t x_len;
+	uint8_t	x_buf[32];
+	size_t	x_used;
+} xxh64_t;
+
+static uint64_t
+xxh64_le64(const uint8_t *p)
+{
+	uint64_t v = 0;
+
+	for (int i = 7; i >= 0; i--)
+		v = v << 8 | p[i];
+	return (v);
+}
+
+static uint64_t
+xxh64_round(uint64_t acc, uint64_t in)
+{
+	acc += in * XXH_P2;
+	acc = ROL64(acc, 31);
+	return (acc * XXH_P1);
+}
+
+static uint64_t
+xxh64_merge(uint64_t acc, uint64_t v)
+{
+	acc ^= xxh64_round(0, v);
+	return (acc * XXH_P1 + XXH_P4);
+}
+
+static void
+xxh64_init(xxh64_t *x)
+{
+	x->x_v[0] = XXH_P1 + XXH_P2;
+	x->x_v[1] = XXH_P2;
+	x->x_v[2] = 0;
+	x->x_v[3] = -XXH_P1;
+	x->x_len = 0;
+	x->x_used = 0;
+}
+
+static void
+xxh64_stripe(xxh64_t *x, const uint8_t *p)
+{
+	for (int i = 0; i < 4; i++)
+		x->x_v[i] = xxh64_round(x->x_v[i], xxh64_le64(p + 8 * i));
+}
+
+static void
+xxh64_update(xxh64_t *x, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	x->x_len += len;
+	if (x->x_used > 0) {
+		size_t n = MIN(len, 32 - x->x_used);
+
+		memcpy(x->x_buf + x->x_used, p, n);
+		x->x_used += n;
+		p += n;
+		len -= n;
+		if (x->x_used < 32)
+			return;
+		xxh64_stripe(x, x->x_buf);
+		x->x_used = 0;
+	}
+	for (; len >= 32; p += 32, len -= 32)
+		xxh64_stripe(x, p);
+	memcpy(x->x_buf, p, len);
+	x->x_used = len;
+}
+
+static void
+xxh64_final(xxh64_t *x, uint8_t *out)
+{
+	const uint8_t *p = x->x_buf;
+	size_t len = x->x_used;
+	uint64_t h;
+
+	if (x->x_len >= 32) {
+		h = ROL64(x->x_v[0], 1) + ROL64(x->x_v[1], 7) +
+		    ROL64(x->x_v[2], 12) + ROL64(x->x_v[3], 18);
+		for (int i = 0; i < 4; i++)
+			h = xxh64_merge(h, x->x_v[i]);
+	} else {
+		h = x->x_v[2] + XXH_P5;
+	}
+	h += x->x_len;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		h ^= xxh64_round(0, xxh64_le64(p));
+		h = ROL64(h, 27) * XXH_P1 + XXH_P4;
+	}
+	if (len >= 4) {
+		h ^= (uint64_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+		    (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24) * XXH_P1;
+		h = ROL64(h, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+		len -= 4;
+	}
+	for (; len > 0; p++, len--) {
+		h ^= *p * XXH_P5;
+		h = ROL64(h, 11) * XXH_P1;
+	}
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+
+	for (int i = 0; i < 8; i++)
+		out[i] = h >> (56 - 8 * i);
+}
+
+typedef enum eh_alg {
+	EH_SHA256,
+	EH_XXH64
+} eh_alg_t;
+
+typedef struct eh_ctx {
+	eh_alg_t	c_alg;
+	union {
+		sha256_t	c_sha;
+		xxh64_t		c_xxh;
+	} c_u;
+} eh_ctx_t;
+
+static const struct {
+	const char	*a_name;
+	size_t		a_len;
+} eh_algs[] = {
+	[EH_SHA256] = { "sha256", 32 },
+	[EH_XXH64] = { "xxh64", 8 }
+};
+
+static void
+eh_init(eh_ctx_t *c, eh_alg_t alg)
+{
+	c->c_alg = alg;
+	if (alg == EH_SHA256)
+		sha256_init(&c->c_u.c_sha);
+	else
+		xxh64_init(&c->c_u.c_xxh);
+}
+
+static void
+eh_update(eh_ctx_t *c, const void *data, size_t len)
+{
+	if (c->c_alg == EH_SHA256)
+		sha256_update(&c->c_u.c_sha, data, len);
+	else
+		xxh64_update(&c->c_u.c_xxh, data, len);
+}
+
+static void
+eh_final(eh_ctx_t *c, uint8_t *out)
+{
+	if (c->c_alg == EH_SHA256)
+		sha256_final(&c->c_u.c_sha, out);
+	else
+		xxh64_final(&c->c_u.c_xxh, out);
+}
+
+/* A hashed inode, shared by all its links */
+typedef struct eh_item {
+	efs_inode_t	*it_inode;
+	uint32_t	it_first;	/* first data block in the image */
+	int		it_err;
+	uint8_t		it_hash[EH_HASH_MAX];
+} eh_item_t;
+
+/* A path, or a line of a manifest */
+typedef struct eh_ent {
+	char		*e_path;
+	uint32_t	e_item;
+	uint32_t	e_ino;
+	int64_t		e_size;
+	char		e_hash[2 * EH_HASH_MAX + 1];
+} eh_ent_t;
+
+typedef struct eh {
+	efs_fs_t	h_fs;
+	eh_alg_t	h_alg;
+	eh_item_t	*h_items;
+	uint32_t	h_nitems;
+	uint32_t	h_maxitems;
+	eh_ent_t	*h_ents;
+	uint32_t	h_nents;
+	uint32_t	h_maxents;
+	uint32_t	*h_byino;	/* inode number -> item + 1 */
+	uint32_t	h_maxino;
+	uint32_t	h_next;		/* next item to hash */
+	uint64_t	h_bytes;
+} eh_t;
+
+static int
+eh_add_ent(eh_ent_t **ents, uint32_t *n, uint32_t *max, eh_ent_t *e)
+{
+	if (*n == *max) {
+		uint32_t m = MAX(*max * 2, 1024);
+		eh_ent_t *p = realloc(*ents, m * sizeof (eh_ent_t));
+
+		if (p == NULL)
+			return (ENOMEM);
+		*ents = p;
+		*max = m;
+	}
+	(*ents)[(*n)++] = *e;
+
+	return (0);
+}
+
+static int
+eh_add_path(eh_t *h, const char *path, efs_inode_t *inode)
+{
+	eh_ent_t e = { 0 };
+	uint32_t ino = inode->i_num;
+
+	if (ino >= h->h_maxino)
+		return (0);
+	if (h->h_byino[ino] == 0) {
+		eh_item_t *it;
+
+		if (h->h_nitems == h->h_maxitems) {
+			uint32_t m = MAX(h->h_maxitems * 2, 1024);
+
+			it = realloc(h->h_items, m * sizeof (eh_item_t));
+			if (it == NULL)
+				return (ENOMEM);
+			h->h_items = it;
+			h->h_maxitems = m;
+		}
+		it = &h->h_items[h->h_nitems];
+		it->it_inode = inode;
+		it->it_first = inode->i_nextents > 0 ?
+		    inode->i_extents[0].e_blk : 0;
+		it->it_err = 0;
+		h->h_byino[ino] = ++h->h_nitems;
+	}
+
+	if ((e.e_path = strdup(path)) == NULL)
+		return (ENOMEM);
+	e.e_item = h->h_byino[ino] - 1;
+	e.e_ino = ino;
+	e.e_size = inode->i_stat.st_size;
+
+	return (eh_add_ent(&h->h_ents, &h->h_nents, &h->h_maxents, &e));
+}
+
+typedef struct eh_dir {
+	char		*d_path;
+	efs_inode_t	*d_inode;
+} eh_dir_t;
+
+/*
+ * Walks the tree breadth first, directories are queued with their paths.
+ * A directory is queued only once, an entry leading back to one that was
+ * already seen (a loop on a damaged image) is reported and skipped.
+ */
+static int
+eh_walk(eh_t *h)
+{
+	eh_dir_t *dirs;
+	uint32_t ndirs = 1, maxdirs = 64;
+	uint8_t *seen;
+	efs_inode_t *root;
+	int err;
+
+	if ((err = efs_iget(&h->h_fs, FIRST_INO, &root)) != 0)
+		return (err);
+	if ((seen = calloc((h->h_maxino + 7) / 8, 1)) == NULL)
+		return (ENOMEM);
+	if ((dirs = malloc(maxdirs * sizeof (eh_dir_t))) == NULL ||
+	    (dirs[0].d_path = strdup("")) == NULL) {
+		free(dirs);
+		free(seen);
+		return (ENOMEM);
+	}
+	dirs[0].d_inode = root;
+	EH_BIT_SET(seen, FIRST_INO);
+
+	for (uint32_t d = 0; d < ndirs && err == 0; d++) {
+		const char *dpath = dirs[d].d_path;
+		efs_dir_snap_t *ds;
+
+		if (EFS_BAD_FILE(dirs[d].d_inode) ||
+		    efs_dir_snap_get(dirs[d].d_inode, &ds) != 0) {
+			fprintf(stderr, "%s/: cannot read directory\n", dpath);
+			continue;
+		}
+		for (uint32_t k = 0; k < ds->ds_nentries && err == 0; k++) {
+			const char *nm = DS_NAME(ds, k);
+			efs_inode_t *inode;
+			char *path;
+
+			if (strcmp(nm, ".") == 0 || strcmp(nm, "..") == 0)
+				continue;
+			if (efs_iget(&h->h_fs, ds->ds_entries[k].dse_ino,
+			    &inode) != 0 || EFS_BAD_FILE(inode)) {
+				fprintf(stderr, "%s/%s: bad inode %u\n", dpath,
+				    nm, ds->ds_entries[k].dse_ino);
+				continue;
+			}
+			if (asprintf(&path, "%s/%s", dpath, nm) < 0) {
+				err = ENOMEM;
+				break;
+			}
+			if (!IS_DIR(inode)) {
+				if (S_ISREG(inode->i_mode) ||
+				    S_ISLNK(inode->i_mode))
+					err = eh_add_path(h, path, inode);
+				free(path);
+				continue;
+			}
+			if (inode->i_num >= h->h_maxino ||
+			    EH_BIT_TEST(seen, inode->i_num)) {
+				fprintf(stderr, "%s: directory %u seen before, "
+				    "skipped\n", path, inode->i_num);
+				free(path);
+				continue;
+			}
+			EH_BIT_SET(seen, inode->i_num);
+			if (ndirs == maxdirs) {
+				eh_dir_t *p = realloc(dirs,
+				    2 * maxdirs * sizeof (eh_dir_t));
+
+				if (p == NULL) {
+					free(path);
+					err = ENOMEM;
+					break;
+				}
+				dirs = p;
+				maxdirs *= 2;
+			}
+			dirs[ndirs].d_path = path;
+			dirs[ndirs++].d_inode = inode;
+		}
+		efs_dir_snap_rele(ds);
+	}
+
+	for (uint32_t d = 0; d < ndirs; d++)
+		free(dirs[d].d_path);
+	free(dirs);
+	free(seen);
+
+	return (err);
+}
+
+/* Asks the kernel to read the data of blocks [blkno, blkno + nblks). */
+static void
+eh_readahead(efs_inode_t *inode, uint32_t blkno, uint32_t nblks)
+{
+	efs_seg_t segs[EH_MAX_SEGS];
+	int n;
+
+	n = efs_bmap(inode, (off_t)blkno * BBS, (size_t)nblks * BBS, NULL);
+	if (n <= 0 || n > EH_MAX_SEGS)
+		return;
+	(void) efs_bmap(inode, (off_t)blkno * BBS, (size_t)nblks * BBS, segs);
+	for (int i = 0; i < n; i++) {
+		if (segs[i].s_pos != EFS_SEG_HOLE)
+			(void) posix_fadvise(inode->i_fs->fd, segs[i].s_pos,
+			    segs[i].s_len, POSIX_FADV_WILLNEED);
+	}
+}
+
+static int
+eh_hash_item(eh_t *h, eh_item_t *it, char *buf)
+{
+	efs_inode_t *inode = it->it_inode;
+	uint64_t size = inode->i_stat.st_size;
+	uint32_t nblks = (size + BBS - 1) / BBS;
+	eh_ctx_t c;
+	int err;
+
+	eh_init(&c, h->h_alg);
+	if (S_ISLNK(inode->i_mode)) {
+		if ((err = efs_readlink(inode, buf, EH_CHUNK_BBS * BBS)) != 0)
+			return (err);
+		eh_update(&c, buf, strlen(buf));
+		eh_final(&c, it->it_hash);
+		return (0);
+	}
+
+	for (uint32_t b = 0; b < nblks; b += EH_CHUNK_BBS) {
+		uint32_t n = MIN(EH_CHUNK_BBS, nblks - b);
+
+		err = efs_iread(inode, b, n, buf);
+		if (err != 0 && err != ENXIO)
+			return (err);
+		if (b + n < nblks)
+			eh_readahead(inode, b + n, MIN(EH_CHUNK_BBS,
+			    nblks - b - n));
+		eh_update(&c, buf, MIN((uint64_t)n * BBS,
+		    size - (uint64_t)b * BBS));
+	}
+	eh_final(&c, it->it_hash);
+	__atomic_add_fetch(&h->h_bytes, size, __ATOMIC_RELAXED);
+
+	return (0);
+}
+
+static void *
+eh_worker(void *arg)
+{
+	eh_t *h = arg;
+	uint32_t k;
+	char *buf;
+
+	if ((buf = malloc(EH_CHUNK_BBS * BBS)) == NULL)
+		return (NULL);
+	while ((k = __atomic_fetch_add(&h->h_next, 1, __ATOMIC_RELAXED)) <
+	    h->h_nitems)
+		h->h_items[k].it_err = eh_hash_item(h, &h->h_items[k], buf);
+	free(buf);
+
+	return (NULL);
+}
+
+static int
+eh_item_cmp(const void *a, const void *b)
+{
+	const eh_item_t *x = a;
+	const eh_item_t *y = b;
+
+	return (x->it_first < y->it_first ? -1 : x->it_first > y->it_first);
+}
+
+static int
+eh_ent_cmp(const void *a, const void *b)
+{
+	return (strcmp(((const eh_ent_t *)a)->e_path,
+	    ((const eh_ent_t *)b)->e_path));
+}
+
+static void
+eh_print_path(FILE *f, const char *path)
+{
+	for (; *path != '\0'; path++) {
+		if (*path == '\\')
+			fputs("\\\\", f);
+		else if (*path == '\n')
+			fputs("\\n", f);
+		else
+			fputc(*path, f);
+	}
+}
+
+/*
+ * Reads a manifest, the paths are unescaped. Returns EINVAL if it was made
+ * with another algorithm or a line cannot be parsed.
+ */
+static int
+eh_load(eh_t *h, const char *file, eh_ent_t **ents, uint32_t *nents)
+{
+	char hdr[64];
+	char *line = NULL;
+	size_t linesz = 0;
+	uint32_t max = 0;
+	ssize_t len;
+	FILE *f;
+	int err = 0;
+
+	if ((f = fopen(file, "r")) == NULL)
+		return (errno);
+	(void) snprintf(hdr, sizeof (hdr), "# efs-hash %s\n",
+	    eh_algs[h->h_alg].a_name);
+	if ((len = getline(&line, &linesz, f)) < 0 || strcmp(line, hdr) != 0)
+		err = EINVAL;
+
+	while (err == 0 && (len = getline(&line, &linesz, f)) > 0) {
+		eh_ent_t e = { 0 };
+		long long size;
+		int pos;
+		char *p;
+
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (sscanf(line, "%64s %lld %u %n", e.e_hash, &size, &e.e_ino,
+		    &pos) != 3 || pos >= len) {
+			err = EINVAL;
+			break;
+		}
+		e.e_size = size;
+		if ((e.e_path = p = strdup(line + pos)) == NULL) {
+			err = ENOMEM;
+			break;
+		}
+		for (const char *s = line + pos; *s != '\0'; s++) {
+			if (*s == '\\' && s[1] == 'n')
+				*p++ = '\n', s++;
+			else if (*s == '\\' && s[1] == '\\')
+				*p++ = '\\', s++;
+			else
+				*p++ = *s;
+		}
+		*p = '\0';
+		if ((err = eh_add_ent(ents, nents, &max, &e)) != 0)
+			free(e.e_path);
+	}
+	free(line);
+	(void) fclose(f);
+
+	return (err);
+}
+
+static void
+eh_diff(const char *what, const eh_ent_t *e)
+{
+	printf("%s ", what);
+	eh_print_path(stdout, e->e_path);
+	printf("\n");
+}
+
+/*
+ * Merges the sorted old and new entries, returns the number of
+ * differences.
+ */
+static uint32_t
+eh_compare(eh_ent_t *old, uint32_t nold, eh_ent_t *cur, uint32_t ncur)
+{
+	uint32_t i = 0, j = 0, ndiff = 0;
+
+	qsort(old, nold, sizeof (eh_ent_t), eh_ent_cmp);
+	while (i < nold || j < ncur) {
+		int cmp = i == nold ? 1 : j == ncur ? -1 :
+		    strcmp(old[i].e_path, cur[j].e_path);
+
+		if (cmp < 0) {
+			eh_diff("missing", &old[i++]);
+		} else if (cmp > 0) {
+			eh_diff("added", &cur[j++]);
+		} else {
+			if (strcmp(old[i].e_hash, cur[j].e_hash) != 0 ||
+			    old[i].e_size != cur[j].e_size) {
+				eh_diff("changed", &cur[j]);
+			} else {
+				i++;
+				j++;
+				continue;
+			}
+			i++;
+			j++;
+		}
+		ndiff++;
+	}
+
+	return (ndiff);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <image>\n", prog);
+	fprintf(stderr, "\t-a <alg>\tsha256 (default) or xxh64\n");
+	fprintf(stderr, "\t-c <manifest>\tCompare with a manifest instead of "
+	    "printing one\n");
+	fprintf(stderr, "\t-j <N>\t\tHash with N threads (default: online "
+	    "CPUs)\n");
+	fprintf(stderr, "\t-p <N>\t\tPartition of the image\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static eh_t h;
+	pthread_t tids[EH_MAX_THREADS];
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *manifest = NULL;
+	eh_ent_t *old = NULL;
+	uint32_t nold = 0;
+	uint32_t nerr = 0, ndiff = 0;
+	uint64_t t0, t1;
+	int part = -1;
+	long n;
+	int c, err;
+
+	while ((c = getopt(argc, argv, "a:c:j:p:")) != -1) {
+		switch (c) {
+		case 'a':
+			if (strcmp(optarg, eh_algs[EH_SHA256].a_name) == 0)
+				h.h_alg = EH_SHA256;
+			else if (strcmp(optarg, eh_algs[EH_XXH64].a_name) == 0)
+				h.h_alg = EH_XXH64;
+			else
+				nthreads = 0;
+			break;
+		case 'c':
+			manifest = optarg;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'p':
+			part = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return (2);
+		}
+	}
+	if (optind != argc - 1 || nthreads < 1) {
+		usage(argv[0]);
+		return (2);
+	}
+	nthreads = MIN(nthreads, EH_MAX_THREADS);
+
+	if (manifest != NULL &&
+	    (err = eh_load(&h, manifest, &old, &nold)) != 0) {
+		fprintf(stderr, "%s: cannot read the %s manifest: %s\n",
+		    manifest, eh_algs[h.h_alg].a_name, strerror(err));
+		return (2);
+	}
+	if (efs_vol_open(&h.h_fs, argv[optind], part) != 0 ||
+	    efs_mount(&h.h_fs) != 0) {
+		fprintf(stderr, "%s: cannot open the image\n", argv[optind]);
+		return (2);
+	}
+	h.h_maxino = GET_I16(h.h_fs.sb.s_ncg) *
+	    GET_I16(h.h_fs.sb.s_cg_ino_bbs) * INOS_PER_BB;
+	if ((h.h_byino = calloc(h.h_maxino, sizeof (uint32_t))) == NULL) {
+		perror("calloc");
+		return (2);
+	}
+
+	t0 = efs_stats_now();
+	if ((err = eh_walk(&h)) != 0) {
+		fprintf(stderr, "%s: cannot scan the image: %s\n", argv[optind],
+		    strerror(err));
+		return (2);
+	}
+
+	/* The items move, the entries refer to them by inode number. */
+	qsort(h.h_items, h.h_nitems, sizeof (eh_item_t), eh_item_cmp);
+	for (uint32_t k = 0; k < h.h_nitems; k++)
+		h.h_byino[h.h_items[k].it_inode->i_num] = k + 1;
+
+	for (n = 0; n < MIN(nthreads, (long)h.h_nitems); n++) {
+		if (pthread_create(&tids[n], NULL, eh_worker, &h) != 0)
+			break;
+	}
+	if (n == 0)
+		(void) eh_worker(&h);
+	for (long k = 0; k < n; k++)
+		(void) pthread_join(tids[k], NULL);
+	t1 = efs_stats_now();
+
+	qsort(h.h_ents, h.h_nents, sizeof (eh_ent_t), eh_ent_cmp);
+	if (manifest == NULL)
+		printf("# efs-hash %s\n", eh_algs[h.h_alg].a_name);
+	for (uint32_t k = 0; k < h.h_nents; k++) {
+		eh_ent_t *e = &h.h_ents[k];
+		eh_item_t *it = &h.h_items[h.h_byino[e->e_ino] - 1];
+
+		if (it->it_err != 0) {
+			fprintf(stderr, "%s: %s\n", e->e_path,
+			    strerror(it->it_err));
+			nerr++;
+			(void) strcpy(e->e_hash, "-");
+			continue;
+		}
+		for (size_t i = 0; i < eh_algs[h.h_alg].a_len; i++)
+			(void) sprintf(e->e_hash + 2 * i, "%02x",
+			    it->it_hash[i]);
+		if (manifest == NULL) {
+			printf("%s %lld %u ", e->e_hash, (long long)e->e_size,
+			    e->e_ino);
+			eh_print_path(stdout, e->e_path);
+			printf("\n");
+		}
+	}
+	if (manifest != NULL)
+		ndiff = eh_compare(old, nold, h.h_ents, h.h_nents);
+
+	fprintf(stderr, "%u paths, %u files, %llu bytes in %.3f s (%.1f MB/s)"
+	    ", %u errors", h.h_nents, h.h_nitems,
+	    (unsigned long long)h.h_bytes, (t1 - t0) / 1e9,
+	    h.h_bytes / 1e6 / ((t1 - t0) / 1e9 + 1e-9), nerr);
+	if (manifest != NULL)
+		fprintf(stderr, ", %u differences", ndiff);
+	fprintf(stderr, "\n");
+
+	for (uint32_t k = 0; k < h.h_nents; k++)
+		free(h.h_ents[k].e_path);
+	for (uint32_t k = 0; k < nold; k++)
+		free(old[k].e_path);
+	free(h.h_ents);
+	free(old);
+	free(h.h_items);
+	free(h.h_byino);
+	efs_umount(&h.h_fs);
+	efs_vol_close(&h.h_fs);
+
+	return (nerr != 0 || ndiff != 0);
+}
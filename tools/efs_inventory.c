@@ -0,0 +1,758 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reports what an EFS image contains, read only:
+ *
+ *	efs-inventory [-J] [-n <N>] [-p <N>] <image>
+ *
+ * The inode tables of all cylinder groups are read sequentially and every
+ * allocated inode is decoded: its size, allocated blocks, extents, the
+ * physically contiguous runs they form and the holes between them. Then
+ * the directories are read once, in the order of their blocks, and each
+ * inode gets the name of its first link, which is enough to build any
+ * path by following the parents.
+ *
+ * The report has the file types, a size histogram, fragmentation
+ * statistics, the largest and the most fragmented files and the
+ * directories that use the most space, the N first of each list (10 by
+ * default). It is printed as text, or as one JSON object with -J.
+ */
+
+#define	_GNU_SOURCE	/* qsort_r() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../utils.h"
+#include "../efs_fs.h"
+#include "../efs_vol.h"
+#include "../efs_file.h"
+#include "../efs_dir.h"
+#include "../efs_stats.h"
+
+#define	IV_SCAN_BBS	256	/* inode table BBs read at once */
+#define	IV_IGET_BATCH	256
+#define	IV_MAX_DEPTH	256	/* longest parent chain, loops end here */
+#define	IV_PATH_MAX	4096
+
+typedef struct iv_node {
+	efs_inode_t	*n_inode;	/* NULL if the inode is free */
+	char		*n_name;	/* name of the first link */
+	uint32_t	n_parent;	/* directory of the first link, or 0 */
+	uint32_t	n_links;	/* directory entries */
+	uint32_t	n_runs;		/* physically contiguous runs */
+	uint32_t	n_holes;
+	uint32_t	n_hole_blks;
+	uint32_t	n_tfiles;	/* directories: inodes below */
+	uint64_t	n_tsize;	/* directories: bytes below */
+	uint64_t	n_talloc;	/* directories: allocated bytes below */
+} iv_node_t;
+
+/* File types, the last one takes the rest */
+static const struct {
+	mode_t		t_fmt;
+	const char	*t_name;
+} iv_types[] = {
+	{ S_IFREG, "file" },
+	{ S_IFDIR, "dir" },
+	{ S_IFLNK, "symlink" },
+	{ S_IFCHR, "chr" },
+	{ S_IFBLK, "blk" },
+	{ S_IFIFO, "fifo" },
+	{ S_IFSOCK, "socket" },
+	{ 0, "other" }
+};
+
+#define	IV_NTYPES	(sizeof (iv_types) / sizeof (iv_types[0]))
+#define	IV_TYPE_DIR	1
+
+/* Size histogram of regular files, by upper bound; 0 ends the list */
+static const struct {
+	uint64_t	s_max;
+	const char	*s_name;
+} iv_sizes[] = {
+	{ 1, "0" },
+	{ 512, "< 512" },
+	{ 4096, "< 4K" },
+	{ 32768, "< 32K" },
+	{ 262144, "< 256K" },
+	{ 2097152, "< 2M" },
+	{ 16777216, "< 16M" },
+	{ 134217728, "< 128M" },
+	{ 0, ">= 128M" }
+};
+
+#define	IV_NSIZES	(sizeof (iv_sizes) / sizeof (iv_sizes[0]))
+
+/* Runs histogram of files with data, by upper bound */
+static const struct {
+	uint32_t	r_max;
+	const char	*r_name;
+} iv_runs[] = {
+	{ 1, "1" },
+	{ 2, "2" },
+	{ 4, "3-4" },
+	{ 8, "5-8" },
+	{ 16, "9-16" },
+	{ 64, "17-64" },
+	{ 0, "> 64" }
+};
+
+#define	IV_NRUNS	(sizeof (iv_runs) / sizeof (iv_runs[0]))
+
+typedef struct iv_stat {
+	uint32_t	st_count;
+	uint64_t	st_size;
+	uint64_t	st_alloc;
+} iv_stat_t;
+
+typedef enum iv_key {
+	IV_KEY_SIZE,
+	IV_KEY_RUNS,
+	IV_KEY_TALLOC
+} iv_key_t;
+
+typedef struct iv_rank {
+	uint64_t	r_key;
+	uint32_t	r_ino;
+} iv_rank_t;
+
+typedef struct iv {
+	efs_fs_t	v_fs;
+	const char	*v_image;
+	int		v_part;
+	iv_node_t	*v_nodes;	/* indexed by inode number */
+	uint32_t	v_maxino;
+	uint32_t	*v_dirs;
+	uint32_t	v_ndirs;
+	uint32_t	v_ninodes;
+	uint32_t	v_nbad;		/* inodes that cannot be decoded */
+	uint32_t	v_nbaddirs;	/* directories that cannot be read */
+	uint32_t	v_ndangling;	/* entries of free inodes */
+	uint32_t	v_norphans;	/* allocated inodes without a name */
+	uint64_t	v_time;		/* scan time in ns */
+	iv_stat_t	v_types[IV_NTYPES];
+	iv_stat_t	v_sizes[IV_NSIZES];
+	uint32_t	v_runs[IV_NRUNS];
+	uint32_t	v_ndata;	/* files with allocated blocks */
+	uint64_t	v_nruns;
+	uint32_t	v_maxruns;
+	uint32_t	v_nholey;
+	uint64_t	v_hole_blks;
+	uint32_t	v_nindirect;
+} iv_t;
+
+/*
+ * Counts the physically contiguous runs of an inode and the holes in its
+ * logical block range, a sparse tail included.
+ */
+static void
+iv_extents(iv_node_t *nd)
+{
+	efs_inode_t *inode = nd->n_inode;
+	efs_extent_t *e = inode->i_extents;
+	uint32_t nblks = (inode->i_stat.st_size + BBS - 1) / BBS;
+	uint32_t next = 0;
+
+	for (int k = 0; k < inode->i_nextents; k++) {
+		if (k == 0 || e[k].e_blk != e[k - 1].e_blk + e[k - 1].e_len)
+			nd->n_runs++;
+		if (e[k].e_offset > next) {
+			nd->n_holes++;
+			nd->n_hole_blks += e[k].e_offset - next;
+		}
+		next = e[k].e_offset + e[k].e_len;
+	}
+	if (nblks > next) {
+		nd->n_holes++;
+		nd->n_hole_blks += nblks - next;
+	}
+}
+
+static void
+iv_add_inodes(iv_t *v, const uint32_t *inos, efs_inode_t **inodes, int n)
+{
+	for (int k = 0; k < n; k++) {
+		iv_node_t *nd = &v->v_nodes[inos[k]];
+
+		nd->n_inode = inodes[k];
+		if (EFS_BAD_FILE(inodes[k])) {
+			v->v_nbad++;
+			continue;
+		}
+		if (IS_DIR(inodes[k]))
+			v->v_dirs[v->v_ndirs++] = inos[k];
+		if (!S_ISLNK(inodes[k]->i_mode))
+			iv_extents(nd);
+	}
+}
+
+/*
+ * Reads the inode tables of all cylinder groups in order and decodes the
+ * allocated inodes.
+ */
+static int
+iv_scan_inodes(iv_t *v)
+{
+	efs_fs_t *fs = &v->v_fs;
+	int32_t ncg = GET_I16(fs->sb.s_ncg);
+	int32_t cgsize = GET_I32(fs->sb.s_cg_size);
+	int32_t firstcg = GET_I32(fs->sb.s_first_cg);
+	int32_t ino_bbs = GET_I16(fs->sb.s_cg_ino_bbs);
+	efs_inode_t *inodes[IV_IGET_BATCH];
+	uint32_t inos[IV_IGET_BATCH];
+	char *buf;
+	int n = 0;
+	int err = 0;
+
+	if ((buf = malloc(IV_SCAN_BBS * BBS)) == NULL)
+		return (ENOMEM);
+
+	for (int32_t cg = 0; cg < ncg && err == 0; cg++) {
+		for (int32_t bb = 0; bb < ino_bbs && err == 0;
+		    bb += IV_SCAN_BBS) {
+			int32_t nbbs = MIN(IV_SCAN_BBS, ino_bbs - bb);
+
+			err = efs_bread_bbs(fs, firstcg + cg * cgsize + bb, buf,
+			    nbbs);
+			for (int k = 0; k < nbbs * INOS_PER_BB && err == 0;
+			    k++) {
+				efs_od_inode_t *di = (efs_od_inode_t *)(buf +
+				    k * INO_SIZE);
+				uint32_t ino = (cg * ino_bbs + bb) *
+				    INOS_PER_BB + k;
+
+				if (ino < FIRST_INO || GET_U16(di->di_mode) ==
+				    0 || GET_I16(di->di_nlink) <= 0)
+					continue;
+				v->v_ninodes++;
+				inos[n++] = ino;
+				if (n < IV_IGET_BATCH)
+					continue;
+				if ((err = efs_iget_batch(fs, inos, n,
+				    inodes)) == 0)
+					iv_add_inodes(v, inos, inodes, n);
+				n = 0;
+			}
+		}
+	}
+	if (err == 0 && n > 0 &&
+	    (err = efs_iget_batch(fs, inos, n, inodes)) == 0)
+		iv_add_inodes(v, inos, inodes, n);
+	free(buf);
+
+	return (err);
+}
+
+static int
+iv_dir_cmp(const void *a, const void *b, void *arg)
+{
+	iv_node_t *nodes = arg;
+	efs_inode_t *x = nodes[*(const uint32_t *)a].n_inode;
+	efs_inode_t *y = nodes[*(const uint32_t *)b].n_inode;
+	uint32_t bx = x->i_nextents > 0 ? x->i_extents[0].e_blk : 0;
+	uint32_t by = y->i_nextents > 0 ? y->i_extents[0].e_blk : 0;
+
+	return (bx < by ? -1 : bx > by);
+}
+
+/*
+ * Reads every directory once, in the order of their first blocks, and
+ * names the inodes after their first link.
+ */
+static int
+iv_scan_dirs(iv_t *v)
+{
+	qsort_r(v->v_dirs, v->v_ndirs, sizeof (uint32_t), iv_dir_cmp,
+	    v->v_nodes);
+
+	for (uint32_t d = 0; d < v->v_ndirs; d++) {
+		uint32_t dino = v->v_dirs[d];
+		efs_dir_snap_t *ds;
+
+		if (efs_dir_snap_get(v->v_nodes[dino].n_inode, &ds) != 0) {
+			v->v_nbaddirs++;
+			continue;
+		}
+		for (uint32_t k = 0; k < ds->ds_nentries; k++) {
+			const char *nm = DS_NAME(ds, k);
+			uint32_t ino = ds->ds_entries[k].dse_ino;
+			iv_node_t *nd;
+
+			if (strcmp(nm, ".") == 0 || strcmp(nm, "..") == 0)
+				continue;
+			if (ino >= v->v_maxino ||
+			    v->v_nodes[ino].n_inode == NULL) {
+				v->v_ndangling++;
+				continue;
+			}
+			nd = &v->v_nodes[ino];
+			if (nd->n_links++ > 0 || ino == FIRST_INO)
+				continue;
+			if ((nd->n_name = strdup(nm)) == NULL) {
+				efs_dir_snap_rele(ds);
+				return (ENOMEM);
+			}
+			nd->n_parent = dino;
+		}
+		efs_dir_snap_rele(ds);
+	}
+
+	return (0);
+}
+
+/*
+ * Adds every inode to the statistics and to the totals of the directories
+ * above it.
+ */
+static void
+iv_account(iv_t *v)
+{
+	for (uint32_t ino = FIRST_INO; ino < v->v_maxino; ino++) {
+		iv_node_t *nd = &v->v_nodes[ino];
+		efs_inode_t *inode = nd->n_inode;
+		uint64_t size, alloc;
+		size_t t, s, r;
+		int depth;
+
+		if (inode == NULL || EFS_BAD_FILE(inode))
+			continue;
+		size = inode->i_stat.st_size;
+		alloc = (uint64_t)inode->i_nalloc_blks * BBS;
+
+		for (t = 0; t < IV_NTYPES - 1; t++) {
+			if ((inode->i_mode & S_IFMT) == iv_types[t].t_fmt)
+				break;
+		}
+		v->v_types[t].st_count++;
+		v->v_types[t].st_size += size;
+		v->v_types[t].st_alloc += alloc;
+
+		if (S_ISREG(inode->i_mode)) {
+			for (s = 0; s < IV_NSIZES - 1; s++) {
+				if (size < iv_sizes[s].s_max)
+					break;
+			}
+			v->v_sizes[s].st_count++;
+			v->v_sizes[s].st_size += size;
+			v->v_sizes[s].st_alloc += alloc;
+		}
+
+		if (nd->n_runs > 0) {
+			for (r = 0; r < IV_NRUNS - 1; r++) {
+				if (nd->n_runs <= iv_runs[r].r_max)
+					break;
+			}
+			v->v_runs[r]++;
+			v->v_ndata++;
+			v->v_nruns += nd->n_runs;
+			v->v_maxruns = MAX(v->v_maxruns, nd->n_runs);
+		}
+		if (nd->n_holes > 0 && !S_ISLNK(inode->i_mode)) {
+			v->v_nholey++;
+			v->v_hole_blks += nd->n_hole_blks;
+		}
+		if (inode->i_nextents > EFS_DIRECTEXTENTS)
+			v->v_nindirect++;
+
+		if (ino != FIRST_INO && nd->n_parent == 0)
+			v->v_norphans++;
+		depth = 0;
+		for (uint32_t p = IS_DIR(inode) ? ino : nd->n_parent;
+		    p != 0 && depth < IV_MAX_DEPTH;
+		    p = v->v_nodes[p].n_parent, depth++) {
+			v->v_nodes[p].n_tfiles++;
+			v->v_nodes[p].n_tsize += size;
+			v->v_nodes[p].n_talloc += alloc;
+		}
+	}
+}
+
+/*
+ * Builds the path of an inode from its parents. Paths that do not lead to
+ * the root start with "?<inode>".
+ */
+static const char *
+iv_path(iv_t *v, uint32_t ino, char *buf)
+{
+	const char *names[IV_MAX_DEPTH];
+	int depth = 0;
+	size_t len = 0;
+
+	if (ino == FIRST_INO)
+		return ("/");
+	for (; ino != FIRST_INO && depth < IV_MAX_DEPTH &&
+	    v->v_nodes[ino].n_parent != 0; ino = v->v_nodes[ino].n_parent)
+		names[depth++] = v->v_nodes[ino].n_name;
+
+	buf[0] = '\0';
+	if (ino != FIRST_INO)
+		len = snprintf(buf, IV_PATH_MAX, "?%u", ino);
+	while (depth > 0 && len < IV_PATH_MAX)
+		len += snprintf(buf + len, IV_PATH_MAX - len, "/%s",
+		    names[--depth]);
+
+	return (buf);
+}
+
+static void
+iv_json_str(const char *s)
+{
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static int
+iv_rank_cmp(const void *a, const void *b)
+{
+	const iv_rank_t *x = a;
+	const iv_rank_t *y = b;
+
+	if (x->r_key != y->r_key)
+		return (x->r_key > y->r_key ? -1 : 1);
+	return (x->r_ino < y->r_ino ? -1 : x->r_ino > y->r_ino);
+}
+
+/*
+ * Ranks the inodes of the given type by the key, the top n are returned.
+ */
+static uint32_t
+iv_top(iv_t *v, mode_t fmt, iv_key_t key, uint32_t n, iv_rank_t **top)
+{
+	iv_rank_t *r;
+	uint32_t nr = 0;
+
+	*top = NULL;
+	if ((r = malloc(MAX(v->v_ninodes, 1) * sizeof (iv_rank_t))) == NULL)
+		return (0);
+	for (uint32_t ino = FIRST_INO; ino < v->v_maxino; ino++) {
+		iv_node_t *nd = &v->v_nodes[ino];
+
+		if (nd->n_inode == NULL || EFS_BAD_FILE(nd->n_inode) ||
+		    (nd->n_inode->i_mode & S_IFMT) != fmt)
+			continue;
+		r[nr].r_ino = ino;
+		r[nr].r_key = key == IV_KEY_SIZE ? nd->n_inode->i_stat.st_size :
+		    key == IV_KEY_RUNS ? nd->n_runs : nd->n_talloc;
+		nr++;
+	}
+	qsort(r, nr, sizeof (iv_rank_t), iv_rank_cmp);
+	*top = r;
+
+	return (MIN(n, nr));
+}
+
+static void
+iv_print_text(iv_t *v, uint32_t ntop)
+{
+	efs_sb_t *sb = &v->v_fs.sb;
+	char path[IV_PATH_MAX];
+	iv_rank_t *top;
+	uint32_t n;
+
+	printf("Image:        %s", v->v_image);
+	if (v->v_part >= 0)
+		printf(" (partition %d)", v->v_part);
+	printf("\nFile system:  \"%.6s\" \"%.6s\", %d blocks, %d cylinder "
+	    "groups\n", sb->s_fname, sb->s_fpack, GET_I32(sb->s_size),
+	    GET_I16(sb->s_ncg));
+	printf("Inodes:       %u allocated of %u, %u bad, %u without a name"
+	    "\n", v->v_ninodes, v->v_maxino, v->v_nbad, v->v_norphans);
+	printf("Directories:  %u, %u unreadable, %u entries of free inodes\n",
+	    v->v_types[IV_TYPE_DIR].st_count, v->v_nbaddirs, v->v_ndangling);
+	printf("Free:         %d blocks, %d inodes\n",
+	    GET_I32(sb->s_blk_free), GET_I32(sb->s_ino_free));
+	printf("Scanned in:   %.3f s\n", v->v_time / 1e9);
+
+	printf("\n%-12s %10s %14s %14s\n", "Type", "Count", "Size",
+	    "Allocated");
+	for (size_t t = 0; t < IV_NTYPES; t++) {
+		iv_stat_t *st = &v->v_types[t];
+
+		if (st->st_count > 0)
+			printf("%-12s %10u %14llu %14llu\n", iv_types[t].t_name,
+			    st->st_count, (unsigned long long)st->st_size,
+			    (unsigned long long)st->st_alloc);
+	}
+
+	printf("\n%-12s %10s %14s %14s\n", "File size", "Count", "Size",
+	    "Allocated");
+	for (size_t s = 0; s < IV_NSIZES; s++) {
+		iv_stat_t *st = &v->v_sizes[s];
+
+		printf("%-12s %10u %14llu %14llu\n", iv_sizes[s].s_name,
+		    st->st_count, (unsigned long long)st->st_size,
+		    (unsigned long long)st->st_alloc);
+	}
+
+	printf("\nFragmentation\n");
+	printf("  files with data   %u, %u contiguous\n", v->v_ndata,
+	    v->v_runs[0]);
+	printf("  runs per file     %.2f average, %u max\n",
+	    v->v_ndata > 0 ? (double)v->v_nruns / v->v_ndata : 0.0,
+	    v->v_maxruns);
+	printf("  sparse files      %u, %llu hole blocks\n", v->v_nholey,
+	    (unsigned long long)v->v_hole_blks);
+	printf("  indirect extents  %u files\n", v->v_nindirect);
+	printf("\n%-12s %10s\n", "Runs", "Files");
+	for (size_t r = 0; r < IV_NRUNS; r++)
+		printf("%-12s %10u\n", iv_runs[r].r_name, v->v_runs[r]);
+
+	n = iv_top(v, S_IFREG, IV_KEY_SIZE, ntop, &top);
+	printf("\nLargest files\n%14s %14s %6s  %s\n", "Size", "Allocated",
+	    "Runs", "Path");
+	for (uint32_t k = 0; k < n; k++) {
+		iv_node_t *nd = &v->v_nodes[top[k].r_ino];
+
+		printf("%14llu %14llu %6u  %s\n", (unsigned long long)
+		    nd->n_inode->i_stat.st_size, (unsigned long long)
+		    nd->n_inode->i_nalloc_blks * BBS, nd->n_runs,
+		    iv_path(v, top[k].r_ino, path));
+	}
+	free(top);
+
+	n = iv_top(v, S_IFREG, IV_KEY_RUNS, ntop, &top);
+	printf("\nMost fragmented files\n%6s %14s  %s\n", "Runs", "Size",
+	    "Path");
+	for (uint32_t k = 0; k < n && top[k].r_key > 1; k++) {
+		iv_node_t *nd = &v->v_nodes[top[k].r_ino];
+
+		printf("%6u %14llu  %s\n", nd->n_runs, (unsigned long long)
+		    nd->n_inode->i_stat.st_size, iv_path(v, top[k].r_ino,
+		    path));
+	}
+	free(top);
+
+	n = iv_top(v, S_IFDIR, IV_KEY_TALLOC, ntop, &top);
+	printf("\nDirectories by usage\n%14s %14s %10s  %s\n", "Allocated",
+	    "Size", "Inodes", "Path");
+	for (uint32_t k = 0; k < n; k++) {
+		iv_node_t *nd = &v->v_nodes[top[k].r_ino];
+
+		printf("%14llu %14llu %10u  %s\n", (unsigned long long)
+		    nd->n_talloc, (unsigned long long)nd->n_tsize,
+		    nd->n_tfiles, iv_path(v, top[k].r_ino, path));
+	}
+	free(top);
+}
+
+static void
+iv_print_json(iv_t *v, uint32_t ntop)
+{
+	efs_sb_t *sb = &v->v_fs.sb;
+	char path[IV_PATH_MAX];
+	char name[7];
+	iv_rank_t *top;
+	uint32_t n;
+
+	printf("{\n  \"image\": ");
+	iv_json_str(v->v_image);
+	printf(",\n  \"partition\": %d,\n  \"fname\": ", v->v_part);
+	(void) snprintf(name, sizeof (name), "%.6s", sb->s_fname);
+	iv_json_str(name);
+	printf(",\n  \"fpack\": ");
+	(void) snprintf(name, sizeof (name), "%.6s", sb->s_fpack);
+	iv_json_str(name);
+	printf(",\n  \"blocks\": %d,\n  \"cylinder_groups\": %d,\n",
+	    GET_I32(sb->s_size), GET_I16(sb->s_ncg));
+	printf("  \"free_blocks\": %d,\n  \"free_inodes\": %d,\n",
+	    GET_I32(sb->s_blk_free), GET_I32(sb->s_ino_free));
+	printf("  \"inodes\": %u,\n  \"max_inodes\": %u,\n  \"bad_inodes\": %u,"
+	    "\n  \"unnamed_inodes\": %u,\n", v->v_ninodes, v->v_maxino,
+	    v->v_nbad, v->v_norphans);
+	printf("  \"unreadable_dirs\": %u,\n  \"dangling_entries\": %u,\n",
+	    v->v_nbaddirs, v->v_ndangling);
+	printf("  \"scan_seconds\": %.3f,\n", v->v_time / 1e9);
+
+	printf("  \"types\": {");
+	for (size_t t = 0; t < IV_NTYPES; t++) {
+		iv_stat_t *st = &v->v_types[t];
+
+		printf("%s\n    \"%s\": { \"count\": %u, \"size\": %llu, "
+		    "\"allocated\": %llu }", t == 0 ? "" : ",",
+		    iv_types[t].t_name, st->st_count,
+		    (unsigned long long)st->st_size,
+		    (unsigned long long)st->st_alloc);
+	}
+
+	printf("\n  },\n  \"file_sizes\": [");
+	for (size_t s = 0; s < IV_NSIZES; s++) {
+		iv_stat_t *st = &v->v_sizes[s];
+
+		printf("%s\n    { \"below\": ", s == 0 ? "" : ",");
+		if (iv_sizes[s].s_max != 0)
+			printf("%llu", (unsigned long long)iv_sizes[s].s_max);
+		else
+			printf("null");
+		printf(", \"count\": %u, \"size\": %llu, \"allocated\": %llu }",
+		    st->st_count, (unsigned long long)st->st_size,
+		    (unsigned long long)st->st_alloc);
+	}
+
+	printf("\n  ],\n  \"fragmentation\": {\n");
+	printf("    \"files_with_data\": %u,\n    \"runs\": %llu,\n",
+	    v->v_ndata, (unsigned long long)v->v_nruns);
+	printf("    \"max_runs\": %u,\n    \"sparse_files\": %u,\n",
+	    v->v_maxruns, v->v_nholey);
+	printf("    \"hole_blocks\": %llu,\n    \"indirect_files\": %u,\n",
+	    (unsigned long long)v->v_hole_blks, v->v_nindirect);
+	printf("    \"runs_histogram\": [");
+	for (size_t r = 0; r < IV_NRUNS; r++) {
+		printf("%s\n      { \"max\": ", r == 0 ? "" : ",");
+		if (iv_runs[r].r_max != 0)
+			printf("%u", iv_runs[r].r_max);
+		else
+			printf("null");
+		printf(", \"files\": %u }", v->v_runs[r]);
+	}
+	printf("\n    ]\n  },\n");
+
+	n = iv_top(v, S_IFREG, IV_KEY_SIZE, ntop, &top);
+	printf("  \"largest_files\": [");
+	for (uint32_t k = 0; k < n; k++) {
+		iv_node_t *nd = &v->v_nodes[top[k].r_ino];
+
+		printf("%s\n    { \"path\": ", k == 0 ? "" : ",");
+		iv_json_str(iv_path(v, top[k].r_ino, path));
+		printf(", \"inode\": %u, \"size\": %llu, \"allocated\": %llu, "
+		    "\"runs\": %u }", top[k].r_ino, (unsigned long long)
+		    nd->n_inode->i_stat.st_size, (unsigned long long)
+		    nd->n_inode->i_nalloc_blks * BBS, nd->n_runs);
+	}
+	free(top);
+
+	n = iv_top(v, S_IFREG, IV_KEY_RUNS, ntop, &top);
+	printf("\n  ],\n  \"most_fragmented\": [");
+	for (uint32_t k = 0; k < n && top[k].r_key > 1; k++) {
+		iv_node_t *nd = &v->v_nodes[top[k].r_ino];
+
+		printf("%s\n    { \"path\": ", k == 0 ? "" : ",");
+		iv_json_str(iv_path(v, top[k].r_ino, path));
+		printf(", \"inode\": %u, \"size\": %llu, \"runs\": %u, "
+		    "\"holes\": %u }", top[k].r_ino, (unsigned long long)
+		    nd->n_inode->i_stat.st_size, nd->n_runs, nd->n_holes);
+	}
+	free(top);
+
+	n = iv_top(v, S_IFDIR, IV_KEY_TALLOC, ntop, &top);
+	printf("\n  ],\n  \"directories\": [");
+	for (uint32_t k = 0; k < n; k++) {
+		iv_node_t *nd = &v->v_nodes[top[k].r_ino];
+
+		printf("%s\n    { \"path\": ", k == 0 ? "" : ",");
+		iv_json_str(iv_path(v, top[k].r_ino, path));
+		printf(", \"inode\": %u, \"allocated\": %llu, \"size\": %llu, "
+		    "\"inodes\": %u }", top[k].r_ino,
+		    (unsigned long long)nd->n_talloc,
+		    (unsigned long long)nd->n_tsize, nd->n_tfiles);
+	}
+	free(top);
+	printf("\n  ]\n}\n");
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-J] [-n <N>] [-p <N>] <image>\n", prog);
+	fprintf(stderr, "\t-J\tPrint the report as JSON\n");
+	fprintf(stderr, "\t-n <N>\tLength of the top lists (default: 10)\n");
+	fprintf(stderr, "\t-p <N>\tPartition of the image\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static iv_t v;
+	uint32_t ntop = 10;
+	uint64_t t0;
+	int json = 0;
+	int c, err;
+
+	v.v_part = -1;
+	while ((c = getopt(argc, argv, "Jn:p:")) != -1) {
+		switch (c) {
+		case 'J':
+			json = 1;
+			break;
+		case 'n':
+			ntop = atoi(optarg);
+			break;
+		case 'p':
+			v.v_part = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return (2);
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return (2);
+	}
+	v.v_image = argv[optind];
+
+	if (efs_vol_open(&v.v_fs, v.v_image, v.v_part) != 0 ||
+	    efs_mount(&v.v_fs) != 0) {
+		fprintf(stderr, "%s: cannot open the image\n", v.v_image);
+		return (2);
+	}
+	v.v_maxino = GET_I16(v.v_fs.sb.s_ncg) *
+	    GET_I16(v.v_fs.sb.s_cg_ino_bbs) * INOS_PER_BB;
+	if ((v.v_nodes = calloc(v.v_maxino, sizeof (iv_node_t))) == NULL ||
+	    (v.v_dirs = malloc(v.v_maxino * sizeof (uint32_t))) == NULL) {
+		perror("calloc");
+		return (2);
+	}
+
+	t0 = efs_stats_now();
+	if ((err = iv_scan_inodes(&v)) != 0 || (err = iv_scan_dirs(&v)) != 0) {
+		fprintf(stderr, "%s: cannot scan the image: %s\n", v.v_image,
+		    strerror(err));
+		return (2);
+	}
+	iv_account(&v);
+	v.v_time = efs_stats_now() - t0;
+
+	if (json)
+		iv_print_json(&v, ntop);
+	else
+		iv_print_text(&v, ntop);
+
+	for (uint32_t ino = 0; ino < v.v_maxino; ino++)
+		free(v.v_nodes[ino].n_name);
+	free(v.v_nodes);
+	free(v.v_dirs);
+	efs_umount(&v.v_fs);
+	efs_vol_close(&v.v_fs);
+
+	return (0);
+}
@@ -0,0 +1,291 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Lists directories of an EFS image like ls(1), without mounting it:
+ *
+ *	efs-ls [-alR] [-p <N>] <image> [path ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../libefs.h"
+
+typedef struct ls_ent {
+	char	*le_name;
+	struct stat le_st;
+} ls_ent_t;
+
+typedef struct ls_dir {
+	ls_ent_t *ld_ents;
+	size_t	ld_n;
+	size_t	ld_max;
+	int	ld_all;
+	int	ld_err;
+} ls_dir_t;
+
+static int opt_all, opt_long, opt_recurse;
+
+static int
+ls_collect(const char *name, const struct stat *st, void *arg)
+{
+	ls_dir_t *d = arg;
+
+	if (!d->ld_all && name[0] == '.')
+		return (0);
+	if (d->ld_n == d->ld_max) {
+		size_t max = d->ld_max == 0 ? 64 : d->ld_max * 2;
+		ls_ent_t *e = realloc(d->ld_ents, max * sizeof (ls_ent_t));
+
+		if (e == NULL) {
+			d->ld_err = ENOMEM;
+			return (1);
+		}
+		d->ld_ents = e;
+		d->ld_max = max;
+	}
+	if ((d->ld_ents[d->ld_n].le_name = strdup(name)) == NULL) {
+		d->ld_err = ENOMEM;
+		return (1);
+	}
+	d->ld_ents[d->ld_n++].le_st = *st;
+
+	return (0);
+}
+
+static int
+ls_cmp(const void *a, const void *b)
+{
+	return (strcmp(((const ls_ent_t *)a)->le_name,
+	    ((const ls_ent_t *)b)->le_name));
+}
+
+static void
+ls_mode(mode_t mode, char *s)
+{
+	const char *rwx = "rwxrwxrwx";
+
+	switch (mode & S_IFMT) {
+	case S_IFDIR:
+		s[0] = 'd';
+		break;
+	case S_IFLNK:
+		s[0] = 'l';
+		break;
+	case S_IFCHR:
+		s[0] = 'c';
+		break;
+	case S_IFBLK:
+		s[0] = 'b';
+		break;
+	case S_IFIFO:
+		s[0] = 'p';
+		break;
+	case S_IFSOCK:
+		s[0] = 's';
+		break;
+	default:
+		s[0] = '-';
+	}
+	for (int k = 0; k < 9; k++)
+		s[k + 1] = (mode & (0400 >> k)) ? rwx[k] : '-';
+	if (mode & S_ISUID)
+		s[3] = (mode & S_IXUSR) ? 's' : 'S';
+	if (mode & S_ISGID)
+		s[6] = (mode & S_IXGRP) ? 's' : 'S';
+	if (mode & S_ISVTX)
+		s[9] = (mode & S_IXOTH) ? 't' : 'T';
+	s[10] = '\0';
+}
+
+static void
+ls_print(efs_ctx_t *ctx, const char *path, const char *name,
+    const struct stat *st)
+{
+	char target[PATH_MAX];
+	char mode[11];
+	char date[32];
+	struct tm tm;
+
+	if (!opt_long) {
+		printf("%s\n", name);
+		return;
+	}
+
+	ls_mode(st->st_mode, mode);
+	(void) strftime(date, sizeof (date), "%Y-%m-%d %H:%M",
+	    gmtime_r(&st->st_mtime, &tm));
+	printf("%s %3lu %5u %5u %10lld %s %s", mode,
+	    (unsigned long)st->st_nlink, (unsigned)st->st_uid,
+	    (unsigned)st->st_gid, (long long)st->st_size, date, name);
+	if (S_ISLNK(st->st_mode) &&
+	    efs_ctx_readlink(ctx, path, target, sizeof (target)) == 0)
+		printf(" -> %s", target);
+	printf("\n");
+}
+
+static char *
+ls_join(const char *dir, const char *name)
+{
+	size_t len = strlen(dir);
+	char *p;
+
+	if ((p = malloc(len + strlen(name) + 2)) == NULL)
+		return (NULL);
+	(void) sprintf(p, "%s%s%s", dir, dir[len - 1] == '/' ? "" : "/",
+	    name);
+
+	return (p);
+}
+
+static int
+ls_dir(efs_ctx_t *ctx, const char *path, int header)
+{
+	ls_dir_t d = { .ld_all = opt_all };
+	int err;
+
+	if ((err = efs_ctx_readdir(ctx, path, ls_collect, &d)) == 0)
+		err = d.ld_err;
+	if (err != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(err));
+		goto out;
+	}
+	qsort(d.ld_ents, d.ld_n, sizeof (ls_ent_t), ls_cmp);
+
+	if (header)
+		printf("%s:\n", path);
+	for (size_t k = 0; k < d.ld_n; k++) {
+		char *p = ls_join(path, d.ld_ents[k].le_name);
+
+		if (p == NULL) {
+			err = ENOMEM;
+			goto out;
+		}
+		ls_print(ctx, p, d.ld_ents[k].le_name, &d.ld_ents[k].le_st);
+		free(p);
+	}
+
+	for (size_t k = 0; opt_recurse && k < d.ld_n; k++) {
+		const char *nm = d.ld_ents[k].le_name;
+		char *p;
+
+		if (!S_ISDIR(d.ld_ents[k].le_st.st_mode) ||
+		    strcmp(nm, ".") == 0 || strcmp(nm, "..") == 0)
+			continue;
+		if ((p = ls_join(path, nm)) == NULL) {
+			err = ENOMEM;
+			goto out;
+		}
+		printf("\n");
+		if (ls_dir(ctx, p, 1) != 0)
+			err = EIO;
+		free(p);
+	}
+
+out:
+	for (size_t k = 0; k < d.ld_n; k++)
+		free(d.ld_ents[k].le_name);
+	free(d.ld_ents);
+
+	return (err);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <image> [path ...]\n", prog);
+	fprintf(stderr, "\t-a\tInclude entries starting with a dot\n");
+	fprintf(stderr, "\t-l\tLong listing\n");
+	fprintf(stderr, "\t-R\tList subdirectories recursively\n");
+	fprintf(stderr, "\t-p <N>\tPartition of the image\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static char *root[] = { "/" };
+	char **paths = root;
+	efs_ctx_t *ctx;
+	int part = -1;
+	int npaths = 1;
+	int rc = 0;
+	int c, err;
+
+	while ((c = getopt(argc, argv, "alRp:")) != -1) {
+		switch (c) {
+		case 'a':
+			opt_all = 1;
+			break;
+		case 'l':
+			opt_long = 1;
+			break;
+		case 'R':
+			opt_recurse = 1;
+			break;
+		case 'p':
+			part = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return (2);
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return (2);
+	}
+	if (optind + 1 < argc) {
+		paths = &argv[optind + 1];
+		npaths = argc - optind - 1;
+	}
+
+	if ((err = efs_ctx_open(argv[optind], part, 0, &ctx)) != 0) {
+		fprintf(stderr, "%s: cannot open the image: %s\n", argv[optind],
+		    strerror(err));
+		return (1);
+	}
+
+	for (int k = 0; k < npaths; k++) {
+		struct stat st;
+
+		if ((err = efs_ctx_stat(ctx, paths[k], &st)) != 0) {
+			fprintf(stderr, "%s: %s\n", paths[k], strerror(err));
+			rc = 1;
+		} else if (!S_ISDIR(st.st_mode)) {
+			ls_print(ctx, paths[k], paths[k], &st);
+		} else {
+			if (k > 0)
+				printf("\n");
+			if (ls_dir(ctx, paths[k], npaths > 1 || opt_recurse)
+			    != 0)
+				rc = 1;
+		}
+	}
+
+	efs_ctx_close(ctx);
+
+	return (rc);
+}
@@ -0,0 +1,665 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Writes a synthetic EFS image for benchmarks and tests. The tree is a
+ * complete directory hierarchy of the given fan-out and depth with the
+ * files spread evenly over all its directories. File sizes are log-uniform
+ * between the given bounds, extents are capped at a given length (files
+ * with more than EFS_DIRECTEXTENTS of them get indirect extents) and some
+ * files may have every third block unallocated. The same seed gives the
+ * same image. The free block bitmap follows the last cylinder group, as
+ * on file systems with EFS_NEWMAGIC.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "../utils.h"
+#include "../efs_fs.h"
+#include "../efs_file.h"
+#include "../efs_dir.h"
+#include "../efs_vol.h"
+
+#define	MK_PART_START	16		/* BBs before the EFS partition */
+#define	MK_PART		7		/* partition number of the EFS */
+#define	MK_EXT_MAX	248		/* longest extent in BBs */
+#define	MK_MAX_BBS	(1U << 24)	/* extents address 24 bits of BBs */
+#define	MK_TIME		946684800	/* 2000-01-01 */
+
+typedef struct mk {
+	/* parameters */
+	uint32_t m_files;
+	uint32_t m_fanout;
+	uint32_t m_depth;
+	uint32_t m_size_min;
+	uint32_t m_size_max;
+	uint32_t m_ext_max;
+	uint32_t m_hole_pct;
+	uint32_t m_cg_size;
+	uint64_t m_seed;
+
+	/* layout */
+	int m_fd;			/* -1 for a dry run */
+	uint64_t m_rng;
+	uint32_t m_ndirs;
+	uint32_t m_dirno;		/* directories created so far */
+	uint32_t m_next_ino;
+	uint32_t m_ncg;
+	uint32_t m_ino_bbs;		/* inode BBs per CG */
+	uint32_t m_cg;			/* CG being allocated from */
+	uint32_t m_next_bb;		/* next free BB in m_cg */
+	uint64_t m_data_bbs;		/* BBs allocated */
+	int m_err;
+} mk_t;
+
+typedef struct mk_dirent {
+	uint32_t d_ino;
+	char d_name[16];
+} mk_dirent_t;
+
+static uint64_t
+mk_rand(mk_t *m)
+{
+	m->m_rng ^= m->m_rng >> 12;
+	m->m_rng ^= m->m_rng << 25;
+	m->m_rng ^= m->m_rng >> 27;
+	return (m->m_rng * 0x2545f4914f6cdd1dULL);
+}
+
+static uint32_t
+mk_rand_range(mk_t *m, uint32_t lo, uint32_t hi)
+{
+	return (lo + mk_rand(m) % ((uint64_t)hi - lo + 1));
+}
+
+/* Log-uniform: pick a bit length first, then a value of that length. */
+static uint32_t
+mk_file_size(mk_t *m)
+{
+	int lo = m->m_size_min == 0 ? 0 : 32 - __builtin_clz(m->m_size_min);
+	int hi = m->m_size_max == 0 ? 0 : 32 - __builtin_clz(m->m_size_max);
+	int bits = mk_rand_range(m, lo, hi);
+	uint32_t from = bits == 0 ? 0 : 1U << (bits - 1);
+	uint32_t to = bits == 0 ? 0 : (uint32_t)((1ULL << bits) - 1);
+
+	return (mk_rand_range(m, MAX(from, m->m_size_min),
+	    MIN(to, m->m_size_max)));
+}
+
+static void
+mk_write(mk_t *m, uint64_t bb, const void *buf, size_t len)
+{
+	if (m->m_fd == -1 || m->m_err != 0)
+		return;
+	if (pwrite(m->m_fd, buf, len, (MK_PART_START + bb) * BBS) !=
+	    (ssize_t)len)
+		m->m_err = errno != 0 ? errno : EIO;
+}
+
+/*
+ * Allocates up to want contiguous BBs, never across a CG boundary.
+ */
+static uint32_t
+mk_alloc(mk_t *m, uint32_t want, uint32_t *got)
+{
+	uint32_t first_cg = 2 * MK_PART_START;	/* leave room for the sb */
+	uint32_t cg_end;
+	uint32_t bb;
+
+	for (;;) {
+		cg_end = first_cg + (m->m_cg + 1) * m->m_cg_size;
+		if (m->m_next_bb < cg_end)
+			break;
+		m->m_cg++;
+		m->m_next_bb = first_cg + m->m_cg * m->m_cg_size +
+		    m->m_ino_bbs;
+	}
+	bb = m->m_next_bb;
+	*got = MIN(want, cg_end - bb);
+	m->m_next_bb += *got;
+	m->m_data_bbs += *got;
+
+	return (bb);
+}
+
+static void
+mk_put_inode(mk_t *m, uint32_t ino, efs_od_inode_t *di)
+{
+	uint32_t inos_per_cg = m->m_ino_bbs * INOS_PER_BB;
+	uint32_t cg = ino / inos_per_cg;
+	uint32_t bb = 2 * MK_PART_START + cg * m->m_cg_size +
+	    (ino % inos_per_cg) / INOS_PER_BB;
+
+	if (m->m_fd == -1 || m->m_err != 0)
+		return;
+	if (pwrite(m->m_fd, di, sizeof (*di), (MK_PART_START + bb) * BBS +
+	    (ino % INOS_PER_BB) * INO_SIZE) != sizeof (*di))
+		m->m_err = errno != 0 ? errno : EIO;
+}
+
+static void
+mk_inode_init(efs_od_inode_t *di, mode_t mode, int nlink, uint32_t size,
+    uint32_t ino)
+{
+	memset(di, 0, sizeof (*di));
+	di->di_mode = htons(mode);
+	di->di_nlink = htons(nlink);
+	di->di_uid = htons(100);
+	di->di_gid = htons(20);
+	di->di_size = htonl(size);
+	di->di_atime = htonl(MK_TIME);
+	di->di_mtime = htonl(MK_TIME);
+	di->di_ctime = htonl(MK_TIME);
+	di->di_gen = htonl(ino);
+}
+
+/*
+ * Allocates extents of at most maxlen BBs for nbbs BBs starting at file
+ * block off and appends them to ext. The data, if any, is written there.
+ */
+static void
+mk_extents(mk_t *m, uint32_t off, uint32_t nbbs, uint32_t maxlen,
+    const char *data, efs_od_extent_t **ext, uint32_t *next, uint32_t *cap)
+{
+	while (nbbs > 0) {
+		uint32_t len;
+		uint32_t bb = mk_alloc(m, MIN(nbbs, maxlen), &len);
+
+		if (*next == *cap) {
+			efs_od_extent_t *n;
+
+			*cap = MAX(*cap * 2, 16);
+			if ((n = realloc(*ext, *cap * sizeof (**ext))) == NULL) {
+				m->m_err = ENOMEM;
+				return;
+			}
+			*ext = n;
+		}
+		(*ext)[*next].ext1 = htonl(bb);
+		(*ext)[*next].ext2 = htonl(len << 24 | off);
+		(*next)++;
+		if (data != NULL) {
+			mk_write(m, bb, data, (size_t)len * BBS);
+			data += (size_t)len * BBS;
+		}
+		off += len;
+		nbbs -= len;
+	}
+}
+
+/*
+ * Stores the extent list in the inode, through indirect extents if it does
+ * not fit. The first indirect extent carries their count in its offset.
+ */
+static void
+mk_set_extents(mk_t *m, efs_od_inode_t *di, efs_od_extent_t *ext,
+    uint32_t n)
+{
+	efs_od_extent_t *ind = NULL;
+	uint32_t nind = 0;
+	uint32_t cap = 0;
+
+	di->di_nextents = htons(n);
+	if (n <= EFS_DIRECTEXTENTS) {
+		if (n > 0)
+			memcpy(di->di_u.di_extents, ext, n * sizeof (*ext));
+		return;
+	}
+
+	mk_extents(m, 0, (n + EFS_EXTENTS_PER_BB - 1) / EFS_EXTENTS_PER_BB,
+	    MK_EXT_MAX, NULL, &ind, &nind, &cap);
+	if (m->m_err != 0 || nind > EFS_DIRECTEXTENTS) {
+		m->m_err = m->m_err != 0 ? m->m_err : EFBIG;
+		free(ind);
+		return;
+	}
+	for (uint32_t i = 0, k = 0; i < nind; i++) {
+		uint32_t bb = ntohl(ind[i].ext1);
+		uint32_t len = ntohl(ind[i].ext2) >> 24;
+		size_t cnt = MIN((size_t)len * EFS_EXTENTS_PER_BB, n - k);
+		char *buf;
+
+		if ((buf = calloc(len, BBS)) == NULL) {
+			m->m_err = ENOMEM;
+			break;
+		}
+		memcpy(buf, &ext[k], cnt * sizeof (*ext));
+		mk_write(m, bb, buf, (size_t)len * BBS);
+		free(buf);
+		k += cnt;
+		di->di_u.di_extents[i].ext1 = ind[i].ext1;
+		di->di_u.di_extents[i].ext2 = htonl(len << 24 |
+		    (i == 0 ? nind : 0));
+	}
+	free(ind);
+}
+
+static void
+mk_file(mk_t *m, uint32_t ino)
+{
+	uint32_t size = mk_file_size(m);
+	uint32_t nbbs = (size + BBS - 1) / BBS;
+	int holes = mk_rand_range(m, 1, 100) <= m->m_hole_pct;
+	uint64_t seed = mk_rand(m) | 1;
+	efs_od_extent_t *ext = NULL;
+	uint32_t next = 0;
+	uint32_t cap = 0;
+	efs_od_inode_t di;
+	char *data = NULL;
+
+	if (m->m_fd != -1 && nbbs > 0) {
+		uint64_t *p;
+
+		if ((data = calloc(nbbs, BBS)) == NULL) {
+			m->m_err = ENOMEM;
+			return;
+		}
+		p = (uint64_t *)data;
+		for (size_t i = 0; i < size / sizeof (*p); i++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			p[i] = seed;
+		}
+	}
+
+	/* runs of allocated BBs; with holes, every third BB is skipped */
+	for (uint32_t bb = 0; bb < nbbs; ) {
+		uint32_t run = nbbs - bb;
+
+		if (holes) {
+			if (bb % 3 == 1 && bb != nbbs - 1) {
+				bb++;
+				continue;
+			}
+			run = MIN(run, bb % 3 == 2 ? 2 : 1);
+		}
+		mk_extents(m, bb, run, m->m_ext_max,
+		    data != NULL ? data + (size_t)bb * BBS : NULL, &ext, &next,
+		    &cap);
+		bb += run;
+	}
+
+	mk_inode_init(&di, S_IFREG | 0644, 1, size, ino);
+	mk_set_extents(m, &di, ext, next);
+	mk_put_inode(m, ino, &di);
+	free(ext);
+	free(data);
+}
+
+/*
+ * Packs the entries into directory blocks like efs(4) does: the entries
+ * grow down from the end of the block, the slot table up after the header.
+ */
+static char *
+mk_dir_blocks(mk_dirent_t *ents, uint32_t n, uint32_t *nblks)
+{
+	efs_dirblk_t *blks = NULL;
+	efs_dirblk_t *db = NULL;
+	uint32_t ino;
+	int top = 0;
+
+	*nblks = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		int len = strlen(ents[i].d_name);
+		int sz = (5 + len + 1) & ~1;
+
+		if (db == NULL || top - sz < EFS_DIRBLK_HDR_SIZE +
+		    db->db_slots + 1 || db->db_slots >= EFS_DIRBLK_SLOTS_MAX) {
+			efs_dirblk_t *nb;
+
+			if ((nb = realloc(blks, (*nblks + 1) * BBS)) == NULL) {
+				free(blks);
+				return (NULL);
+			}
+			blks = nb;
+			db = &blks[(*nblks)++];
+			memset(db, 0, BBS);
+			db->db_magic = htons(EFS_DIRBLK_MAGIC);
+			top = BBS;
+		}
+		top -= sz;
+		ino = htonl(ents[i].d_ino);
+		memcpy((char *)db + top, &ino, sizeof (ino));
+		((uint8_t *)db)[top + 4] = len;
+		memcpy((char *)db + top + 5, ents[i].d_name, len);
+		db->db_space[db->db_slots++] = top >> 1;
+		db->db_first = top >> 1;
+	}
+
+	return ((char *)blks);
+}
+
+static void
+mk_dir(mk_t *m, uint32_t ino, uint32_t parent, uint32_t depth)
+{
+	uint32_t nfiles = m->m_files / m->m_ndirs +
+	    (m->m_dirno < m->m_files % m->m_ndirs);
+	uint32_t nsub = depth < m->m_depth ? m->m_fanout : 0;
+	uint32_t n = 0;
+	efs_od_extent_t *ext = NULL;
+	uint32_t next = 0;
+	uint32_t cap = 0;
+	efs_od_inode_t di;
+	mk_dirent_t *ents;
+	uint32_t nblks;
+	char *blks;
+
+	m->m_dirno++;
+	if ((ents = calloc(2 + nfiles + nsub, sizeof (*ents))) == NULL) {
+		m->m_err = ENOMEM;
+		return;
+	}
+	ents[n].d_ino = ino;
+	(void) strcpy(ents[n++].d_name, ".");
+	ents[n].d_ino = parent;
+	(void) strcpy(ents[n++].d_name, "..");
+
+	for (uint32_t i = 0; i < nfiles && m->m_err == 0; i++, n++) {
+		ents[n].d_ino = m->m_next_ino++;
+		(void) snprintf(ents[n].d_name, sizeof (ents[n].d_name),
+		    "f%u", i);
+		mk_file(m, ents[n].d_ino);
+	}
+	for (uint32_t i = 0; i < nsub && m->m_err == 0; i++, n++) {
+		ents[n].d_ino = m->m_next_ino++;
+		(void) snprintf(ents[n].d_name, sizeof (ents[n].d_name),
+		    "d%u", i);
+		mk_dir(m, ents[n].d_ino, ino, depth + 1);
+	}
+
+	if ((blks = mk_dir_blocks(ents, n, &nblks)) == NULL) {
+		m->m_err = m->m_err != 0 ? m->m_err : ENOMEM;
+	} else {
+		mk_extents(m, 0, nblks, m->m_ext_max, blks, &ext, &next,
+		    &cap);
+		mk_inode_init(&di, S_IFDIR | 0755, 2 + nsub, nblks * BBS, ino);
+		mk_set_extents(m, &di, ext, next);
+		mk_put_inode(m, ino, &di);
+	}
+	free(blks);
+	free(ext);
+	free(ents);
+}
+
+static void
+mk_tree(mk_t *m)
+{
+	uint32_t first_cg = 2 * MK_PART_START;
+
+	m->m_rng = m->m_seed * 0x9e3779b97f4a7c15ULL | 1;
+	m->m_dirno = 0;
+	m->m_next_ino = FIRST_INO + 1;
+	m->m_cg = 0;
+	m->m_next_bb = first_cg + m->m_ino_bbs;
+	m->m_data_bbs = 0;
+	mk_dir(m, FIRST_INO, FIRST_INO, 0);
+}
+
+/*
+ * Lays out the CGs: enough inode BBs in each for all inodes and enough
+ * CGs for the data found by a dry run, with one spare CG for the space
+ * lost at CG ends.
+ */
+static int
+mk_layout(mk_t *m)
+{
+	uint64_t ninos = FIRST_INO + 1 + (uint64_t)m->m_files + m->m_ndirs;
+	uint64_t data;
+
+	m->m_fd = -1;
+	m->m_ino_bbs = 1;
+	mk_tree(m);
+	if (m->m_err != 0)
+		return (m->m_err);
+	data = m->m_data_bbs;
+
+	for (m->m_ncg = 1; ; m->m_ncg++) {
+		m->m_ino_bbs = (ninos + m->m_ncg * INOS_PER_BB - 1) /
+		    (m->m_ncg * INOS_PER_BB);
+		if (m->m_ino_bbs < m->m_cg_size / 2 &&
+		    (uint64_t)(m->m_ncg - 1) * (m->m_cg_size -
+		    m->m_ino_bbs) >= data)
+			break;
+		if ((uint64_t)m->m_ncg * m->m_cg_size > MK_MAX_BBS)
+			return (EFBIG);
+	}
+	if (m->m_ino_bbs > INT16_MAX || m->m_ncg > INT16_MAX)
+		return (EFBIG);
+
+	return (0);
+}
+
+/*
+ * Writes the free block bitmap, a set bit is a free data block. Blocks are
+ * allocated in order, so all CGs before m_cg are full.
+ */
+static void
+mk_bitmap(mk_t *m, uint32_t bmblock, uint32_t bmbbs)
+{
+	uint32_t first_cg = 2 * MK_PART_START;
+	uint8_t *bm;
+
+	if ((bm = calloc(bmbbs, BBS)) == NULL) {
+		m->m_err = ENOMEM;
+		return;
+	}
+	for (uint32_t cg = m->m_cg; cg < m->m_ncg; cg++) {
+		uint32_t b = first_cg + cg * m->m_cg_size + m->m_ino_bbs;
+		uint32_t end = first_cg + (cg + 1) * m->m_cg_size;
+
+		if (cg == m->m_cg)
+			b = m->m_next_bb;
+		for (; b < end; b++)
+			bm[b >> 3] |= 1 << (b & 7);
+	}
+	mk_write(m, bmblock, bm, (size_t)bmbbs * BBS);
+	free(bm);
+}
+
+static int
+mk_image(mk_t *m, const char *path)
+{
+	uint32_t first_cg = 2 * MK_PART_START;
+	uint32_t bmblock, bmbbs, prev;
+	uint32_t fs_size;
+	efs_vol_hdr_t vh;
+	efs_sb_t sb;
+	int err;
+
+	if ((err = mk_layout(m)) != 0)
+		return (err);
+	/* the bitmap covers itself too */
+	bmblock = first_cg + m->m_ncg * m->m_cg_size;
+	bmbbs = 0;
+	do {
+		prev = bmbbs;
+		bmbbs = (bmblock + bmbbs + BBS * 8 - 1) / (BBS * 8);
+	} while (bmbbs != prev);
+	fs_size = bmblock + bmbbs;
+
+	if ((m->m_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1)
+		return (errno);
+	if (ftruncate(m->m_fd, (off_t)(MK_PART_START + fs_size) * BBS) != 0) {
+		err = errno;
+		(void) close(m->m_fd);
+		return (err);
+	}
+
+	memset(&vh, 0, sizeof (vh));
+	vh.h_magic = htonl(BOOT_BLOCK_MAGIC);
+	vh.h_pt[MK_PART].p_blocks = htonl(fs_size);
+	vh.h_pt[MK_PART].p_first = htonl(MK_PART_START);
+	vh.h_pt[MK_PART].p_type = htonl(PART_EFS);
+	vh.h_pt[10].p_blocks = htonl(MK_PART_START + fs_size);
+	vh.h_pt[10].p_type = htonl(PART_WD);
+	if (pwrite(m->m_fd, &vh, sizeof (vh), 0) != sizeof (vh))
+		m->m_err = errno;
+
+	mk_tree(m);
+	if (m->m_err == 0 && m->m_cg >= m->m_ncg)
+		m->m_err = ENOSPC;
+	mk_bitmap(m, bmblock, bmbbs);
+
+	memset(&sb, 0, sizeof (sb));
+	sb.s_size = htonl(fs_size);
+	sb.s_first_cg = htonl(first_cg);
+	sb.s_cg_size = htonl(m->m_cg_size);
+	sb.s_cg_ino_bbs = htons(m->m_ino_bbs);
+	sb.s_ncg = htons(m->m_ncg);
+	sb.s_time = htonl(MK_TIME);
+	sb.s_magic = htonl(EFS_NEWMAGIC);
+	memcpy(sb.s_fname, "bench", 5);
+	memcpy(sb.s_fpack, "efsmk", 5);
+	sb.s_bmsize = htonl((fs_size + 7) / 8);
+	sb.s_bmblock = htonl(bmblock);
+	sb.s_blk_free = htonl(m->m_ncg * (m->m_cg_size - m->m_ino_bbs) -
+	    m->m_data_bbs);
+	sb.s_ino_free = htonl(m->m_ncg * m->m_ino_bbs * INOS_PER_BB -
+	    m->m_next_ino);
+	mk_write(m, 1, &sb, sizeof (sb));
+
+	if (close(m->m_fd) != 0 && m->m_err == 0)
+		m->m_err = errno;
+
+	return (m->m_err);
+}
+
+static int
+parse_u32(const char *s, uint32_t *v)
+{
+	char *end;
+	unsigned long l;
+
+	errno = 0;
+	l = strtoul(s, &end, 0);
+	if (errno != 0 || end == s || *end != '\0' || l > UINT32_MAX)
+		return (EINVAL);
+	*v = l;
+	return (0);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <image>\n", prog);
+	fprintf(stderr, "\t-n <N>\t\tNumber of files (default 10000)\n");
+	fprintf(stderr, "\t-f <N>\t\tSubdirectories per directory "
+	    "(default 8)\n");
+	fprintf(stderr, "\t-d <N>\t\tDepth of the directory tree (default 2)\n");
+	fprintf(stderr, "\t-s <min:max>\tFile size range in bytes, "
+	    "log-uniform (default 0:65536)\n");
+	fprintf(stderr, "\t-e <N>\t\tLongest extent in BBs, 1-%d "
+	    "(default %d)\n", MK_EXT_MAX, MK_EXT_MAX);
+	fprintf(stderr, "\t-H <pct>\tPercentage of files with holes "
+	    "(default 0)\n");
+	fprintf(stderr, "\t-c <N>\t\tCylinder group size in BBs "
+	    "(default 16384)\n");
+	fprintf(stderr, "\t-r <N>\t\tRandom seed (default 1)\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	mk_t m = { 10000, 8, 2, 0, 65536, MK_EXT_MAX, 0, 16384, 1 };
+	uint32_t seed = 1;
+	uint64_t level = 1;
+	char *colon;
+	int err = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:f:d:s:e:H:c:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			err = parse_u32(optarg, &m.m_files);
+			break;
+		case 'f':
+			err = parse_u32(optarg, &m.m_fanout);
+			break;
+		case 'd':
+			err = parse_u32(optarg, &m.m_depth);
+			break;
+		case 's':
+			if ((colon = strchr(optarg, ':')) == NULL) {
+				err = EINVAL;
+				break;
+			}
+			*colon = '\0';
+			if ((err = parse_u32(optarg, &m.m_size_min)) == 0)
+				err = parse_u32(colon + 1, &m.m_size_max);
+			break;
+		case 'e':
+			err = parse_u32(optarg, &m.m_ext_max);
+			break;
+		case 'H':
+			err = parse_u32(optarg, &m.m_hole_pct);
+			break;
+		case 'c':
+			err = parse_u32(optarg, &m.m_cg_size);
+			break;
+		case 'r':
+			err = parse_u32(optarg, &seed);
+			break;
+		default:
+			err = EINVAL;
+			break;
+		}
+		if (err != 0)
+			break;
+	}
+	if (err != 0 || optind != argc - 1 || m.m_size_min > m.m_size_max ||
+	    m.m_size_max > INT32_MAX || m.m_ext_max < 1 ||
+	    m.m_ext_max > MK_EXT_MAX || m.m_hole_pct > 100 ||
+	    m.m_cg_size < 2 * MK_EXT_MAX || m.m_fanout > 1000000) {
+		usage(argv[0]);
+		return (2);
+	}
+	m.m_seed = seed;
+
+	/* directories in a complete tree */
+	m.m_ndirs = 0;
+	for (uint32_t d = 0; d <= m.m_depth; d++, level *= m.m_fanout) {
+		m.m_ndirs += level;
+		if (m.m_ndirs > 1000000 || level == 0)
+			break;
+	}
+	if (m.m_ndirs > 1000000) {
+		fprintf(stderr, "%s: too many directories\n", argv[0]);
+		return (1);
+	}
+
+	if ((err = mk_image(&m, argv[optind])) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(err));
+		return (1);
+	}
+	printf("%s: %u files, %u directories, %u CGs of %u BBs, "
+	    "%llu data BBs\n", argv[optind], m.m_files, m.m_ndirs, m.m_ncg,
+	    m.m_cg_size, (unsigned long long)m.m_data_bbs);
+
+	return (0);
+}
@@ -0,0 +1,746 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * End-to-end benchmark of a mounted image. The image is mounted with the
+ * fuse-efs binary once for every combination of mount options, thread
+ * count and workload, so each run starts with cold caches in both the
+ * kernel and the daemon. The workloads are:
+ *
+ *	stat_tree	readdir and lstat of every entry, like find -ls
+ *	ls_bigdir	readdir and lstat of the largest directory, like ls -l
+ *	small_reads	open, read in full and close all files up to 64 KB
+ *	seq_stream	sequential 1 MB reads of the largest files
+ *	rand_4k		random 4 KB preads of the most fragmented files
+ *
+ * Directories and files are shared among the threads through a common
+ * index, except ls_bigdir and rand_4k where each thread does the whole
+ * job. Every run is written as one JSON object per line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+
+#include "../utils.h"
+#include "../efs_fuse.h"
+
+#define	MB_SMALL_MAX	(64 * 1024)
+#define	MB_NLARGE	8
+#define	MB_NFRAG	16
+#define	MB_RAND_OPS	4096	/* preads per thread in rand_4k */
+#define	MB_SEQ_BUF	(1024 * 1024)
+#define	MB_MOUNT_WAIT	100	/* 50 ms polls */
+
+typedef struct mb_obj {
+	char	*o_path;	/* relative to the mountpoint */
+	off_t	o_size;		/* file size or number of entries */
+	uint32_t o_nexts;
+} mb_obj_t;
+
+typedef struct mb_set {
+	mb_obj_t *s_objs;
+	uint32_t s_n;
+} mb_set_t;
+
+typedef struct mb {
+	const char *m_prog;	/* fuse-efs binary */
+	const char *m_image;
+	const char *m_mnt;
+	mb_set_t m_dirs;
+	mb_set_t m_small;
+	mb_set_t m_large;
+	mb_set_t m_frag;
+	uint32_t m_bigdir;	/* index into m_dirs */
+	pid_t	m_pid;		/* mounted daemon */
+} mb_t;
+
+typedef struct mb_run mb_run_t;
+typedef struct mb_thread mb_thread_t;
+
+typedef struct mb_work {
+	const char *w_name;
+	int (*w_func)(mb_run_t *, mb_thread_t *);
+} mb_work_t;
+
+struct mb_run {
+	mb_t	*r_mb;
+	const mb_work_t *r_work;
+	uint32_t r_next;	/* shared index */
+};
+
+struct mb_thread {
+	mb_run_t *t_run;
+	pthread_t t_tid;
+	uint64_t t_rng;
+	uint64_t t_ops;
+	uint64_t t_bytes;
+	int	t_err;
+};
+
+static uint64_t
+mb_now(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static uint64_t
+mb_rand(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return (*s);
+}
+
+static int
+mb_add(mb_set_t *s, const char *path, off_t size, uint32_t nexts)
+{
+	mb_obj_t *no;
+
+	if ((s->s_n & (s->s_n - 1)) == 0) {
+		if ((no = realloc(s->s_objs, MAX(s->s_n * 2, 1) *
+		    sizeof (mb_obj_t))) == NULL)
+			return (ENOMEM);
+		s->s_objs = no;
+	}
+	if ((s->s_objs[s->s_n].o_path = strdup(path)) == NULL)
+		return (ENOMEM);
+	s->s_objs[s->s_n].o_size = size;
+	s->s_objs[s->s_n++].o_nexts = nexts;
+
+	return (0);
+}
+
+static void
+mb_free(mb_set_t *s)
+{
+	for (uint32_t i = 0; i < s->s_n; i++)
+		free(s->s_objs[i].o_path);
+	free(s->s_objs);
+	s->s_objs = NULL;
+	s->s_n = 0;
+}
+
+static char *
+mb_path(const mb_t *m, const char *rel, char *buf, size_t len)
+{
+	(void) snprintf(buf, len, "%s%s", m->m_mnt, rel);
+	return (buf);
+}
+
+/*
+ * Number of extents of a file, from the extent map xattr.
+ */
+static uint32_t
+mb_nexts(const char *path)
+{
+	char *buf;
+	ssize_t len;
+	uint32_t n = 0;
+
+	if ((len = getxattr(path, EFS_XATTR_EXTENTS, NULL, 0)) <= 0 ||
+	    (buf = malloc(len)) == NULL)
+		return (0);
+	if ((len = getxattr(path, EFS_XATTR_EXTENTS, buf, len)) > 0) {
+		for (ssize_t i = 0; i < len; i++)
+			n += buf[i] == '\n';
+	}
+	free(buf);
+
+	return (n);
+}
+
+static int
+mb_cmp_size(const void *a, const void *b)
+{
+	const mb_obj_t *oa = a, *ob = b;
+
+	return (oa->o_size < ob->o_size ? 1 : oa->o_size > ob->o_size ? -1 : 0);
+}
+
+static int
+mb_cmp_nexts(const void *a, const void *b)
+{
+	const mb_obj_t *oa = a, *ob = b;
+
+	return (oa->o_nexts < ob->o_nexts ? 1 :
+	    oa->o_nexts > ob->o_nexts ? -1 : 0);
+}
+
+/*
+ * Walks the mounted tree breadth first and picks the objects of the
+ * workloads. Large and fragmented files are first collected among all
+ * files bigger than MB_SMALL_MAX and then trimmed to the top ones.
+ */
+static int
+mb_scan(mb_t *m)
+{
+	int err;
+
+	if ((err = mb_add(&m->m_dirs, "", 0, 0)) != 0)
+		return (err);
+	for (uint32_t d = 0; d < m->m_dirs.s_n; d++) {
+		char path[4096];
+		struct dirent *de;
+		DIR *dp;
+		off_t n = 0;
+
+		if ((dp = opendir(mb_path(m, m->m_dirs.s_objs[d].o_path, path,
+		    sizeof (path)))) == NULL)
+			return (errno);
+		while ((de = readdir(dp)) != NULL && err == 0) {
+			char rel[4096];
+			struct stat st;
+
+			if (strcmp(de->d_name, ".") == 0 ||
+			    strcmp(de->d_name, "..") == 0)
+				continue;
+			n++;
+			(void) snprintf(rel, sizeof (rel), "%s/%s",
+			    m->m_dirs.s_objs[d].o_path, de->d_name);
+			if (lstat(mb_path(m, rel, path, sizeof (path)),
+			    &st) != 0)
+				continue;
+			if (S_ISDIR(st.st_mode))
+				err = mb_add(&m->m_dirs, rel, 0, 0);
+			else if (S_ISREG(st.st_mode) &&
+			    st.st_size <= MB_SMALL_MAX)
+				err = mb_add(&m->m_small, rel, st.st_size, 0);
+			else if (S_ISREG(st.st_mode))
+				err = mb_add(&m->m_large, rel, st.st_size,
+				    mb_nexts(path));
+		}
+		(void) closedir(dp);
+		if (err != 0)
+			return (err);
+		m->m_dirs.s_objs[d].o_size = n;
+		if (n > m->m_dirs.s_objs[m->m_bigdir].o_size)
+			m->m_bigdir = d;
+	}
+
+	for (uint32_t i = 0; i < m->m_large.s_n; i++) {
+		mb_obj_t *o = &m->m_large.s_objs[i];
+
+		if ((err = mb_add(&m->m_frag, o->o_path, o->o_size,
+		    o->o_nexts)) != 0)
+			return (err);
+	}
+	if (m->m_large.s_n == 0)
+		return (0);
+	qsort(m->m_large.s_objs, m->m_large.s_n, sizeof (mb_obj_t),
+	    mb_cmp_size);
+	while (m->m_large.s_n > MB_NLARGE)
+		free(m->m_large.s_objs[--m->m_large.s_n].o_path);
+	qsort(m->m_frag.s_objs, m->m_frag.s_n, sizeof (mb_obj_t),
+	    mb_cmp_nexts);
+	while (m->m_frag.s_n > MB_NFRAG)
+		free(m->m_frag.s_objs[--m->m_frag.s_n].o_path);
+
+	return (0);
+}
+
+/*
+ * Takes the next object of a shared set, returns -1 when all are done.
+ */
+static int64_t
+mb_take(mb_run_t *r, const mb_set_t *s)
+{
+	uint32_t i = __atomic_fetch_add(&r->r_next, 1, __ATOMIC_RELAXED);
+
+	return (i < s->s_n ? (int64_t)i : -1);
+}
+
+static int
+mb_list(mb_run_t *r, const char *rel, uint64_t *ops)
+{
+	char path[4096];
+	struct dirent *de;
+	DIR *dp;
+	int fd;
+
+	if ((dp = opendir(mb_path(r->r_mb, rel, path, sizeof (path)))) ==
+	    NULL)
+		return (errno);
+	fd = dirfd(dp);
+	while ((de = readdir(dp)) != NULL) {
+		struct stat st;
+
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0)
+			continue;
+		if (fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+			(void) closedir(dp);
+			return (errno);
+		}
+		(*ops)++;
+	}
+	(void) closedir(dp);
+
+	return (0);
+}
+
+static int
+mb_stat_tree(mb_run_t *r, mb_thread_t *t)
+{
+	int64_t i;
+	int err;
+
+	while ((i = mb_take(r, &r->r_mb->m_dirs)) >= 0) {
+		if ((err = mb_list(r, r->r_mb->m_dirs.s_objs[i].o_path,
+		    &t->t_ops)) != 0)
+			return (err);
+	}
+
+	return (0);
+}
+
+static int
+mb_ls_bigdir(mb_run_t *r, mb_thread_t *t)
+{
+	return (mb_list(r, r->r_mb->m_dirs.s_objs[r->r_mb->m_bigdir].o_path,
+	    &t->t_ops));
+}
+
+/*
+ * Reads a whole file with the given buffer, returns the bytes read in
+ * *bytes.
+ */
+static int
+mb_read_file(mb_run_t *r, const char *rel, char *buf, size_t len,
+    uint64_t *bytes)
+{
+	char path[4096];
+	ssize_t got;
+	int fd;
+
+	if ((fd = open(mb_path(r->r_mb, rel, path, sizeof (path)),
+	    O_RDONLY)) < 0)
+		return (errno);
+	while ((got = read(fd, buf, len)) > 0)
+		*bytes += got;
+	if (got < 0) {
+		int err = errno;
+
+		(void) close(fd);
+		return (err);
+	}
+	(void) close(fd);
+
+	return (0);
+}
+
+static int
+mb_small_reads(mb_run_t *r, mb_thread_t *t)
+{
+	char buf[MB_SMALL_MAX];
+	int64_t i;
+	int err;
+
+	while ((i = mb_take(r, &r->r_mb->m_small)) >= 0) {
+		if ((err = mb_read_file(r, r->r_mb->m_small.s_objs[i].o_path,
+		    buf, sizeof (buf), &t->t_bytes)) != 0)
+			return (err);
+		t->t_ops++;
+	}
+
+	return (0);
+}
+
+static int
+mb_seq_stream(mb_run_t *r, mb_thread_t *t)
+{
+	char *buf;
+	int64_t i;
+	int err = 0;
+
+	if ((buf = malloc(MB_SEQ_BUF)) == NULL)
+		return (ENOMEM);
+	while (err == 0 && (i = mb_take(r, &r->r_mb->m_large)) >= 0) {
+		uint64_t before = t->t_bytes;
+
+		err = mb_read_file(r, r->r_mb->m_large.s_objs[i].o_path, buf,
+		    MB_SEQ_BUF, &t->t_bytes);
+		t->t_ops += (t->t_bytes - before + MB_SEQ_BUF - 1) /
+		    MB_SEQ_BUF;
+	}
+	free(buf);
+
+	return (err);
+}
+
+static int
+mb_rand_4k(mb_run_t *r, mb_thread_t *t)
+{
+	const mb_set_t *s = &r->r_mb->m_frag;
+	int fds[MB_NFRAG];
+	char buf[4096];
+	int err = 0;
+
+	for (uint32_t i = 0; i < s->s_n; i++) {
+		char path[4096];
+
+		if ((fds[i] = open(mb_path(r->r_mb, s->s_objs[i].o_path, path,
+		    sizeof (path)), O_RDONLY)) < 0) {
+			err = errno;
+			while (i-- > 0)
+				(void) close(fds[i]);
+			return (err);
+		}
+	}
+	for (uint32_t k = 0; k < MB_RAND_OPS && s->s_n > 0; k++) {
+		uint32_t i = mb_rand(&t->t_rng) % s->s_n;
+		off_t nblk = MAX(s->s_objs[i].o_size / sizeof (buf), 1);
+		off_t off = (mb_rand(&t->t_rng) % nblk) * sizeof (buf);
+		ssize_t got;
+
+		if ((got = pread(fds[i], buf, sizeof (buf), off)) < 0) {
+			err = errno;
+			break;
+		}
+		t->t_bytes += got;
+		t->t_ops++;
+	}
+	for (uint32_t i = 0; i < s->s_n; i++)
+		(void) close(fds[i]);
+
+	return (err);
+}
+
+static const mb_work_t mb_works[] = {
+	{ "stat_tree", mb_stat_tree },
+	{ "ls_bigdir", mb_ls_bigdir },
+	{ "small_reads", mb_small_reads },
+	{ "seq_stream", mb_seq_stream },
+	{ "rand_4k", mb_rand_4k },
+	{ NULL, NULL }
+};
+
+/*
+ * Starts fuse-efs in the foreground with the given space separated
+ * options and waits until the mountpoint changes its device.
+ */
+static int
+mb_mount(mb_t *m, const char *opts)
+{
+	char *args[64], *copy, *tok, *last;
+	char fsopt[4096];
+	struct stat before, st;
+	int n = 0;
+	int status;
+
+	if (stat(m->m_mnt, &before) != 0)
+		return (errno);
+	if ((copy = strdup(opts)) == NULL)
+		return (ENOMEM);
+	(void) snprintf(fsopt, sizeof (fsopt), "--fs=%s", m->m_image);
+	args[n++] = (char *)m->m_prog;
+	args[n++] = fsopt;
+	for (tok = strtok_r(copy, " ", &last); tok != NULL && n < 60;
+	    tok = strtok_r(NULL, " ", &last))
+		args[n++] = tok;
+	args[n++] = "-f";
+	args[n++] = (char *)m->m_mnt;
+	args[n] = NULL;
+
+	if ((m->m_pid = fork()) < 0) {
+		free(copy);
+		return (errno);
+	}
+	if (m->m_pid == 0) {
+		(void) execv(m->m_prog, args);
+		perror(m->m_prog);
+		_exit(127);
+	}
+	free(copy);
+
+	for (int i = 0; i < MB_MOUNT_WAIT; i++) {
+		if (waitpid(m->m_pid, &status, WNOHANG) == m->m_pid) {
+			fprintf(stderr, "%s exited with status %d\n",
+			    m->m_prog, WEXITSTATUS(status));
+			m->m_pid = 0;
+			return (ECHILD);
+		}
+		if (stat(m->m_mnt, &st) == 0 && st.st_dev != before.st_dev)
+			return (0);
+		(void) usleep(50000);
+	}
+	(void) kill(m->m_pid, SIGTERM);
+	(void) waitpid(m->m_pid, &status, 0);
+	m->m_pid = 0;
+
+	return (ETIMEDOUT);
+}
+
+static void
+mb_umount(mb_t *m)
+{
+	pid_t pid;
+	int status;
+
+	if (m->m_pid == 0)
+		return;
+	if ((pid = fork()) == 0) {
+		(void) execlp("fusermount3", "fusermount3", "-u", m->m_mnt,
+		    (char *)NULL);
+		(void) execlp("fusermount", "fusermount", "-u", m->m_mnt,
+		    (char *)NULL);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		(void) kill(m->m_pid, SIGTERM);
+	(void) waitpid(m->m_pid, &status, 0);
+	m->m_pid = 0;
+}
+
+static void *
+mb_thread(void *arg)
+{
+	mb_thread_t *t = arg;
+
+	t->t_err = t->t_run->r_work->w_func(t->t_run, t);
+	return (NULL);
+}
+
+static void
+mb_json_str(const char *s)
+{
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			putchar('\\');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+/*
+ * One workload at one thread count on a fresh mount.
+ */
+static int
+mb_run(mb_t *m, const mb_work_t *w, const char *opts, uint32_t nthreads,
+    uint64_t seed)
+{
+	mb_thread_t *t;
+	mb_run_t r;
+	uint64_t start, mstart, ops = 0, bytes = 0;
+	double secs;
+	uint32_t i;
+	int err = 0;
+
+	if ((t = calloc(nthreads, sizeof (mb_thread_t))) == NULL)
+		return (ENOMEM);
+	memset(&r, 0, sizeof (r));
+	r.r_mb = m;
+	r.r_work = w;
+
+	mstart = mb_now();
+	if ((err = mb_mount(m, opts)) != 0) {
+		fprintf(stderr, "cannot mount %s with '%s': %s\n", m->m_image,
+		    opts, strerror(err));
+		free(t);
+		return (err);
+	}
+	start = mb_now();
+	for (i = 0; i < nthreads; i++) {
+		t[i].t_run = &r;
+		t[i].t_rng = seed + i * 0x9e3779b97f4a7c15ULL;
+		if (t[i].t_rng == 0)
+			t[i].t_rng = 1;
+		if ((err = pthread_create(&t[i].t_tid, NULL, mb_thread,
+		    &t[i])) != 0)
+			break;
+	}
+	nthreads = i;
+	for (i = 0; i < nthreads; i++) {
+		(void) pthread_join(t[i].t_tid, NULL);
+		if (err == 0)
+			err = t[i].t_err;
+		ops += t[i].t_ops;
+		bytes += t[i].t_bytes;
+	}
+	secs = (mb_now() - start) / 1e9;
+	mb_umount(m);
+	free(t);
+
+	if (err != 0) {
+		fprintf(stderr, "%s with '%s' failed: %s\n", w->w_name, opts,
+		    strerror(err));
+		return (err);
+	}
+	printf("{\"workload\": \"%s\", \"options\": ", w->w_name);
+	mb_json_str(opts);
+	printf(", \"threads\": %u, \"ops\": %llu, \"bytes\": %llu, "
+	    "\"seconds\": %.6f, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f, "
+	    "\"mount_seconds\": %.6f}\n", nthreads, (unsigned long long)ops,
+	    (unsigned long long)bytes, secs, secs > 0 ? ops / secs : 0,
+	    secs > 0 ? bytes / secs / (1024 * 1024) : 0,
+	    (start - mstart) / 1e9);
+	(void) fflush(stdout);
+
+	return (0);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <image>\n", prog);
+	fprintf(stderr, "\t-b <path>\tfuse-efs binary (default ./fuse-efs)\n");
+	fprintf(stderr, "\t-m <dir>\tMountpoint (default a temporary "
+	    "directory)\n");
+	fprintf(stderr, "\t-o <opts>\tSpace separated mount options, may be "
+	    "repeated\n\t\t\t(default '', '--lowlevel' and "
+	    "'--lowlevel --no-keep-cache')\n");
+	fprintf(stderr, "\t-t <list>\tComma separated thread counts "
+	    "(default 1,4,16)\n");
+	fprintf(stderr, "\t-w <list>\tComma separated workloads "
+	    "(default all)\n");
+	fprintf(stderr, "\t-r <N>\tRandom seed of rand_4k (default 1)\n");
+}
+
+static int
+mb_selected(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+
+	if (list == NULL)
+		return (1);
+	for (const char *p = list; (p = strstr(p, name)) != NULL; p += len) {
+		if ((p == list || p[-1] == ',') &&
+		    (p[len] == '\0' || p[len] == ','))
+			return (1);
+	}
+
+	return (0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const char *def_opts[] = { "", "--lowlevel",
+	    "--lowlevel --no-keep-cache" };
+	const char *opts[16];
+	const char *threads = "1,4,16", *works = NULL;
+	char tmpmnt[] = "/tmp/efs-mountbench.XXXXXX";
+	uint32_t nopts = 0;
+	uint64_t seed = 1;
+	mb_t m;
+	int err = 0;
+	int c;
+
+	memset(&m, 0, sizeof (m));
+	m.m_prog = "./fuse-efs";
+	while ((c = getopt(argc, argv, "b:m:o:t:w:r:")) != -1) {
+		switch (c) {
+		case 'b':
+			m.m_prog = optarg;
+			break;
+		case 'm':
+			m.m_mnt = optarg;
+			break;
+		case 'o':
+			if (nopts < sizeof (opts) / sizeof (opts[0]))
+				opts[nopts++] = optarg;
+			break;
+		case 't':
+			threads = optarg;
+			break;
+		case 'w':
+			works = optarg;
+			break;
+		case 'r':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return (2);
+		}
+	}
+	if (optind != argc - 1 || seed == 0) {
+		usage(argv[0]);
+		return (2);
+	}
+	m.m_image = argv[optind];
+	if (nopts == 0) {
+		for (; nopts < sizeof (def_opts) / sizeof (def_opts[0]); nopts++)
+			opts[nopts] = def_opts[nopts];
+	}
+	if (m.m_mnt == NULL && (m.m_mnt = mkdtemp(tmpmnt)) == NULL) {
+		perror("mkdtemp");
+		return (1);
+	}
+
+	if ((err = mb_mount(&m, opts[0])) != 0) {
+		fprintf(stderr, "cannot mount %s: %s\n", m.m_image,
+		    strerror(err));
+		goto out;
+	}
+	err = mb_scan(&m);
+	mb_umount(&m);
+	if (err != 0) {
+		fprintf(stderr, "cannot scan %s: %s\n", m.m_image,
+		    strerror(err));
+		goto out;
+	}
+
+	for (uint32_t o = 0; o < nopts && err == 0; o++) {
+		for (const char *p = threads; *p != '\0' && err == 0; ) {
+			char *end;
+			unsigned long n = strtoul(p, &end, 10);
+
+			if (end == p || n == 0) {
+				fprintf(stderr, "bad thread count list: %s\n",
+				    threads);
+				err = EINVAL;
+				break;
+			}
+			for (const mb_work_t *w = mb_works; w->w_name != NULL &&
+			    err == 0; w++) {
+				if (mb_selected(works, w->w_name))
+					err = mb_run(&m, w, opts[o], n, seed);
+			}
+			p = *end == ',' ? end + 1 : end;
+		}
+	}
+
+out:
+	if (m.m_mnt == tmpmnt)
+		(void) rmdir(tmpmnt);
+	mb_free(&m.m_dirs);
+	mb_free(&m.m_small);
+	mb_free(&m.m_large);
+	mb_free(&m.m_frag);
+
+	return (err != 0);
+}
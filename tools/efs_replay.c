@@ -0,0 +1,683 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Replays a recording written by fuse-efs --record=<path>, either through
+ * the core library against an image or through the system calls against
+ * a mountpoint. Records are replayed one at a time in the order they
+ * started, as fast as possible or, with -t, at their original times.
+ *
+ * Handles are matched by the recorded file and directory handles. In the
+ * library mode an operation is done the way the FUSE handlers do it; the
+ * extended attribute calls only look up the inode, their formatting is
+ * part of the FUSE glue. Low-level recordings address inodes, so in the
+ * mountpoint mode paths are rebuilt from the recorded lookups and records
+ * of unknown inodes are skipped.
+ *
+ * Per operation, the output has the number of records, the records whose
+ * result differed from the recorded one, the skipped records and the
+ * replay latency.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+
+#include "../utils.h"
+#include "../efs_fs.h"
+#include "../efs_vol.h"
+#include "../efs_file.h"
+#include "../efs_dir.h"
+#include "../efs_fuse.h"
+#include "../efs_prefetch.h"
+#include "../efs_stats.h"
+#include "../efs_record.h"
+
+#define	RP_BUCKETS	4096
+#define	RP_BATCH	64
+
+typedef struct rp_rec {
+	efs_record_t rr_rec;
+	char	*rr_path;	/* NUL terminated, NULL if none */
+	uint32_t rr_seq;	/* position in the file */
+} rp_rec_t;
+
+/* An open handle or a known inode path, by recorded handle or inode */
+typedef struct rp_ent {
+	uint64_t e_key;
+	union {
+		efs_file_t *e_file;
+		efs_dir_snap_t *e_ds;
+		int	e_fd;
+		DIR	*e_dir;
+		char	*e_path;
+	} e_u;
+	struct rp_ent *e_next;
+} rp_ent_t;
+
+typedef struct rp_stat {
+	uint64_t s_count;
+	uint64_t s_diff;	/* result differs from the recording */
+	uint64_t s_skipped;
+	uint64_t s_ns;
+	uint64_t s_max_ns;
+} rp_stat_t;
+
+typedef struct rp {
+	efs_fs_t p_fs;
+	const char *p_mnt;	/* mountpoint mode if set */
+	rp_ent_t *p_handles[RP_BUCKETS];
+	rp_ent_t *p_paths[RP_BUCKETS];
+	char	*p_buf;
+	size_t	p_buflen;
+	rp_stat_t p_stats[EFS_OP_NOPS];
+} rp_t;
+
+static rp_ent_t **
+rp_find(rp_ent_t **tab, uint64_t key)
+{
+	rp_ent_t **ep = &tab[(key ^ (key >> 17)) % RP_BUCKETS];
+
+	while (*ep != NULL && (*ep)->e_key != key)
+		ep = &(*ep)->e_next;
+	return (ep);
+}
+
+static rp_ent_t *
+rp_get(rp_ent_t **tab, uint64_t key)
+{
+	return (*rp_find(tab, key));
+}
+
+static rp_ent_t *
+rp_insert(rp_ent_t **tab, uint64_t key)
+{
+	rp_ent_t **ep = rp_find(tab, key);
+
+	if (*ep == NULL && (*ep = calloc(1, sizeof (rp_ent_t))) != NULL)
+		(*ep)->e_key = key;
+	return (*ep);
+}
+
+/* Unlinks an entry, the caller frees it. */
+static rp_ent_t *
+rp_remove(rp_ent_t **tab, uint64_t key)
+{
+	rp_ent_t **ep = rp_find(tab, key);
+	rp_ent_t *e = *ep;
+
+	if (e != NULL)
+		*ep = e->e_next;
+	return (e);
+}
+
+static int
+rp_bufsize(rp_t *p, size_t len)
+{
+	char *nb;
+
+	if (len <= p->p_buflen)
+		return (0);
+	if ((nb = realloc(p->p_buf, len)) == NULL)
+		return (ENOMEM);
+	p->p_buf = nb;
+	p->p_buflen = len;
+
+	return (0);
+}
+
+/*
+ * Library mode. Paths come from the high-level API, inode numbers from
+ * the low-level one.
+ */
+static int
+rl_inode(rp_t *p, const rp_rec_t *rr, efs_inode_t **inode)
+{
+	int err;
+
+	if (rr->rr_path != NULL)
+		err = efs_dir_namei(&p->p_fs, rr->rr_path, inode);
+	else
+		err = efs_iget(&p->p_fs, rr->rr_rec.r_ino, inode);
+	if (err == 0 && EFS_BAD_FILE((*inode)))
+		err = EIO;
+
+	return (err);
+}
+
+/*
+ * Handles opened before the recording started are opened on first use.
+ */
+static int
+rl_file(rp_t *p, const rp_rec_t *rr, efs_file_t **fp)
+{
+	efs_inode_t *inode;
+	rp_ent_t *e;
+	int err;
+
+	if ((e = rp_get(p->p_handles, rr->rr_rec.r_fh)) != NULL) {
+		*fp = e->e_u.e_file;
+		return (0);
+	}
+	if ((err = rl_inode(p, rr, &inode)) != 0 ||
+	    (err = efs_file_open(inode, fp)) != 0)
+		return (err);
+	if ((e = rp_insert(p->p_handles, rr->rr_rec.r_fh)) == NULL) {
+		efs_file_close(*fp);
+		return (ENOMEM);
+	}
+	e->e_u.e_file = *fp;
+
+	return (0);
+}
+
+static int
+rl_dir(rp_t *p, const rp_rec_t *rr, efs_dir_snap_t **dsp)
+{
+	efs_inode_t *inode;
+	rp_ent_t *e;
+	int err;
+
+	if ((e = rp_get(p->p_handles, rr->rr_rec.r_fh)) != NULL) {
+		*dsp = e->e_u.e_ds;
+		return (0);
+	}
+	if ((err = rl_inode(p, rr, &inode)) != 0 ||
+	    (err = efs_dir_snap_get(inode, dsp)) != 0)
+		return (err);
+	if ((e = rp_insert(p->p_handles, rr->rr_rec.r_fh)) == NULL) {
+		efs_dir_snap_rele(*dsp);
+		return (ENOMEM);
+	}
+	e->e_u.e_ds = *dsp;
+
+	return (0);
+}
+
+static int
+rl_replay(rp_t *p, const rp_rec_t *rr)
+{
+	const efs_record_t *r = &rr->rr_rec;
+	efs_inode_t *inode;
+	efs_dir_snap_t *ds;
+	efs_file_t *f;
+	struct statvfs sv;
+	rp_ent_t *e;
+	size_t nread;
+	uint32_t ino;
+	off_t res;
+	int err;
+
+	switch (r->r_op) {
+	case EFS_OP_LOOKUP:
+		if ((err = efs_iget(&p->p_fs, r->r_ino, &inode)) == 0 &&
+		    (err = efs_dir_lookup(inode, rr->rr_path, &ino)) == 0)
+			err = efs_iget(&p->p_fs, ino, &inode);
+		return (err);
+	case EFS_OP_GETATTR:
+	case EFS_OP_GETXATTR:
+	case EFS_OP_LISTXATTR:
+		return (rl_inode(p, rr, &inode));
+	case EFS_OP_OPEN:
+		if ((err = rl_file(p, rr, &f)) == 0)
+			efs_prefetch_open(f->f_inode);
+		return (err);
+	case EFS_OP_READ:
+		if ((err = rp_bufsize(p, r->r_size)) != 0 ||
+		    (err = rl_file(p, rr, &f)) != 0)
+			return (err);
+		return (efs_file_pread(f, p->p_buf, r->r_size, r->r_off,
+		    &nread));
+	case EFS_OP_LSEEK:
+		if ((err = rl_file(p, rr, &f)) != 0)
+			return (err);
+		return (efs_seek_data(f->f_inode, r->r_off, r->r_size, &res));
+	case EFS_OP_RELEASE:
+		if ((e = rp_remove(p->p_handles, r->r_fh)) != NULL) {
+			efs_file_close(e->e_u.e_file);
+			free(e);
+		}
+		return (0);
+	case EFS_OP_OPENDIR:
+		if ((err = rl_dir(p, rr, &ds)) == 0)
+			efs_prefetch_dir(ds);
+		return (err);
+	case EFS_OP_READDIR:
+		if ((err = rl_dir(p, rr, &ds)) != 0)
+			return (err);
+		for (uint32_t i = r->r_off; i < MIN(r->r_off + r->r_size,
+		    ds->ds_nentries) && err == 0; i += RP_BATCH) {
+			efs_inode_t *items[RP_BATCH];
+			uint32_t inos[RP_BATCH];
+			uint32_t n = MIN(RP_BATCH, r->r_off + r->r_size - i);
+
+			n = MIN(n, ds->ds_nentries - i);
+			for (uint32_t k = 0; k < n; k++)
+				inos[k] = ds->ds_entries[i + k].dse_ino;
+			err = efs_iget_batch(&p->p_fs, inos, n, items);
+		}
+		return (err);
+	case EFS_OP_RELEASEDIR:
+		if ((e = rp_remove(p->p_handles, r->r_fh)) != NULL) {
+			efs_dir_snap_rele(e->e_u.e_ds);
+			free(e);
+		}
+		return (0);
+	case EFS_OP_STATFS:
+		efs_fs_statvfs(&p->p_fs, &sv);
+		return (0);
+	}
+
+	return (EINVAL);
+}
+
+/*
+ * Mountpoint mode.
+ */
+static const char *
+rm_path(rp_t *p, const rp_rec_t *rr, char *buf, size_t len)
+{
+	rp_ent_t *e;
+
+	if (rr->rr_path != NULL) {
+		(void) snprintf(buf, len, "%s%s", p->p_mnt, rr->rr_path);
+	} else if (rr->rr_rec.r_ino == FIRST_INO) {
+		(void) snprintf(buf, len, "%s", p->p_mnt);
+	} else if ((e = rp_get(p->p_paths, rr->rr_rec.r_ino)) != NULL) {
+		(void) snprintf(buf, len, "%s%s", p->p_mnt, e->e_u.e_path);
+	} else {
+		return (NULL);
+	}
+
+	return (buf);
+}
+
+static int
+rm_remember(rp_t *p, uint32_t ino, const char *parent, const char *name)
+{
+	char path[4096];
+	rp_ent_t *e;
+
+	(void) snprintf(path, sizeof (path), "%s/%s", parent, name);
+	if ((e = rp_insert(p->p_paths, ino)) == NULL)
+		return (ENOMEM);
+	free(e->e_u.e_path);
+	if ((e->e_u.e_path = strdup(path)) == NULL)
+		return (ENOMEM);
+
+	return (0);
+}
+
+/*
+ * Returns -1 if the path of the record is not known.
+ */
+static int
+rm_replay(rp_t *p, const rp_rec_t *rr)
+{
+	const efs_record_t *r = &rr->rr_rec;
+	char path[4096];
+	struct statvfs sv;
+	struct stat st;
+	rp_ent_t *e;
+	int err = 0;
+
+	if (r->r_op == EFS_OP_STATFS)
+		return (statvfs(p->p_mnt, &sv) != 0 ? errno : 0);
+	if (r->r_op == EFS_OP_LOOKUP) {
+		rp_ent_t *pe = rp_get(p->p_paths, r->r_ino);
+		const char *parent = pe != NULL ? pe->e_u.e_path : "";
+
+		if (pe == NULL && r->r_ino != FIRST_INO)
+			return (-1);
+		(void) snprintf(path, sizeof (path), "%s%s/%s", p->p_mnt,
+		    parent, rr->rr_path);
+		if (lstat(path, &st) != 0)
+			return (errno);
+		return (r->r_off != 0 ? rm_remember(p, r->r_off, parent,
+		    rr->rr_path) : 0);
+	}
+
+	switch (r->r_op) {
+	case EFS_OP_READ:
+	case EFS_OP_LSEEK:
+	case EFS_OP_RELEASE:
+	case EFS_OP_READDIR:
+	case EFS_OP_RELEASEDIR:
+		if ((e = rp_get(p->p_handles, r->r_fh)) != NULL)
+			break;
+		if (r->r_op == EFS_OP_RELEASE || r->r_op == EFS_OP_RELEASEDIR)
+			return (0);
+		/* FALLTHROUGH */
+	default:
+		e = NULL;
+		if (rm_path(p, rr, path, sizeof (path)) == NULL)
+			return (-1);
+		break;
+	}
+
+	switch (r->r_op) {
+	case EFS_OP_GETATTR:
+		return (lstat(path, &st) != 0 ? errno : 0);
+	case EFS_OP_GETXATTR:
+		if ((err = rp_bufsize(p, MAX(r->r_size, 1))) != 0)
+			return (err);
+		return (getxattr(path, EFS_XATTR_EXTENTS, p->p_buf,
+		    r->r_size) < 0 ? errno : 0);
+	case EFS_OP_LISTXATTR:
+		if ((err = rp_bufsize(p, MAX(r->r_size, 1))) != 0)
+			return (err);
+		return (listxattr(path, p->p_buf, r->r_size) < 0 ? errno : 0);
+	case EFS_OP_OPEN:
+	case EFS_OP_READ:
+	case EFS_OP_LSEEK:
+		if (e == NULL) {
+			int fd;
+
+			if ((fd = open(path, O_RDONLY)) < 0)
+				return (errno);
+			if ((e = rp_insert(p->p_handles, r->r_fh)) == NULL) {
+				(void) close(fd);
+				return (ENOMEM);
+			}
+			e->e_u.e_fd = fd;
+		}
+		if (r->r_op == EFS_OP_READ) {
+			if ((err = rp_bufsize(p, r->r_size)) != 0)
+				return (err);
+			return (pread(e->e_u.e_fd, p->p_buf, r->r_size,
+			    r->r_off) < 0 ? errno : 0);
+		}
+		if (r->r_op == EFS_OP_LSEEK)
+			return (lseek(e->e_u.e_fd, r->r_off, r->r_size) < 0 ?
+			    errno : 0);
+		return (0);
+	case EFS_OP_RELEASE:
+		(void) rp_remove(p->p_handles, r->r_fh);
+		(void) close(e->e_u.e_fd);
+		free(e);
+		return (0);
+	case EFS_OP_OPENDIR:
+	case EFS_OP_READDIR:
+		if (e == NULL) {
+			DIR *dp;
+
+			if ((dp = opendir(path)) == NULL)
+				return (errno);
+			if ((e = rp_insert(p->p_handles, r->r_fh)) == NULL) {
+				(void) closedir(dp);
+				return (ENOMEM);
+			}
+			e->e_u.e_dir = dp;
+		}
+		if (r->r_op == EFS_OP_READDIR) {
+			if (r->r_off == 0)
+				rewinddir(e->e_u.e_dir);
+			for (uint32_t i = 0; i < r->r_size &&
+			    readdir(e->e_u.e_dir) != NULL; i++)
+				;
+		}
+		return (0);
+	case EFS_OP_RELEASEDIR:
+		(void) rp_remove(p->p_handles, r->r_fh);
+		(void) closedir(e->e_u.e_dir);
+		free(e);
+		return (0);
+	}
+
+	return (EINVAL);
+}
+
+static int
+rp_cmp(const void *a, const void *b)
+{
+	const rp_rec_t *x = a;
+	const rp_rec_t *y = b;
+
+	if (x->rr_rec.r_ts != y->rr_rec.r_ts)
+		return (x->rr_rec.r_ts < y->rr_rec.r_ts ? -1 : 1);
+	return (x->rr_seq < y->rr_seq ? -1 : x->rr_seq > y->rr_seq);
+}
+
+/*
+ * Reads the whole recording and sorts it by start time.
+ */
+static int
+rp_load(const char *path, rp_rec_t **recs, uint32_t *nrecs)
+{
+	efs_record_hdr_t rh;
+	rp_rec_t *rv = NULL;
+	uint32_t n = 0;
+	FILE *f;
+	int err = 0;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return (errno);
+	if (fread(&rh, sizeof (rh), 1, f) != 1 ||
+	    rh.rh_magic != EFS_RECORD_MAGIC ||
+	    rh.rh_version != EFS_RECORD_VERSION ||
+	    rh.rh_recsize != sizeof (efs_record_t)) {
+		(void) fclose(f);
+		return (EINVAL);
+	}
+
+	for (;;) {
+		efs_record_t r;
+		rp_rec_t *nv;
+
+		/* A short last record is a recording cut by a crash. */
+		if (fread(&r, sizeof (r), 1, f) != 1 || r.r_op >= EFS_OP_NOPS)
+			break;
+		if ((n & (n - 1)) == 0) {
+			if ((nv = realloc(rv, MAX(n * 2, 1) *
+			    sizeof (rp_rec_t))) == NULL) {
+				err = ENOMEM;
+				break;
+			}
+			rv = nv;
+		}
+		rv[n].rr_rec = r;
+		rv[n].rr_seq = n;
+		rv[n].rr_path = NULL;
+		if (r.r_pathlen > 0) {
+			if ((rv[n].rr_path = malloc(r.r_pathlen + 1)) == NULL) {
+				err = ENOMEM;
+				break;
+			}
+			if (fread(rv[n].rr_path, 1, r.r_pathlen, f) !=
+			    r.r_pathlen) {
+				free(rv[n].rr_path);
+				break;
+			}
+			rv[n].rr_path[r.r_pathlen] = '\0';
+		}
+		n++;
+	}
+	(void) fclose(f);
+
+	if (n > 0)
+		qsort(rv, n, sizeof (rp_rec_t), rp_cmp);
+	*recs = rv;
+	*nrecs = n;
+
+	return (err);
+}
+
+static void
+rp_free(rp_t *p, rp_rec_t *recs, uint32_t nrecs)
+{
+	for (uint32_t i = 0; i < nrecs; i++)
+		free(recs[i].rr_path);
+	free(recs);
+
+	for (int b = 0; b < RP_BUCKETS; b++) {
+		rp_ent_t *e;
+
+		while ((e = p->p_handles[b]) != NULL) {
+			p->p_handles[b] = e->e_next;
+			free(e);
+		}
+		while ((e = p->p_paths[b]) != NULL) {
+			p->p_paths[b] = e->e_next;
+			free(e->e_u.e_path);
+			free(e);
+		}
+	}
+	free(p->p_buf);
+}
+
+static void
+rp_report(const rp_t *p, uint64_t ns)
+{
+	printf("%-12s %10s %8s %8s %12s %12s\n", "op", "count", "diff",
+	    "skipped", "avg_us", "max_us");
+	for (int op = 0; op < EFS_OP_NOPS; op++) {
+		const rp_stat_t *s = &p->p_stats[op];
+		uint64_t done = s->s_count - s->s_skipped;
+
+		if (s->s_count == 0)
+			continue;
+		printf("%-12s %10llu %8llu %8llu %12.3f %12.3f\n",
+		    efs_stats_op_name(op), (unsigned long long)s->s_count,
+		    (unsigned long long)s->s_diff,
+		    (unsigned long long)s->s_skipped,
+		    done > 0 ? s->s_ns / 1000.0 / done : 0,
+		    s->s_max_ns / 1000.0);
+	}
+	printf("total %.6f s\n", ns / 1e9);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <recording> <image | "
+	    "mountpoint>\n", prog);
+	fprintf(stderr, "\t-m\tReplay against a mountpoint instead of an "
+	    "image\n");
+	fprintf(stderr, "\t-t\tKeep the original timing\n");
+	fprintf(stderr, "\t-p <N>\tPartition of the image\n");
+	fprintf(stderr, "\t-P <N>\tPrefetch depth, 0 disables (default %d)\n",
+	    EFS_PREFETCH_DEPTH);
+	fprintf(stderr, "\t-s\tPrint the library statistics at the end\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static rp_t p;
+	rp_rec_t *recs;
+	uint32_t nrecs;
+	uint64_t t0;
+	int mnt = 0, timed = 0, stats = 0;
+	int part = -1, depth = EFS_PREFETCH_DEPTH;
+	int err;
+	int c;
+
+	while ((c = getopt(argc, argv, "mtp:P:s")) != -1) {
+		switch (c) {
+		case 'm':
+			mnt = 1;
+			break;
+		case 't':
+			timed = 1;
+			break;
+		case 'p':
+			part = atoi(optarg);
+			break;
+		case 'P':
+			depth = atoi(optarg);
+			break;
+		case 's':
+			stats = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return (2);
+		}
+	}
+	if (optind != argc - 2) {
+		usage(argv[0]);
+		return (2);
+	}
+
+	if ((err = rp_load(argv[optind], &recs, &nrecs)) != 0) {
+		fprintf(stderr, "%s: cannot read the recording: %s\n",
+		    argv[optind], strerror(err));
+		return (1);
+	}
+	if (mnt) {
+		p.p_mnt = argv[optind + 1];
+	} else if (efs_vol_open(&p.p_fs, argv[optind + 1], part) != 0 ||
+	    efs_mount(&p.p_fs) != 0) {
+		fprintf(stderr, "%s: cannot open the image\n",
+		    argv[optind + 1]);
+		return (1);
+	} else {
+		(void) efs_prefetch_start(&p.p_fs, depth);
+	}
+
+	t0 = efs_stats_now();
+	for (uint32_t i = 0; i < nrecs; i++) {
+		const efs_record_t *r = &recs[i].rr_rec;
+		rp_stat_t *s = &p.p_stats[r->r_op];
+		uint64_t start;
+
+		if (timed) {
+			uint64_t due = t0 + r->r_ts - recs[0].rr_rec.r_ts;
+			struct timespec ts;
+
+			ts.tv_sec = due / 1000000000ULL;
+			ts.tv_nsec = due % 1000000000ULL;
+			(void) clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			    &ts, NULL);
+		}
+		start = efs_stats_now();
+		err = mnt ? rm_replay(&p, &recs[i]) : rl_replay(&p, &recs[i]);
+		start = efs_stats_now() - start;
+		s->s_count++;
+		if (err == -1) {
+			s->s_skipped++;
+			continue;
+		}
+		s->s_ns += start;
+		s->s_max_ns = MAX(s->s_max_ns, start);
+		if (MIN(err, UINT8_MAX) != r->r_err)
+			s->s_diff++;
+	}
+	rp_report(&p, efs_stats_now() - t0);
+
+	if (!mnt) {
+		efs_prefetch_stop();
+		if (stats)
+			(void) efs_stats_dump("-");
+		efs_umount(&p.p_fs);
+		efs_vol_close(&p.p_fs);
+	}
+	rp_free(&p, recs, nrecs);
+
+	return (0);
+}
@@ -0,0 +1,153 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Prints the attributes of files in an EFS image like stat(1), without
+ * mounting it:
+ *
+ *	efs-stat [-p <N>] <image> <path> ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "../libefs.h"
+
+static const char *
+st_type(mode_t mode)
+{
+	switch (mode & S_IFMT) {
+	case S_IFREG:
+		return ("regular file");
+	case S_IFDIR:
+		return ("directory");
+	case S_IFLNK:
+		return ("symbolic link");
+	case S_IFCHR:
+		return ("character special file");
+	case S_IFBLK:
+		return ("block special file");
+	case S_IFIFO:
+		return ("fifo");
+	case S_IFSOCK:
+		return ("socket");
+	default:
+		return ("unknown");
+	}
+}
+
+static void
+st_time(const char *what, time_t t)
+{
+	char date[64];
+	struct tm tm;
+
+	(void) strftime(date, sizeof (date), "%Y-%m-%d %H:%M:%S +0000",
+	    gmtime_r(&t, &tm));
+	printf("%s: %s\n", what, date);
+}
+
+static int
+st_print(efs_ctx_t *ctx, const char *path)
+{
+	char target[PATH_MAX];
+	struct stat st;
+	int err;
+
+	if ((err = efs_ctx_stat(ctx, path, &st)) != 0)
+		return (err);
+
+	printf("  File: %s", path);
+	if (S_ISLNK(st.st_mode) &&
+	    efs_ctx_readlink(ctx, path, target, sizeof (target)) == 0)
+		printf(" -> %s", target);
+	printf("\n");
+	printf("  Size: %-10lld Blocks: %-10lld IO Block: %-6ld %s\n",
+	    (long long)st.st_size, (long long)st.st_blocks,
+	    (long)st.st_blksize, st_type(st.st_mode));
+	printf(" Inode: %-10lu Links: %lu", (unsigned long)st.st_ino,
+	    (unsigned long)st.st_nlink);
+	if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode))
+		printf("  Device type: %x,%x", major(st.st_rdev),
+		    minor(st.st_rdev));
+	printf("\n");
+	printf("Access: (%04o)  Uid: %5u  Gid: %5u\n",
+	    (unsigned)(st.st_mode & 07777), (unsigned)st.st_uid,
+	    (unsigned)st.st_gid);
+	st_time("Access", st.st_atime);
+	st_time("Modify", st.st_mtime);
+	st_time("Change", st.st_ctime);
+
+	return (0);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <image> <path> ...\n", prog);
+	fprintf(stderr, "\t-p <N>\tPartition of the image\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	efs_ctx_t *ctx;
+	int part = -1;
+	int rc = 0;
+	int c, err;
+
+	while ((c = getopt(argc, argv, "p:")) != -1) {
+		switch (c) {
+		case 'p':
+			part = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return (2);
+		}
+	}
+	if (optind + 2 > argc) {
+		usage(argv[0]);
+		return (2);
+	}
+
+	if ((err = efs_ctx_open(argv[optind], part, 0, &ctx)) != 0) {
+		fprintf(stderr, "%s: cannot open the image: %s\n", argv[optind],
+		    strerror(err));
+		return (1);
+	}
+
+	for (int k = optind + 1; k < argc; k++) {
+		if ((err = st_print(ctx, argv[k])) != 0) {
+			fprintf(stderr, "%s: %s\n", argv[k], strerror(err));
+			rc = 1;
+		}
+	}
+
+	efs_ctx_close(ctx);
+
+	return (rc);
+}
@@ -0,0 +1,156 @@
+/*
+ * fuse-efs - FUSE module for SGI EFS
+ * https://github.com/senjan/fuse-efs
+ * Copyright (C) 2024 Jan Senolt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Decodes a trace file written by fuse-efs --trace=<path>. The events of
+ * all threads are merged and printed in time order, one per line:
+ *
+ *	<us since the first event> <thread id> <event> <arguments>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "../efs_stats.h"
+#include "../efs_trace.h"
+
+typedef struct ev {
+	efs_trace_rec_t e_rec;
+	uint32_t e_tid;
+} ev_t;
+
+static int
+ev_cmp(const void *a, const void *b)
+{
+	const ev_t *x = a;
+	const ev_t *y = b;
+
+	if (x->e_rec.tr_ts != y->e_rec.tr_ts)
+		return (x->e_rec.tr_ts < y->e_rec.tr_ts ? -1 : 1);
+	return (x->e_tid < y->e_tid ? -1 : x->e_tid > y->e_tid);
+}
+
+static void
+ev_print(const ev_t *e, uint64_t t0)
+{
+	const efs_trace_rec_t *r = &e->e_rec;
+
+	printf("%12.3f %7u ", (r->tr_ts - t0) / 1000.0, e->e_tid);
+	switch (r->tr_ev) {
+	case EFS_TR_OP:
+		printf("op       %-10s %.3f us\n", efs_stats_op_name(r->tr_a0),
+		    r->tr_a1 / 1000.0);
+		break;
+	case EFS_TR_IGET:
+		printf("iget     ino %u %s\n", r->tr_a0,
+		    r->tr_a1 ? "cached" : "read");
+		break;
+	case EFS_TR_PREFETCH:
+		printf("prefetch ino %u, %llu inodes\n", r->tr_a0,
+		    (unsigned long long)r->tr_a1);
+		break;
+	case EFS_TR_INO2LOC:
+		printf("ino2loc  ino %u -> BB %llu, offset %llu\n", r->tr_a0,
+		    (unsigned long long)(r->tr_a1 >> 32),
+		    (unsigned long long)(r->tr_a1 & UINT32_MAX));
+		break;
+	case EFS_TR_BREAD:
+		printf("bread    %u bytes at 0x%llx\n", r->tr_a0,
+		    (unsigned long long)r->tr_a1);
+		break;
+	case EFS_TR_IREAD:
+		printf("iread    ino %u, BB %llu, %llu BBs\n", r->tr_a0,
+		    (unsigned long long)(r->tr_a1 >> 32),
+		    (unsigned long long)(r->tr_a1 & UINT32_MAX));
+		break;
+	default:
+		printf("event %u %u %llu\n", r->tr_ev, r->tr_a0,
+		    (unsigned long long)r->tr_a1);
+		break;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	efs_trace_hdr_t th;
+	ev_t *evs = NULL;
+	size_t nevs = 0;
+	FILE *f;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <trace file>\n", argv[0]);
+		return (2);
+	}
+	if ((f = fopen(argv[1], "r")) == NULL) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+		return (1);
+	}
+	if (fread(&th, sizeof (th), 1, f) != 1 ||
+	    th.th_magic != EFS_TRACE_MAGIC) {
+		fprintf(stderr, "%s: not a fuse-efs trace file\n", argv[1]);
+		return (1);
+	}
+	if (th.th_version != EFS_TRACE_VERSION ||
+	    th.th_recsize != sizeof (efs_trace_rec_t)) {
+		fprintf(stderr, "%s: unsupported trace version %u\n", argv[1],
+		    th.th_version);
+		return (1);
+	}
+
+	for (uint32_t i = 0; i < th.th_nrings; i++) {
+		efs_trace_ring_hdr_t rh;
+		ev_t *nevp;
+
+		if (fread(&rh, sizeof (rh), 1, f) != 1)
+			goto trunc;
+		if (rh.rh_total > rh.rh_nrecs) {
+			fprintf(stderr, "thread %u: %llu older events lost\n",
+			    rh.rh_tid,
+			    (unsigned long long)(rh.rh_total - rh.rh_nrecs));
+		}
+		if ((nevp = realloc(evs, (nevs + rh.rh_nrecs) *
+		    sizeof (ev_t))) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return (1);
+		}
+		evs = nevp;
+		for (uint32_t k = 0; k < rh.rh_nrecs; k++, nevs++) {
+			if (fread(&evs[nevs].e_rec, sizeof (efs_trace_rec_t), 1,
+			    f) != 1)
+				goto trunc;
+			evs[nevs].e_tid = rh.rh_tid;
+		}
+	}
+	(void) fclose(f);
+
+	qsort(evs, nevs, sizeof (ev_t), ev_cmp);
+	for (size_t k = 0; k < nevs; k++)
+		ev_print(&evs[k], evs[0].e_rec.tr_ts);
+	free(evs);
+
+	return (0);
+
+trunc:
+	fprintf(stderr, "%s: truncated trace file\n", argv[1]);
+	return (1);
+}
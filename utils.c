@@ -51,17 +51,21 @@ swap_int32(int32_t val)
 void
 logger(int level, int msg_level, char *msg, ...)
 {
+	FILE *out = msg_level == 0 ? stderr : stdout;
 	va_list argp;
 
 	if (msg_level > level)
 		return;
 
+	/* keep the prefix and the message of one thread together */
+	flockfile(out);
 	if (msg_level == 0)
-		fprintf(stderr, "Error: ");
+		fprintf(out, "Error: ");
 
 	va_start(argp, msg);
 
-	vfprintf(msg_level == 0 ? stderr : stdout, msg, argp);
+	vfprintf(out, msg, argp);
 
 	va_end(argp);
+	funlockfile(out);
 }
@@ -21,6 +21,7 @@
 #define	UTILS_H
 
 #include <sys/types.h>
+#include <stdint.h>
 
 #if !defined(__BYTE_ORDER__)
 #error __BYTE_ORDER__ must be defined!
@@ -45,10 +46,24 @@
 
 void logger(int level, int msg_level, char *msg, ...);
 
-#define	LOG_DBG3(fs, msg...) logger((fs)->log_lvl, 4, msg)
-#define	LOG_DBG2(fs, msg...) logger((fs)->log_lvl, 3, msg)
-#define	LOG_DBG1(fs, msg...) logger((fs)->log_lvl, 2, msg)
-#define	LOG_WARN(fs, msg...) logger((fs)->log_lvl, 1, msg)
+/*
+ * Messages above EFS_LOG_MAX are compiled out, the others cost a compare
+ * until the --debug level enables them. Hot paths use efs_trace.h instead.
+ */
+#ifndef EFS_LOG_MAX
+#define	EFS_LOG_MAX	4
+#endif
+
+#define	LOG_AT(fs, l, msg...)						\
+	do {								\
+		if ((l) <= EFS_LOG_MAX && (fs)->log_lvl >= (l))		\
+			logger((fs)->log_lvl, (l), msg);		\
+	} while (0)
+
+#define	LOG_DBG3(fs, msg...) LOG_AT(fs, 4, msg)
+#define	LOG_DBG2(fs, msg...) LOG_AT(fs, 3, msg)
+#define	LOG_DBG1(fs, msg...) LOG_AT(fs, 2, msg)
+#define	LOG_WARN(fs, msg...) LOG_AT(fs, 1, msg)
 #define	LOG_ERR(msg...) logger(0, 0, msg)
 
 uint16_t swap_uint16(uint16_t val);